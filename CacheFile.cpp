@@ -0,0 +1,446 @@
+/************************************************************
+  **** CacheFile.cpp (implementation of .h)
+   ***
+    ** Author:
+     *   Tommy Hellstrom
+     *
+     * Description:
+     *   Stores translated blocks in a file, so that
+     *   later runs of the same rom can skip translation
+     *
+     * Revision history:
+     *   When         Who       What
+     *   20261016     me        created
+     *
+     * License information:
+     *   GPLv3
+     *
+     ********************************************************/
+
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "CacheFile.h"
+
+/*
+ * File layout, all words are 32 bit in host byte order
+ *
+ * header   magic, version, key, region count, block count
+ * block    address, opcount, size, exit count, relocation count, data count,
+ *          exits (target, offset, type),
+ *          relocations (offset, region),
+ *          data read at translation time (address, size),
+ *          the emulated code (opcount * 2 bytes),
+ *          the emulated data (the sizes of the data),
+ *          the machine code (size bytes), padded to a word
+ *
+ * Exits are stored unlinked and relocated addresses are stored
+ * as offsets into their region.
+ */
+
+/**
+ * Read a word from the file
+ *
+ * PARAMS
+ * rpData   ref. to read position, moved past the word
+ * pEnd     end of the file
+ * rValue   the word is stored here
+ *
+ * RETURNS
+ * true if successful, false at end of file
+ */
+static bool readWord(const uint8_t *&rpData, const uint8_t *const pEnd, uint32_t &rValue)
+{
+    if(pEnd - rpData < 4)
+        return false;
+
+    memcpy(&rValue, rpData, 4);
+    rpData += 4;
+
+    return true;
+}
+
+/**
+ * Write a word to the file
+ *
+ * PARAMS
+ * pOut     file
+ * value    the word
+ *
+ * RETURNS
+ * true if successful, otherwise false
+ */
+static bool writeWord(FILE *const pOut, const uint32_t value)
+{
+    return fwrite(&value, 4, 1, pOut) == 1;
+}
+
+/**
+ * Check if a block is saved. Superblocks translated from several
+ * ranges of code and blocks in a convention are formed again.
+ *
+ * PARAMS
+ * pBlock   the block, may be NULL
+ *
+ * RETURNS
+ * true if the block is saved, otherwise false
+ */
+static bool isSaved(const CodeBlock *const pBlock)
+{
+    return pBlock != NULL && pBlock->ranges.size() == 1 && pBlock->residentOffset < 0;
+}
+
+/**
+ * Compute the key of a rom, a hash of the memory
+ * image and the translator version
+ *
+ * PARAMS
+ * c8_memArray  memory with the rom loaded
+ *
+ * RETURNS
+ * key of the rom
+ */
+uint32_t CacheFile::computeKey(const uint8_t c8_memArray[C8_MEMSIZE])
+{
+    //FNV-1a
+    uint32_t hash = 2166136261u ^ TR_VERSION;
+
+    for(int i = C8_PC_START; i < C8_MEMSIZE; i++)
+    {
+        hash ^= c8_memArray[i];
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+/**
+ * Loads translated blocks from the file into the cache.
+ * Blocks are relocated to the regions of the translator.
+ * Blocks that were translated from other code than what
+ * is in memory are skipped.
+ *
+ * PARAMS
+ * rCache       cache to insert the blocks into
+ * rTranslator  translator whose regions the code addresses
+ * c8_memArray  memory
+ *
+ * RETURNS
+ * number of blocks loaded
+ */
+int CacheFile::load(TranslationCache &rCache, const Translator &rTranslator, const uint8_t c8_memArray[C8_MEMSIZE])
+{
+    if(!mEnabled)
+        return 0;
+
+    const int fd = open(mPath, O_RDONLY);
+
+    if(fd < 0)
+        return 0;
+
+    struct stat info;
+
+    if(fstat(fd, &info) != 0 || info.st_size == 0)
+    {
+        close(fd);
+        return 0;
+    }
+
+    void *const pFile = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if(pFile == MAP_FAILED)
+        return 0;
+
+    const uint8_t *p = (const uint8_t *) pFile;
+    const uint8_t *const pEnd = p + info.st_size;
+    CodeArena *const pArena = rCache.getArena();
+    uint32_t magic, version, key, regionCount, blockCount;
+    int loaded = 0;
+
+    if(!readWord(p, pEnd, magic) || !readWord(p, pEnd, version) || !readWord(p, pEnd, key) ||
+       !readWord(p, pEnd, regionCount) || !readWord(p, pEnd, blockCount) ||
+       magic != CF_MAGIC || version != TR_VERSION || key != mKey ||
+       regionCount != (uint32_t) rTranslator.getRegionCount())
+    {
+        munmap(pFile, info.st_size);
+        return 0;
+    }
+
+    for(uint32_t b = 0; b < blockCount; b++)
+    {
+        uint32_t address, opcount, size, exitCount, relocCount, dataCount;
+
+        if(!readWord(p, pEnd, address) || !readWord(p, pEnd, opcount) || !readWord(p, pEnd, size) ||
+           !readWord(p, pEnd, exitCount) || !readWord(p, pEnd, relocCount) || !readWord(p, pEnd, dataCount))
+            break;
+
+        if(address >= C8_MEMSIZE || opcount == 0 || opcount > (C8_MEMSIZE - address) / C8_OPCODE_SIZE ||
+           size < 4 || size > CG_BLOCK_SIZE || exitCount > CB_MAX_EXITS || relocCount > size / 4 ||
+           dataCount > size / 4 ||
+           (uint32_t)(pEnd - p) < exitCount * 12 + relocCount * 8 + dataCount * 8 + opcount * C8_OPCODE_SIZE)
+            break;
+
+        const uint8_t *const pExits = p;
+        const uint8_t *const pRelocs = pExits + exitCount * 12;
+        const uint8_t *const pData = pRelocs + relocCount * 8;
+        const uint8_t *const pGuest = pData + dataCount * 8;
+        const uint8_t *pGuestData = pGuest + opcount * C8_OPCODE_SIZE;
+        std::list<CodeBlock::Data> data;
+        bool valid = true;
+
+        //data read at translation time follows the code it was read for
+        for(uint32_t i = 0; i < dataCount; i++)
+        {
+            CodeBlock::Data span;
+            uint32_t spanAddress = 0, spanSize = 0;
+            const uint8_t *q = pData + i * 8;
+
+            readWord(q, pEnd, spanAddress);
+            readWord(q, pEnd, spanSize);
+
+            if(spanAddress >= C8_MEMSIZE || spanSize == 0 || spanSize > C8_MEMSIZE - spanAddress ||
+               (uint32_t)(pEnd - pGuestData) < spanSize)
+            {
+                valid = false;
+                break;
+            }
+
+            span.address = spanAddress;
+            span.size = spanSize;
+            data.push_back(span);
+            pGuestData += spanSize;
+        }
+
+        if(!valid)
+            break;
+
+        const uint8_t *const pCode = pGuestData;
+        const uint32_t padding = (4 - size % 4) % 4;
+
+        if((uint32_t)(pEnd - pCode) < size + padding)
+            break;
+
+        p = pCode + size + padding;
+
+        //translated from other code than the rom contains now
+        if(memcmp(pGuest, c8_memArray + address, opcount * C8_OPCODE_SIZE) != 0 || rCache.exists(address))
+            continue;
+
+        pGuestData = pGuest + opcount * C8_OPCODE_SIZE;
+
+        for(std::list<CodeBlock::Data>::const_iterator it = data.begin(); it != data.end() && valid; ++it)
+        {
+            valid = memcmp(pGuestData, c8_memArray + it->address, it->size) == 0;
+            pGuestData += it->size;
+        }
+
+        if(!valid)
+            continue;
+
+        if(rCache.isFull() || pArena->getFreeSpace() < size)
+            break;
+
+        uint8_t *const pDest = pArena->top();
+        memcpy(pDest, pCode, size);
+
+        CodeBlock *const pBlock = new CodeBlock(pDest, address, opcount, size);
+        const uint8_t *q = pExits;
+
+        pBlock->data.swap(data);
+
+        for(uint32_t i = 0; i < exitCount; i++)
+        {
+            uint32_t target = 0, offset = 0, type = 0;
+
+            readWord(q, pEnd, target);
+            readWord(q, pEnd, offset);
+            readWord(q, pEnd, type);
+
+            if(target >= C8_MEMSIZE || offset > size - 4)
+                valid = false;
+            else
+                pBlock->addExit(target, offset, type);
+        }
+
+        for(uint32_t i = 0; i < relocCount && valid; i++)
+        {
+            uint32_t offset = 0, region = 0, value;
+
+            readWord(q, pEnd, offset);
+            readWord(q, pEnd, region);
+
+            if(offset > size - 4 || region >= regionCount)
+            {
+                valid = false;
+                break;
+            }
+
+            memcpy(&value, pDest + offset, 4);
+            value += rTranslator.getRegionBase(region);
+            memcpy(pDest + offset, &value, 4);
+
+            Relocation_t reloc;
+            reloc.offset = offset;
+            reloc.region = region;
+            pBlock->relocations.push_back(reloc);
+        }
+
+        if(!valid)
+        {
+            delete pBlock;
+            break;
+        }
+
+        pArena->commit(size);
+        rCache.insert(pBlock);
+        loaded++;
+    }
+
+    munmap(pFile, info.st_size);
+
+    return loaded;
+}
+
+/**
+ * Saves all blocks in the cache to the file.
+ * Superblocks translated from several ranges of
+ * code and blocks in a convention are not saved,
+ * they are formed again.
+ *
+ * PARAMS
+ * rCache       cache with blocks to save
+ * rTranslator  translator whose regions the code addresses
+ * c8_memArray  memory
+ *
+ * RETURNS
+ * true if successful, otherwise false
+ */
+bool CacheFile::save(const TranslationCache &rCache, const Translator &rTranslator, const uint8_t c8_memArray[C8_MEMSIZE]) const
+{
+    if(!mEnabled)
+        return false;
+
+    //written to a temporary file first, other runs may read the file
+    char tmpPath[CF_PATH_SIZE + 16];
+    sprintf(tmpPath, "%s.%d", mPath, (int) getpid());
+
+    FILE *const pOut = fopen(tmpPath, "wb");
+
+    if(pOut == NULL)
+        return false;
+
+    uint32_t blockCount = 0;
+
+    for(uint32_t address = 0; address < C8_MEMSIZE; address++)
+        if(isSaved(rCache.getBlock(address)))
+            blockCount++;
+
+    bool ok = writeWord(pOut, CF_MAGIC) && writeWord(pOut, TR_VERSION) && writeWord(pOut, mKey) &&
+              writeWord(pOut, rTranslator.getRegionCount()) && writeWord(pOut, blockCount);
+
+    uint8_t *const pCode = new uint8_t[CG_BLOCK_SIZE];
+    const uint8_t zero[4] = {0, 0, 0, 0};
+
+    for(uint32_t address = 0; address < C8_MEMSIZE && ok; address++)
+    {
+        const CodeBlock *const pBlock = rCache.getBlock(address);
+
+        if(!isSaved(pBlock))
+            continue;
+
+        if(pBlock->size > CG_BLOCK_SIZE)
+        {
+            ok = false;
+            break;
+        }
+
+        memcpy(pCode, (void *) pBlock->pfnCodeBlock, pBlock->size);
+
+        ok = writeWord(pOut, pBlock->address) && writeWord(pOut, pBlock->opcount) &&
+             writeWord(pOut, pBlock->size) && writeWord(pOut, pBlock->exitCount) &&
+             writeWord(pOut, pBlock->relocations.size()) && writeWord(pOut, pBlock->data.size());
+
+        for(int i = 0; i < pBlock->exitCount && ok; i++)
+        {
+            memset(pCode + pBlock->exits[i].offset, 0, 4);
+
+            ok = writeWord(pOut, pBlock->exits[i].target) && writeWord(pOut, pBlock->exits[i].offset) &&
+                 writeWord(pOut, pBlock->exits[i].type);
+        }
+
+        std::list<Relocation_t>::const_iterator it;
+
+        for(it = pBlock->relocations.begin(); it != pBlock->relocations.end() && ok; ++it)
+        {
+            uint32_t value;
+
+            memcpy(&value, pCode + it->offset, 4);
+            value -= rTranslator.getRegionBase(it->region);
+            memcpy(pCode + it->offset, &value, 4);
+
+            ok = writeWord(pOut, it->offset) && writeWord(pOut, it->region);
+        }
+
+        std::list<CodeBlock::Data>::const_iterator d;
+
+        for(d = pBlock->data.begin(); d != pBlock->data.end() && ok; ++d)
+            ok = writeWord(pOut, d->address) && writeWord(pOut, d->size);
+
+        const size_t padding = (4 - pBlock->size % 4) % 4;
+
+        ok = ok && fwrite(c8_memArray + pBlock->address, C8_OPCODE_SIZE, pBlock->opcount, pOut) == (size_t) pBlock->opcount;
+
+        for(d = pBlock->data.begin(); d != pBlock->data.end() && ok; ++d)
+            ok = fwrite(c8_memArray + d->address, 1, d->size, pOut) == (size_t) d->size;
+
+        ok = ok && fwrite(pCode, 1, pBlock->size, pOut) == pBlock->size &&
+             fwrite(zero, 1, padding, pOut) == padding;
+    }
+
+    delete [] pCode;
+
+    if(fclose(pOut) != 0)
+        ok = false;
+
+    if(ok)
+        ok = rename(tmpPath, mPath) == 0;
+
+    if(!ok)
+        remove(tmpPath);
+
+    return ok;
+}
+
+/**
+ * Check if a cache directory was given
+ *
+ * RETURNS
+ * true if the cache file is used, otherwise false
+ */
+bool CacheFile::isEnabled() const
+{
+    return mEnabled;
+}
+
+/**
+ * Constructor
+ * Must be created before the rom starts to execute
+ *
+ * PARAMS
+ * pDir         directory for cache files, NULL disables the cache file
+ * c8_memArray  memory with the rom loaded
+ */
+CacheFile::CacheFile(const char *const pDir, const uint8_t c8_memArray[C8_MEMSIZE])
+{
+    mKey = computeKey(c8_memArray);
+    mEnabled = pDir != NULL && strlen(pDir) + 32 < CF_PATH_SIZE;
+    mPath[0] = '\0';
+
+    if(mEnabled)
+        sprintf(mPath, "%s/chip86-%08x.cache", pDir, mKey);
+}
@@ -0,0 +1,111 @@
+/************************************************************
+  **** CacheFile.h (header)
+   ***
+    ** Author:
+     *   Tommy Hellstrom
+     *
+     * Description:
+     *   Stores translated blocks in a file, so that
+     *   later runs of the same rom can skip translation
+     *
+     * Revision history:
+     *   When         Who       What
+     *   20261016     me        created
+     *
+     * License information:
+     *   GPLv3
+     *
+     ********************************************************/
+
+#pragma once
+#ifndef _CACHEFILE_H_
+#define _CACHEFILE_H_
+
+#include <stdint.h>
+
+#include "Chip8def.h"
+#include "Translator.h"
+#include "TranslationCache.h"
+
+//max length of a cache file path
+#define CF_PATH_SIZE 1024
+
+//identifies a cache file
+#define CF_MAGIC 0x54363843  //"C86T"
+
+class CacheFile
+{
+    private:
+
+        char     mPath[CF_PATH_SIZE];
+        bool     mEnabled;
+        uint32_t mKey;
+
+        /**
+         * Compute the key of a rom, a hash of the memory
+         * image and the translator version
+         *
+         * PARAMS
+         * c8_memArray  memory with the rom loaded
+         *
+         * RETURNS
+         * key of the rom
+         */
+        static uint32_t computeKey(const uint8_t c8_memArray[C8_MEMSIZE]);
+
+    public:
+
+        /**
+         * Loads translated blocks from the file into the cache.
+         * Blocks are relocated to the regions of the translator.
+         * Blocks that were translated from other code than what
+         * is in memory are skipped.
+         *
+         * PARAMS
+         * rCache       cache to insert the blocks into
+         * rTranslator  translator whose regions the code addresses
+         * c8_memArray  memory
+         *
+         * RETURNS
+         * number of blocks loaded
+         */
+        int load(TranslationCache &rCache, const Translator &rTranslator, const uint8_t c8_memArray[C8_MEMSIZE]);
+
+        /**
+         * Saves all blocks in the cache to the file.
+         * Superblocks translated from several ranges of
+         * code and blocks in a convention are not saved,
+         * they are formed again.
+         *
+         * PARAMS
+         * rCache       cache with blocks to save
+         * rTranslator  translator whose regions the code addresses
+         * c8_memArray  memory
+         *
+         * RETURNS
+         * true if successful, otherwise false
+         */
+        bool save(const TranslationCache &rCache, const Translator &rTranslator, const uint8_t c8_memArray[C8_MEMSIZE]) const;
+
+        /**
+         * Check if a cache directory was given
+         *
+         * RETURNS
+         * true if the cache file is used, otherwise false
+         */
+        bool isEnabled() const;
+
+        /**
+         * Constructor
+         * Must be created before the rom starts to execute
+         *
+         * PARAMS
+         * pDir         directory for cache files, NULL disables the cache file
+         * c8_memArray  memory with the rom loaded
+         */
+            CacheFile(const char *const pDir, const uint8_t c8_memArray[C8_MEMSIZE]);
+        //   CacheFile(const CacheFile&);
+        //   CacheFile& CacheFile=(const CacheFile&);
+};
+
+#endif
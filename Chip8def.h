@@ -31,7 +31,9 @@
 #define C8_KEY_COUNT        16
 #define C8_RES_WIDTH        64
 #define C8_RES_HEIGHT       32
-#define C8_PIXEL_ON         1
 #define C8_PIXEL_OFF        0
 
+//a screen row is one 64 bit word, the leftmost pixel in the highest bit
+#define C8_PIXEL(row, x)    (((row) >> (C8_RES_WIDTH - 1 - (x))) & 1)
+
 #endif //_CHIP8DEF_H_
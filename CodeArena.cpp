@@ -0,0 +1,129 @@
+/************************************************************
+  **** CodeArena.cpp (implementation of .h)
+   ***
+    ** Author:
+     *   Tommy Hellstrom
+     *
+     * Description:
+     *   A single executable memory area that translated
+     *   code is emitted into (bump allocation)
+     *
+     * Revision history:
+     *   When         Who       What
+     *   20261016     me        created
+     *
+     * License information:
+     *   GPLv3
+     *
+     ********************************************************/
+
+#include <sys/mman.h>
+
+#include "CodeArena.h"
+#include "CodeGenerator.h"
+
+/**
+ * Get pointer to the first free byte in the arena.
+ * Code generation writes directly to this position.
+ *
+ * RETURNS
+ * pointer to the first free (aligned) byte
+ */
+uint8_t* CodeArena::top() const
+{
+    return pmArena + mTop;
+}
+
+/**
+ * Commit code written at top() and move top past it.
+ * Next top is aligned to CG_ALIGNMENT.
+ *
+ * PARAMS
+ * size     number of bytes written at top()
+ *
+ * RETURNS
+ * pointer to the committed code, NULL if it did not fit
+ */
+void* CodeArena::commit(const size_t size)
+{
+    if(size > getFreeSpace())
+        return NULL;
+
+    void *const pCode = pmArena + mTop;
+
+    mTop = (mTop + size + CG_ALIGNMENT - 1) & ~(size_t)(CG_ALIGNMENT - 1);
+
+    if(mTop > mSize)
+        mTop = mSize;
+
+    return pCode;
+}
+
+/**
+ * Return number of free bytes in the arena
+ *
+ * RETURNS
+ * number of free bytes
+ */
+size_t CodeArena::getFreeSpace() const
+{
+    return mSize - mTop;
+}
+
+/**
+ * Check if arena was successfully allocated
+ *
+ * RETURNS
+ * true if arena is usable, otherwise false
+ */
+bool CodeArena::isValid() const
+{
+    return pmArena != NULL;
+}
+
+/**
+ * Discard all code in the arena
+ */
+void CodeArena::reset()
+{
+    mTop = 0;
+}
+
+/**
+ * Constructor
+ *
+ * PARAMS
+ * size     size of the arena in bytes
+ */
+CodeArena::CodeArena(const size_t size)
+{
+#ifdef X86_LONG_MODE
+    //linked blocks and predicted returns hold 32 bit code addresses
+    void *const p = mmap(NULL, size, PROT_EXEC | PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_32BIT, -1, 0);
+#else
+    void *const p = mmap(NULL, size, PROT_EXEC | PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+#endif
+
+    if(p == MAP_FAILED)
+    {
+        pmArena = NULL;
+        mSize = 0;
+    }
+    else
+    {
+        //mmap returns page aligned memory
+        pmArena = (uint8_t *) p;
+        mSize = size;
+    }
+
+    mTop = 0;
+}
+
+/**
+ * Destructor
+ */
+CodeArena::~CodeArena()
+{
+    if(pmArena != NULL)
+        munmap(pmArena, mSize);
+}
@@ -0,0 +1,95 @@
+/************************************************************
+  **** CodeArena.h (header)
+   ***
+    ** Author:
+     *   Tommy Hellstrom
+     *
+     * Description:
+     *   A single executable memory area that translated
+     *   code is emitted into (bump allocation)
+     *
+     * Revision history:
+     *   When         Who       What
+     *   20261016     me        created
+     *
+     * License information:
+     *   GPLv3
+     *
+     ********************************************************/
+
+#pragma once
+#ifndef _CODEARENA_H_
+#define _CODEARENA_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+class CodeArena
+{
+    private:
+
+        uint8_t *pmArena;
+        size_t   mSize;
+        size_t   mTop;
+
+    public:
+
+        /**
+         * Get pointer to the first free byte in the arena.
+         * Code generation writes directly to this position.
+         *
+         * RETURNS
+         * pointer to the first free (aligned) byte
+         */
+        uint8_t* top() const;
+
+        /**
+         * Commit code written at top() and move top past it.
+         * Next top is aligned to CG_ALIGNMENT.
+         *
+         * PARAMS
+         * size     number of bytes written at top()
+         *
+         * RETURNS
+         * pointer to the committed code, NULL if it did not fit
+         */
+        void* commit(const size_t size);
+
+        /**
+         * Return number of free bytes in the arena
+         *
+         * RETURNS
+         * number of free bytes
+         */
+        size_t getFreeSpace() const;
+
+        /**
+         * Check if arena was successfully allocated
+         *
+         * RETURNS
+         * true if arena is usable, otherwise false
+         */
+        bool isValid() const;
+
+        /**
+         * Discard all code in the arena
+         */
+        void reset();
+
+        /**
+         * Constructor
+         *
+         * PARAMS
+         * size     size of the arena in bytes
+         */
+            CodeArena(const size_t size);
+
+        /**
+         * Destructor
+         */
+            ~CodeArena();
+        //   CodeArena(const CodeArena&);
+        //   CodeArena& CodeArena=(const CodeArena&);
+};
+
+#endif
@@ -6,7 +6,7 @@
      *
      * Description:
      *   A class that contain pointer to a block of
-     *   machinecode allocated with mmap()
+     *   machinecode located in the code arena
      *
      * Revision history:
      *   When         Who       What
@@ -22,46 +22,228 @@
 #define _CODEBLOCK_H_
 
 #include <cstdlib>
+#include <list>
 #include <stdint.h>
-#include <sys/mman.h>
+
+#include "Chip8def.h"
+#include "CodeGenerator.h"
+#include "RegTracker.h"
+
+//max number of exits that can be linked to other blocks,
+//superblocks have one or two exits for every side exit
+#define CB_MAX_EXITS 32
+
+//exit types
+#define CB_EXIT_JUMP     0  //JMP rel32 to the target block
+#define CB_EXIT_ADDRESS  1  //absolute address of the target block
+#define CB_EXIT_RESIDENT 2  //JMP rel32 past the entry of a block in a convention
 
 class CodeBlock
 {
-    private:
-        void       *pmBlock;
-        size_t     size;
-
     public:
+
+        /**
+         * A block exit with a known target. The exit ends with
+         * a JMP rel32 that is linked to the target block, or
+         * holds the address of the target block as an immediate.
+         * Resident exits are only linked to a target block in
+         * the same convention.
+         */
+        struct Exit
+        {
+            uint32_t        target;
+            int             offset;
+            int             type;
+            RegConvention_t convention;
+        };
+
+        /**
+         * A range of emulated code the block was translated from.
+         * Superblocks are translated from several ranges.
+         */
+        struct Range
+        {
+            uint32_t address;
+            int      opcount;
+        };
+
+        /**
+         * Emulated memory that is not code, but was read when
+         * the block was translated, like the sprites of DXYN
+         */
+        struct Data
+        {
+            uint32_t address;
+            int      size;
+        };
+
         int         opcount;
         uint32_t    address;
+        size_t      size;
         uint32_t  (*pfnCodeBlock)();
+        Exit        exits[CB_MAX_EXITS];
+        int         exitCount;
+
+        //registers are kept in a convention when entered at this
+        //offset from a resident exit, -1 if the block has no convention
+        int             residentOffset;
+        RegConvention_t convention;
+
+        //absolute addresses in the code, for moving it between processes
+        std::list<Relocation_t> relocations;
+
+        //emulated code the block was translated from
+        std::list<Range> ranges;
+
+        //emulated data the code was specialized on
+        std::list<Data> data;
 
         /**
          * Constructor
+         * The code is owned by the code arena, not by the block
          *
          * PARAMS
-         * pBlock   pointer to memory allocated with malloc
          * pCode    pointer to code starting point
          * address  the address for the code in the emulated machine
          * opcount  number of emulated opcodes the block contains
+         * size     size of the code in bytes
          */
-        CodeBlock(void *const pBlock, void *const pCode, const uint32_t address, const int opcount, const size_t size)
+        CodeBlock(void *const pCode, const uint32_t address, const int opcount, const size_t size)
         {
-            pmBlock = pBlock;
             this->address = address;
             this->opcount = opcount;
             this->size = size;
             pfnCodeBlock = (uint32_t(*)()) pCode;
             //pfnCodeBlock = reinterpret_cast<uint32_t(*)()>(reinterpret_cast<uintptr_t>(pCode));
+            exitCount = 0;
+            residentOffset = -1;
+
+            Range range;
+            range.address = address;
+            range.opcount = opcount;
+            ranges.push_back(range);
         }
 
         /**
-         * Destructor
+         * Check if the block was translated from code, or data
+         * read at translation time, in a memory range
+         *
+         * PARAMS
+         * first    first address of the range
+         * end      address after the range
+         *
+         * RETURNS
+         * true if the ranges overlap, otherwise false
          */
-        ~CodeBlock()
+        bool overlaps(const uint32_t first, const uint32_t end) const
         {
-            if(pmBlock != NULL)
-                munmap(pmBlock, this->size);
+            std::list<Range>::const_iterator it;
+
+            for(it = ranges.begin(); it != ranges.end(); ++it)
+                if(it->address < end && it->address + it->opcount * C8_OPCODE_SIZE > first)
+                    return true;
+
+            std::list<Data>::const_iterator d;
+
+            for(d = data.begin(); d != data.end(); ++d)
+                if(d->address < end && d->address + d->size > first)
+                    return true;
+
+            return false;
+        }
+
+        /**
+         * Add an exit that can be linked to another block
+         *
+         * PARAMS
+         * target   emulated address the exit leads to
+         * offset   offset of the rel32 or address to patch
+         * type     CB_EXIT_JUMP or CB_EXIT_ADDRESS
+         *
+         * RETURNS
+         * true if added, otherwise false (exit is never linked)
+         */
+        bool addExit(const uint32_t target, const int offset, const int type)
+        {
+            if(exitCount == CB_MAX_EXITS)
+                return false;
+
+            exits[exitCount].target = target;
+            exits[exitCount].offset = offset;
+            exits[exitCount].type = type;
+            exitCount++;
+
+            return true;
+        }
+
+        /**
+         * Add an exit that can be linked to another block
+         *
+         * PARAMS
+         * rExit    the exit, with the convention of resident exits
+         *
+         * RETURNS
+         * true if added, otherwise false (exit is never linked)
+         */
+        bool addExit(const Exit &rExit)
+        {
+            if(exitCount == CB_MAX_EXITS)
+                return false;
+
+            exits[exitCount++] = rExit;
+
+            return true;
+        }
+
+        /**
+         * Get the code an exit of another block enters this block at
+         *
+         * PARAMS
+         * rExit    the exit
+         *
+         * RETURNS
+         * the code, NULL if the exit can not enter the block
+         */
+        void* getEntry(const Exit &rExit) const
+        {
+            if(rExit.type != CB_EXIT_RESIDENT)
+                return (void *) pfnCodeBlock;
+
+            if(residentOffset < 0 || rExit.convention.addressReg != convention.addressReg)
+                return NULL;
+
+            for(int i = 0; i < X86_COUNT_REGS_8BIT; i++)
+                if(rExit.convention.c8reg[i] != convention.c8reg[i])
+                    return NULL;
+
+            return (uint8_t *) pfnCodeBlock + residentOffset;
+        }
+
+        /**
+         * Point an exit at a code address
+         *
+         * PARAMS
+         * i        exit number
+         * pDest    code to jump to, NULL to fall back to the dispatcher
+         */
+        void linkExit(const int i, const void *const pDest)
+        {
+            uint8_t *const pImm = (uint8_t *) pfnCodeBlock + exits[i].offset;
+            uint32_t imm;
+
+            //a zero displacement falls through to the return path
+            //and a zero address means no known target
+            if(pDest == NULL)
+                imm = 0;
+            else if(exits[i].type != CB_EXIT_ADDRESS)
+                imm = (uintptr_t) pDest - (uintptr_t) (pImm + 4);
+            else
+                imm = (uintptr_t) pDest;
+
+            pImm[0] = imm&0xFF;
+            pImm[1] = ((imm>>8)&0xFF);
+            pImm[2] = ((imm>>16)&0xFF);
+            pImm[3] = ((imm>>24)&0xFF);
         }
 
      // CodeBlock(const CodeBlock&);
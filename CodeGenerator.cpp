@@ -18,35 +18,272 @@
 
 #include <cstdlib>
 #include <cstring>
-#include <sys/mman.h>
 
 #include "CodeGenerator.h"
 
 /**
- * Insert all jumps into the code.
+ * Gives every jump to a label the size of its
+ * shortest form, starting with the short form
+ * and growing the jumps that do not reach
+ * until no more jump has to grow.
+ */
+void CodeGenerator::relaxJumps()
+{
+    std::vector<Jump>::iterator it;
+    bool grown = true;
+
+    //jumps to labels that are never inserted fall through, they are removed
+    for(it = mJumps.begin(); it != mJumps.end(); ++it)
+        it->size = mLabels[it->label].inserted ? CG_JUMP_SIZE_SHORT : 0;
+
+    //jumps only grow, so this ends
+    while(grown)
+    {
+        int shift = 0;
+        grown = false;
+
+        for(it = mJumps.begin(); it != mJumps.end(); ++it)
+        {
+            it->finalIndex = it->index - shift;
+            shift += CG_JUMP_SPACE - it->size;
+        }
+
+        for(it = mJumps.begin(); it != mJumps.end(); ++it)
+        {
+            if(it->size != CG_JUMP_SIZE_SHORT)
+                continue;
+
+            const int32_t rel = getFinalIndex(mLabels[it->label].index) - (it->finalIndex + CG_JUMP_SIZE_SHORT);
+
+            if(rel < CG_INT8_MIN || rel > CG_INT8_MAX)
+            {
+                it->size = it->longSize;
+                grown = true;
+            }
+        }
+    }
+}
+
+/**
+ * Insert all jumps into the code. Every jump gets its shortest
+ * form and the code after it is moved back over the bytes it
+ * does not use. Relocations move with the code. No more code
+ * may be generated after this, until the code is committed.
  */
 void CodeGenerator::insertJumps()
 {
+    if(mJumpsInserted)
+        return;
+
+    relaxJumps();
 
-    const int tmp = mIndex;
+    const int end = mIndex;
+    int from = 0;
 
-    while(!mJumps.empty())
+    for(std::vector<Jump>::const_iterator it = mJumps.begin(); it != mJumps.end(); ++it)
     {
-        const Jump *const pJmp = mJumps.back();
-        const int id = pJmp->label;
+        //the code between two jumps is moved back in one piece
+        memmove(mMachineCode + getFinalIndex(from), mMachineCode + from, it->index - from);
 
-        if(mLabels[id]->inserted)
+        if(it->size > 0)
         {
-            mIndex = pJmp->index;
-            const int32_t rel = mLabels[id]->index - mIndex;
-            (this->*pJmp->pfnJmp)(rel);
+            mIndex = it->finalIndex;
+            (this->*it->pfnJmp)(getFinalIndex(mLabels[it->label].index) - it->finalIndex);
         }
 
-        mJumps.pop_back();
-        delete pJmp;
+        from = it->index + CG_JUMP_SPACE;
+    }
+
+    memmove(mMachineCode + getFinalIndex(from), mMachineCode + from, end - from);
+
+    for(std::list<Relocation_t>::iterator it = mRelocations.begin(); it != mRelocations.end(); ++it)
+        it->offset = getFinalIndex(it->offset);
+
+    mIndex = getFinalIndex(end);
+    mJumpsInserted = true;
+}
+
+/**
+ * Get the position of generated code after the jumps
+ * are inserted
+ *
+ * PARAMS
+ * index    position before the jumps were inserted
+ *
+ * RETURNS
+ * position after the jumps were inserted
+ */
+int CodeGenerator::getFinalIndex(const int index) const
+{
+    int low = 0;
+    int high = mJumps.size();
+
+    //find the first jump at or after index, jumps are in code order
+    while(low < high)
+    {
+        const int mid = (low + high) / 2;
+
+        if(mJumps[mid].index < index)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+
+    if(low == 0)
+        return index;
+
+    const Jump &rJmp = mJumps[low - 1];
+
+    return rJmp.finalIndex + rJmp.size + index - (rJmp.index + CG_JUMP_SPACE);
+}
+
+/**
+ * Write a 32 bit immediate or displacement. Values that
+ * point into a registered region are recorded as relocations.
+ *
+ * PARAMS
+ * value    32 bit value
+ */
+void CodeGenerator::emit32(const uint32_t value)
+{
+    const int region = findRegion(value);
+
+    if(region >= 0)
+    {
+        Relocation_t reloc;
+        reloc.offset = mIndex;
+        reloc.region = region;
+        mRelocations.push_back(reloc);
+    }
+
+    mMachineCode[mIndex++] = value&0xFF;
+    mMachineCode[mIndex++] = ((value>>8)&0xFF);
+    mMachineCode[mIndex++] = ((value>>16)&0xFF);
+    mMachineCode[mIndex++] = ((value>>24)&0xFF);
+}
+
+/**
+ * Write the ModR/M byte of a memory operand at an absolute
+ * address, followed by the address. In 64 bit mode a disp32
+ * without SIB byte is relative to the instruction pointer.
+ *
+ * PARAMS
+ * reg      register or opcode extension of the ModR/M byte
+ * disp32   32 bit memory address
+ */
+void CodeGenerator::emitAbsolute(const int reg, const uint32_t disp32)
+{
+#ifdef X86_LONG_MODE
+    mMachineCode[mIndex++] = X86_MODRM_BYTE(X86_MOD_MEM, reg, 0x4);
+    mMachineCode[mIndex++] = X86_SIB_BYTE(0, X86_SIB_NO_INDEX, X86_SIB_NO_BASE);
+#else
+    mMachineCode[mIndex++] = X86_MODRM_BYTE(X86_MOD_MEM, reg, 0x5);
+#endif
+    emit32(disp32);
+}
+
+/**
+ * Find the registered region a value points into
+ *
+ * PARAMS
+ * value    32 bit value
+ *
+ * RETURNS
+ * region number, -1 if it is not in a region
+ */
+int CodeGenerator::findRegion(const uint32_t value) const
+{
+    for(int i = 0; i < mRegionCount; i++)
+        if(value >= mRegions[i].base && value <= mRegions[i].base + mRegions[i].size)
+            return i;
+
+    return -1;
+}
+
+/**
+ * Forget the peephole facts, the code at the current
+ * position can be reached from elsewhere
+ */
+void CodeGenerator::forgetPeephole()
+{
+    mPeephole.index = -1;
+}
+
+/**
+ * Start a peephole memory access, facts that are
+ * no longer valid at the current position are dropped
+ */
+void CodeGenerator::beginPeephole()
+{
+    if(mPeephole.index == mIndex)
+        return;
+
+    mPeephole.index = mIndex;
+    mPeephole.pointer = -1;
+
+    for(int i = 0; i < X86_COUNT_REGS_8BIT; i++)
+        mPeephole.byteKnown[i] = false;
+}
+
+/**
+ * Called by the register emitters that keep the peephole
+ * facts valid, after an instruction is emitted
+ *
+ * PARAMS
+ * start    position of the instruction
+ * reg8     8 bit register written, -1 if none
+ */
+void CodeGenerator::keepPeephole(const int start, const int reg8)
+{
+    if(mPeephole.index != start)
+        return;
+
+    mPeephole.index = mIndex;
+
+    if(reg8 < 0)
+        return;
+
+    mPeephole.byteKnown[reg8] = false;
+
+    //AL-BL and AH-BH are parts of EAX-EBX
+    if((reg8 & 3) == mPeephole.pointer)
+        mPeephole.pointer = -1;
+}
+
+/**
+ * Make a register point near an address, reusing the
+ * address already in it when it is close enough
+ *
+ * PARAMS
+ * reg32    32 bit register used as pointer
+ * address  absolute address
+ *
+ * RETURNS
+ * displacement of the address from the register
+ */
+int CodeGenerator::pointTo(const int reg32, const uint32_t address)
+{
+    //the displacement is not relocated, both must move together
+    if(mPeephole.pointer == reg32 && findRegion(address) == findRegion(mPeephole.pointerAddress))
+    {
+        const int disp = (int32_t) (address - mPeephole.pointerAddress);
+
+        if(disp >= CG_INT8_MIN && disp <= CG_INT8_MAX)
+            return disp;
     }
 
-    mIndex = tmp;
+    mov_r32i32(reg32, address);
+    mPeephole.pointer = reg32;
+    mPeephole.pointerAddress = address;
+
+    //only EAX-EBX have 8 bit parts
+    if(reg32 < X86_COUNT_REGS_8BIT / 2)
+    {
+        mPeephole.byteKnown[reg32] = false;
+        mPeephole.byteKnown[reg32 + X86_COUNT_REGS_8BIT / 2] = false;
+    }
+
+    return 0;
 }
 
 /**
@@ -122,7 +359,37 @@ void CodeGenerator::insert_jmp(const int32_t rel)
     if((rel - 2) >= CG_INT8_MIN && (rel - 2) <= CG_INT8_MAX)
         jmp_i8(rel - 2);
     else
-        jmp_i32(rel - 6);
+        jmp_i32(rel - CG_JUMP_SIZE_JMP);
+}
+
+/**
+ * Jump If Less or Equal.
+ * Insert a jump into the code
+ *
+ * PARAMS
+ *   rel    distance between label and jump
+ */
+void CodeGenerator::insert_jle(const int32_t rel)
+{
+    if((rel - 2) >= CG_INT8_MIN && (rel - 2) <= CG_INT8_MAX)
+        jle_i8(rel - 2);
+    else
+        jle_i32(rel - 6);
+}
+
+/**
+ * Jump If Above.
+ * Insert a jump into the code
+ *
+ * PARAMS
+ *   rel    distance between label and jump
+ */
+void CodeGenerator::insert_ja(const int32_t rel)
+{
+    if((rel - 2) >= CG_INT8_MIN && (rel - 2) <= CG_INT8_MAX)
+        ja_i8(rel - 2);
+    else
+        ja_i32(rel - 6);
 }
 
 /**
@@ -133,8 +400,9 @@ void CodeGenerator::insert_jmp(const int32_t rel)
  */
 void CodeGenerator::insertLabel(const Label_t id)
 {
-    mLabels[id]->inserted = true;
-    mLabels[id]->index = mIndex;
+    mLabels[id].inserted = true;
+    mLabels[id].index = mIndex;
+    forgetPeephole();
 }
 
 /**
@@ -145,49 +413,33 @@ void CodeGenerator::insertLabel(const Label_t id)
  */
 Label_t CodeGenerator::newLabel()
 {
-    mLabels.push_back(new Label);
+    mLabels.push_back(Label());
     return mLabels.size() - 1;
 }
 
 /**
- * Copies the code to the heap and return a pointer to it
+ * Commits the code to the code arena and return a pointer to it
  * The code is guaranteed to be aligned
+ *
+ * PARAMS
+ * size     size of the code is stored here
+ *
  * RETURNS
  * void pointer to generated code
  */
-void* CodeGenerator::getAlignedCodePointer(void **const pBlock, size_t *size)
+void* CodeGenerator::getAlignedCodePointer(size_t *size)
 {
-    void *pCode;
-
-    //om det finns kod
-    if(mIndex > 0)
-    {
-        //calculate and add all jumps
-        insertJumps();
-        //Allocate new memory and copy
-        //*pBlock = malloc(mIndex + CG_ALIGNMENT);
-        *size = mIndex + CG_ALIGNMENT;
-        *pBlock = mmap(NULL, mIndex + CG_ALIGNMENT, PROT_EXEC | PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-        const uintptr_t blockAddr = (uintptr_t)*pBlock;
-        pCode = (void*)(blockAddr + (CG_ALIGNMENT - (blockAddr & (CG_ALIGNMENT - 1))));
-        //pCode = *pBlock;
-        memcpy(pCode, mMachineCode, mIndex);
-        reset();
-    }
-    else
-    {
-        *pBlock = NULL;
-        pCode = NULL;
-        *size = 0;
-    }
-
-    return pCode;
+    //code is emitted at the arena top, which is always aligned
+    return getCodePointer(size);
 }
 
 /**
- * Copies the code to the heap and return a pointer to it
+ * Commits the code to the code arena and return a pointer to it
  * The code is NOT guaranteed to be aligned
  *
+ * PARAMS
+ * size     size of the code is stored here
+ *
  * RETURNS
  * void pointer to generated code
  */
@@ -198,13 +450,11 @@ void* CodeGenerator::getCodePointer(size_t *size)
     //if we have some code
     if(mIndex > 0)
     {
-        //Calculate and add all jumps
+        //Calculate and add all jumps, unless already done
         insertJumps();
-        //Allocate memory and copy
-        //pCode = malloc(mIndex);
+        //Code is already in place, just claim the space
         *size = mIndex;
-        pCode = mmap(NULL, mIndex, PROT_EXEC | PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-        memcpy(pCode, mMachineCode, mIndex);
+        pCode = pmArena->commit(mIndex);
         reset();
     }
     else
@@ -234,12 +484,131 @@ void CodeGenerator::align()
         align16();
 }
 
+/**
+ * Get current position in the code, counted from the start
+ * of the block being generated. The position may be entered
+ * from elsewhere, so the peephole facts are forgotten.
+ *
+ * RETURNS
+ * offset of the next byte to be written
+ */
+int CodeGenerator::getIndex()
+{
+    forgetPeephole();
+    return mIndex;
+}
+
+/**
+ * Get the number of bytes that can still be generated
+ * before the code arena is full
+ *
+ * RETURNS
+ * number of free bytes after the code being generated
+ */
+size_t CodeGenerator::getFreeSpace() const
+{
+    const size_t free = pmArena->getFreeSpace();
+
+    return (size_t) mIndex < free ? free - mIndex : 0;
+}
+
+/**
+ * Register a memory region that generated code addresses.
+ * Absolute addresses into the region are recorded as
+ * relocations, so the code can be moved to a process
+ * where the region is located elsewhere.
+ *
+ * PARAMS
+ * pBase    start of the region
+ * size     size of the region in bytes
+ *
+ * RETURNS
+ * region number, -1 if there is no room for more regions
+ * or the generated code can not reach the region
+ */
+int CodeGenerator::addRegion(const void *const pBase, const size_t size)
+{
+    if(mRegionCount == CG_MAX_REGIONS)
+    {
+        mRegionsValid = false;
+        return -1;
+    }
+
+#ifdef X86_LONG_MODE
+    //the generated code can not reach it
+    if((uintptr_t) pBase + size > X86_LONG_MODE_LIMIT)
+    {
+        mRegionsValid = false;
+        return -1;
+    }
+#endif
+
+    mRegions[mRegionCount].base = (uintptr_t) pBase;
+    mRegions[mRegionCount].size = size;
+
+    return mRegionCount++;
+}
+
+/**
+ * Check that every region could be registered
+ *
+ * RETURNS
+ * true if the generated code can address all regions
+ */
+bool CodeGenerator::isRegionsValid() const
+{
+    return mRegionsValid;
+}
+
+/**
+ * Get the start of a registered region
+ *
+ * PARAMS
+ * region   region number
+ *
+ * RETURNS
+ * address of the region
+ */
+uintptr_t CodeGenerator::getRegionBase(const int region) const
+{
+    return mRegions[region].base;
+}
+
+/**
+ * Get number of registered regions
+ *
+ * RETURNS
+ * number of regions
+ */
+int CodeGenerator::getRegionCount() const
+{
+    return mRegionCount;
+}
+
+/**
+ * Move the relocations recorded for the code being
+ * generated to a list. Must be called before the code
+ * is committed.
+ *
+ * PARAMS
+ * rRelocations     relocations are moved here
+ */
+void CodeGenerator::takeRelocations(std::list<Relocation_t> &rRelocations)
+{
+    rRelocations.clear();
+    rRelocations.swap(mRelocations);
+}
+
 /**
  * Reset
  */
 void CodeGenerator::reset()
 {
     mIndex = 0;
+    mMachineCode = pmArena->top();
+    mRelocations.clear();
+    mJumpsInserted = false;
+    forgetPeephole();
     destroy();
 }
 
@@ -248,26 +617,23 @@ void CodeGenerator::reset()
  */
 void CodeGenerator::destroy()
 {
-    while(!mJumps.empty())
-    {
-        const Jump *const p = mJumps.back();
-        mJumps.pop_back();
-        delete p;
-    }
-
-    while(!mLabels.empty())
-    {
-        const Label *const p = mLabels.back();
-        mLabels.pop_back();
-        delete p;
-    }
+    mJumps.clear();
+    mLabels.clear();
 }
 
 /**
  * Constructor
+ *
+ * PARAMS
+ * pArena   code arena to emit code into
  */
-CodeGenerator::CodeGenerator()
+CodeGenerator::CodeGenerator(CodeArena *const pArena)
 {
+    pmArena = pArena;
+    mRegionCount = 0;
+    mRegionsValid = true;
+    mLabels.reserve(CG_RESERVED_LABELS);
+    mJumps.reserve(CG_RESERVED_JUMPS);
     reset();
 }
 
@@ -279,6 +645,140 @@ CodeGenerator::~CodeGenerator()
     destroy();
 }
 
+/**
+ * Load a byte from an absolute address. A byte that is still
+ * in a register is copied from it instead, and a pointer that
+ * is close enough to the address is reused.
+ *
+ * PARAMS
+ * reg8d    8 bit destination register
+ * reg32    32 bit register used as pointer, undefined after
+ * address  absolute address
+ */
+void CodeGenerator::load_r8(const int reg8d, const int reg32, const uint32_t address)
+{
+    beginPeephole();
+
+    for(int i = 0; i < X86_COUNT_REGS_8BIT; i++)
+        if(mPeephole.byteKnown[i] && mPeephole.byteAddress[i] == address)
+        {
+            if(i != reg8d)
+                mov_r8r8(reg8d, i);
+
+            mPeephole.byteKnown[reg8d] = true;
+            mPeephole.byteAddress[reg8d] = address;
+            return;
+        }
+
+    const int disp = pointTo(reg32, address);
+
+    if(disp == 0)
+        mov_r8m8(reg8d, reg32);
+    else
+        mov_r8m8_d8(reg8d, reg32, disp);
+
+    mPeephole.index = mIndex;
+    mPeephole.byteKnown[reg8d] = true;
+    mPeephole.byteAddress[reg8d] = address;
+
+    if((reg8d & 3) == mPeephole.pointer)
+        mPeephole.pointer = -1;
+}
+
+/**
+ * Store a byte at an absolute address, unless the address
+ * is known to hold it already. A pointer that is close
+ * enough to the address is reused.
+ *
+ * PARAMS
+ * reg32    32 bit register used as pointer, undefined after
+ * address  absolute address
+ * reg8s    8 bit source register
+ */
+void CodeGenerator::store_r8(const int reg32, const uint32_t address, const int reg8s)
+{
+    beginPeephole();
+
+    if(mPeephole.byteKnown[reg8s] && mPeephole.byteAddress[reg8s] == address)
+        return;
+
+    const int disp = pointTo(reg32, address);
+
+    if(disp == 0)
+        mov_m8r8(reg32, reg8s);
+    else
+        mov_m8r8_d8(reg32, reg8s, disp);
+
+    mPeephole.index = mIndex;
+
+    for(int i = 0; i < X86_COUNT_REGS_8BIT; i++)
+        if(mPeephole.byteAddress[i] == address)
+            mPeephole.byteKnown[i] = false;
+
+    mPeephole.byteKnown[reg8s] = true;
+    mPeephole.byteAddress[reg8s] = address;
+}
+
+/**
+ * Load 32 bits from an absolute address. A pointer that
+ * is close enough to the address is reused.
+ *
+ * PARAMS
+ * reg32d   32 bit destination register
+ * reg32    32 bit register used as pointer, undefined after
+ * address  absolute address
+ */
+void CodeGenerator::load_r32(const int reg32d, const int reg32, const uint32_t address)
+{
+    beginPeephole();
+
+    const int disp = pointTo(reg32, address);
+
+    if(disp == 0)
+        mov_r32m32(reg32d, reg32);
+    else
+        mov_r32m32_d8(reg32d, reg32, disp);
+
+    mPeephole.index = mIndex;
+
+    if(reg32d == mPeephole.pointer)
+        mPeephole.pointer = -1;
+
+    //only EAX-EBX have 8 bit parts
+    if(reg32d < X86_COUNT_REGS_8BIT / 2)
+    {
+        mPeephole.byteKnown[reg32d] = false;
+        mPeephole.byteKnown[reg32d + X86_COUNT_REGS_8BIT / 2] = false;
+    }
+}
+
+/**
+ * Store 32 bits at an absolute address. A pointer that
+ * is close enough to the address is reused.
+ *
+ * PARAMS
+ * reg32    32 bit register used as pointer, undefined after
+ * address  absolute address
+ * reg32s   32 bit source register
+ */
+void CodeGenerator::store_r32(const int reg32, const uint32_t address, const int reg32s)
+{
+    beginPeephole();
+
+    const int disp = pointTo(reg32, address);
+
+    if(disp == 0)
+        mov_m32r32(reg32, reg32s);
+    else
+        mov_m32r32_d8(reg32, reg32s, disp);
+
+    mPeephole.index = mIndex;
+
+    for(int i = 0; i < X86_COUNT_REGS_8BIT; i++)
+        if(mPeephole.byteAddress[i] - address < sizeof(uint32_t))
+            mPeephole.byteKnown[i] = false;
+}
+
 /**
  * MOV r32,imm32
  *
@@ -292,10 +792,7 @@ void CodeGenerator::mov_r32i32(const int reg32, const uint32_t imm32)
     //MOV r32,imm32
     //Move imm32 to r32
     mMachineCode[mIndex++] = 0xB8+reg32;
-    mMachineCode[mIndex++] = imm32&0xFF;
-    mMachineCode[mIndex++] = ((imm32>>8)&0xFF);
-    mMachineCode[mIndex++] = ((imm32>>16)&0xFF);
-    mMachineCode[mIndex++] = ((imm32>>24)&0xFF);
+    emit32(imm32);
 }
 
 /**
@@ -312,10 +809,7 @@ void CodeGenerator::mov_m32i32(const int reg32, const uint32_t imm32)
     //Move imm32 to r/m32
     mMachineCode[mIndex++] = 0xC7;
     mMachineCode[mIndex++] = X86_MODRM_BYTE(X86_MOD_MEM, 0x0, reg32);
-    mMachineCode[mIndex++] = imm32&0xFF;
-    mMachineCode[mIndex++] = ((imm32>>8)&0xFF);
-    mMachineCode[mIndex++] = ((imm32>>16)&0xFF);
-    mMachineCode[mIndex++] = ((imm32>>24)&0xFF);
+    emit32(imm32);
 }
 
 /**
@@ -334,10 +828,7 @@ void CodeGenerator::mov_m32i32_d8(const int reg32, const uint32_t imm32, const u
     mMachineCode[mIndex++] = 0xC7;
     mMachineCode[mIndex++] = X86_MODRM_BYTE(X86_MOD_MEM_DISPB, 0x0, reg32);
     mMachineCode[mIndex++] = disp8;
-    mMachineCode[mIndex++] = imm32&0xFF;
-    mMachineCode[mIndex++] = ((imm32>>8)&0xFF);
-    mMachineCode[mIndex++] = ((imm32>>16)&0xFF);
-    mMachineCode[mIndex++] = ((imm32>>24)&0xFF);
+    emit32(imm32);
 }
 
 /**
@@ -445,11 +936,15 @@ void CodeGenerator::nop()
  */
 void CodeGenerator::mov_r8i8(const int reg8, const uint8_t imm8)
 {
+    const int start = mIndex;
+
     //B0+ rb
     //MOV r8,imm8
     //Move imm8 to r8
     mMachineCode[mIndex++] = 0xB0+reg8;
     mMachineCode[mIndex++] = imm8;
+
+    keepPeephole(start, reg8);
 }
 
 /**
@@ -461,11 +956,15 @@ void CodeGenerator::mov_r8i8(const int reg8, const uint8_t imm8)
  */
 void CodeGenerator::mov_r8r8(const int reg8d, const int reg8s)
 {
+    const int start = mIndex;
+
     //88 /r
     //MOV r/m8,r8
     //Move r8 to r/m8
     mMachineCode[mIndex++] = 0x88;
     mMachineCode[mIndex++] = X86_MODRM_BYTE(X86_MOD_REG, reg8s, reg8d);
+
+    keepPeephole(start, reg8d);
 }
 
 /**
@@ -518,6 +1017,24 @@ void CodeGenerator::mov_r32m32(const int reg32d, const int reg32s)
     mMachineCode[mIndex++] = X86_MODRM_BYTE(X86_MOD_MEM, reg32d, reg32s);
 }
 
+/**
+ * MOV r32,m32
+ *
+ * PARAMS
+ * reg32d    32 bit destination register
+ * reg32s    32 bit memory pointer
+ * disp8     8 bit memory displacement
+ */
+void CodeGenerator::mov_r32m32_d8(const int reg32d, const int reg32s, const uint8_t disp8)
+{
+    //8B /r
+    //MOV r32,r/m32
+    //Move r/m32 to r32
+    mMachineCode[mIndex++] = 0x8B;
+    mMachineCode[mIndex++] = X86_MODRM_BYTE(X86_MOD_MEM_DISPB, reg32d, reg32s);
+    mMachineCode[mIndex++] = disp8;
+}
+
 /**
  * MOV r16,m16
  *
@@ -584,6 +1101,24 @@ void CodeGenerator::mov_m32r32(const int reg32d, const int reg32s)
     mMachineCode[mIndex++] = X86_MODRM_BYTE(X86_MOD_MEM, reg32s, reg32d);
 }
 
+/**
+ * MOV m32,r32
+ *
+ * PARAMS
+ * reg32d    32 bit memory pointer
+ * reg32s    32 bit source register
+ * disp8     8 bit memory displacement
+ */
+void CodeGenerator::mov_m32r32_d8(const int reg32d, const int reg32s, const uint8_t disp8)
+{
+    //89 /r
+    //MOV r/m32,r32
+    //Move r32 to r/m32
+    mMachineCode[mIndex++] = 0x89;
+    mMachineCode[mIndex++] = X86_MODRM_BYTE(X86_MOD_MEM_DISPB, reg32s, reg32d);
+    mMachineCode[mIndex++] = disp8;
+}
+
 /**
  * MOV m16,r16
  *
@@ -727,6 +1262,21 @@ void CodeGenerator::call_r32(const int reg32)
     mMachineCode[mIndex++] = X86_MODRM_BYTE(X86_MOD_REG, 0x2, reg32);
 }
 
+/**
+ * JMP r32
+ *
+ * PARAMS
+ * reg32    32 bit register with destination address
+ */
+void CodeGenerator::jmp_r32(const int reg32)
+{
+    //FF /4
+    //JMP r/m32
+    //Jump near, absolute indirect, address given in r/m32
+    mMachineCode[mIndex++] = 0xFF;
+    mMachineCode[mIndex++] = X86_MODRM_BYTE(X86_MOD_REG, 0x4, reg32);
+}
+
 /**
  * CMP r8,i8
  *
@@ -736,6 +1286,8 @@ void CodeGenerator::call_r32(const int reg32)
  */
 void CodeGenerator::cmp_r8i8(const int reg8, const uint8_t imm8)
 {
+    const int start = mIndex;
+
     //3C ib
     //CMP AL, imm8
     //Compare imm8 with AL
@@ -752,6 +1304,8 @@ void CodeGenerator::cmp_r8i8(const int reg8, const uint8_t imm8)
     }
 
     mMachineCode[mIndex++] = imm8;
+
+    keepPeephole(start, -1);
 }
 
 /**
@@ -763,6 +1317,8 @@ void CodeGenerator::cmp_r8i8(const int reg8, const uint8_t imm8)
  */
 void CodeGenerator::or_r8i8(const int reg8, const uint8_t imm8)
 {
+    const int start = mIndex;
+
     //0C ib
     //OR AL,imm8
     //AL OR imm8
@@ -780,6 +1336,8 @@ void CodeGenerator::or_r8i8(const int reg8, const uint8_t imm8)
     }
 
     mMachineCode[mIndex++] = imm8;
+
+    keepPeephole(start, reg8);
 }
 
 /**
@@ -818,6 +1376,45 @@ void CodeGenerator::cmp_m8i8_d8(const int reg32, const uint8_t imm8, const uint8
     mMachineCode[mIndex++] = imm8;
 }
 
+/**
+ * CMP m8,i8
+ *
+ * PARAMS
+ * reg32   32 bit memory pointer
+ * imm8    8 bit immediate
+ * disp32  32 bit memory displacement
+ */
+void CodeGenerator::cmp_m8i8_d32(const int reg32, const uint8_t imm8, const uint32_t disp32)
+{
+    //80 /7 ib
+    //CMP r/m8, imm8
+    //Compare imm8 with r/m8
+    mMachineCode[mIndex++] = 0x80;
+    mMachineCode[mIndex++] = X86_MODRM_BYTE(X86_MOD_MEM_DISPDW, 0x7, reg32);
+    emit32(disp32);
+    mMachineCode[mIndex++] = imm8;
+}
+
+/**
+ * CMP m32,i8
+ * The immediate is sign extended
+ *
+ * PARAMS
+ * reg32   32 bit memory pointer
+ * imm8    8 bit immediate
+ * disp8   8 bit memory displacement
+ */
+void CodeGenerator::cmp_m32i8_d8(const int reg32, const uint8_t imm8, const uint8_t disp8)
+{
+    //83 /7 ib
+    //CMP r/m32,imm8
+    //Compare imm8 with r/m32
+    mMachineCode[mIndex++] = 0x83;
+    mMachineCode[mIndex++] = X86_MODRM_BYTE(X86_MOD_MEM_DISPB, 0x7, reg32);
+    mMachineCode[mIndex++] = disp8;
+    mMachineCode[mIndex++] = imm8;
+}
+
 /**
  * CMP r8,r8
  *
@@ -827,11 +1424,15 @@ void CodeGenerator::cmp_m8i8_d8(const int reg32, const uint8_t imm8, const uint8
  */
 void CodeGenerator::cmp_r8r8(const int reg8d, const int reg8s)
 {
+    const int start = mIndex;
+
     //38 /r
     //CMP r/m8,r8
     //Compare r8 with r/m8
     mMachineCode[mIndex++] = 0x38;
     mMachineCode[mIndex++] = X86_MODRM_BYTE(X86_MOD_REG, reg8s, reg8d);
+
+    keepPeephole(start, -1);
 }
 
 /**
@@ -843,11 +1444,15 @@ void CodeGenerator::cmp_r8r8(const int reg8d, const int reg8s)
  */
 void CodeGenerator::or_r8r8(const int reg8d, const int reg8s)
 {
+    const int start = mIndex;
+
     //08 /r
     //OR r/m8, r8
     //r/m8 OR r8
     mMachineCode[mIndex++] = 0x08;
     mMachineCode[mIndex++] = X86_MODRM_BYTE(X86_MOD_REG, reg8s, reg8d);
+
+    keepPeephole(start, reg8d);
 }
 
 /**
@@ -859,11 +1464,15 @@ void CodeGenerator::or_r8r8(const int reg8d, const int reg8s)
  */
 void CodeGenerator::xor_r8r8(const int reg8d, const int reg8s)
 {
+    const int start = mIndex;
+
     //30 /r
     //XOR r/m8, r8
     //r/m8 XOR r8
     mMachineCode[mIndex++] = 0x30;
     mMachineCode[mIndex++] = X86_MODRM_BYTE(X86_MOD_REG, reg8s, reg8d);
+
+    keepPeephole(start, reg8d);
 }
 
 /**
@@ -907,11 +1516,15 @@ void CodeGenerator::xor_r16r16(const int reg16d, const int reg16s)
  */
 void CodeGenerator::and_r8r8(const int reg8d, const int reg8s)
 {
+    const int start = mIndex;
+
     //20 /r
     //AND r/m8, r8
     //r/m8 AND r8
     mMachineCode[mIndex++] = 0x20;
     mMachineCode[mIndex++] = X86_MODRM_BYTE(X86_MOD_REG, reg8s, reg8d);
+
+    keepPeephole(start, reg8d);
 }
 
 /**
@@ -923,6 +1536,8 @@ void CodeGenerator::and_r8r8(const int reg8d, const int reg8s)
  */
 void CodeGenerator::and_r8i8(const int reg8, const uint8_t imm8)
 {
+    const int start = mIndex;
+
     //24 ib
     //AND AL,imm8
     //AL AND imm8
@@ -939,6 +1554,8 @@ void CodeGenerator::and_r8i8(const int reg8, const uint8_t imm8)
     }
 
     mMachineCode[mIndex++] = imm8;
+
+    keepPeephole(start, reg8);
 }
 
 /**
@@ -949,11 +1566,34 @@ void CodeGenerator::and_r8i8(const int reg8, const uint8_t imm8)
  */
 void CodeGenerator::not_r8(const int reg8)
 {
+    const int start = mIndex;
+
     //F6 /2
     //NOT r/m8
     //Reverse each bit of r/m8
     mMachineCode[mIndex++] = 0xF6;
     mMachineCode[mIndex++] = X86_MODRM_BYTE(X86_MOD_REG, 0x2, reg8);
+
+    keepPeephole(start, reg8);
+}
+
+/**
+ * NEG r8
+ *
+ * PARAMS
+ * reg8   8 bit register
+ */
+void CodeGenerator::neg_r8(const int reg8)
+{
+    const int start = mIndex;
+
+    //F6 /3
+    //NEG r/m8
+    //Two's complement negate r/m8
+    mMachineCode[mIndex++] = 0xF6;
+    mMachineCode[mIndex++] = X86_MODRM_BYTE(X86_MOD_REG, 0x3, reg8);
+
+    keepPeephole(start, reg8);
 }
 
 /**
@@ -965,6 +1605,8 @@ void CodeGenerator::not_r8(const int reg8)
  */
 void CodeGenerator::add_r8i8(const int reg8, const uint8_t imm8)
 {
+    const int start = mIndex;
+
     //04 ib
     //ADD AL,imm8
     //Add imm8 to AL
@@ -982,6 +1624,8 @@ void CodeGenerator::add_r8i8(const int reg8, const uint8_t imm8)
     }
 
     mMachineCode[mIndex++] = imm8;
+
+    keepPeephole(start, reg8);
 }
 
 /**
@@ -993,11 +1637,15 @@ void CodeGenerator::add_r8i8(const int reg8, const uint8_t imm8)
  */
 void CodeGenerator::add_r8r8(const int reg8d, const int reg8s)
 {
+    const int start = mIndex;
+
     //00 /r
     //ADD r/m8,r8
     //Add r8 to r/m8
     mMachineCode[mIndex++] = 0x00;
     mMachineCode[mIndex++] = X86_MODRM_BYTE(X86_MOD_REG, reg8s, reg8d);
+
+    keepPeephole(start, reg8d);
 }
 
 /**
@@ -1087,10 +1735,111 @@ void CodeGenerator::add_r32i32(const int reg32, const uint32_t imm32)
         mMachineCode[mIndex++] = X86_MODRM_BYTE(X86_MOD_REG, 0x0, reg32);
     }
 
-    mMachineCode[mIndex++] = imm32&0xFF;
-    mMachineCode[mIndex++] = ((imm32>>8)&0xFF);
-    mMachineCode[mIndex++] = ((imm32>>16)&0xFF);
-    mMachineCode[mIndex++] = ((imm32>>24)&0xFF);
+    emit32(imm32);
+}
+
+/**
+ * ADD m32,r32
+ *
+ * PARAMS
+ * reg32d   32 bit memory pointer
+ * reg32s   32 bit source register
+ */
+void CodeGenerator::add_m32r32(const int reg32d, const int reg32s)
+{
+    //01 /r
+    //ADD r/m32,r32
+    //Add r32 to r/m32
+    mMachineCode[mIndex++] = 0x01;
+    mMachineCode[mIndex++] = X86_MODRM_BYTE(X86_MOD_MEM, reg32s, reg32d);
+}
+
+/**
+ * ADD m32,i32
+ * Memory operand is addressed by a 32 bit displacement only
+ *
+ * PARAMS
+ * disp32  32 bit memory address
+ * imm32   32 bit immediate
+ */
+void CodeGenerator::add_m32i32_d32(const uint32_t disp32, const uint32_t imm32)
+{
+    //81 /0 id
+    //ADD r/m32,imm32
+    //Add imm32 to r/m32
+    mMachineCode[mIndex++] = 0x81;
+    emitAbsolute(0x0, disp32);
+    emit32(imm32);
+}
+
+/**
+ * ADC m32,r32
+ *
+ * PARAMS
+ * reg32d   32 bit memory pointer
+ * reg32s   32 bit source register
+ * disp8    8 bit memory displacement
+ */
+void CodeGenerator::adc_m32r32_d8(const int reg32d, const int reg32s, const uint8_t disp8)
+{
+    //11 /r
+    //ADC r/m32,r32
+    //Add with carry r32 to r/m32
+    mMachineCode[mIndex++] = 0x11;
+    mMachineCode[mIndex++] = X86_MODRM_BYTE(X86_MOD_MEM_DISPB, reg32s, reg32d);
+    mMachineCode[mIndex++] = disp8;
+}
+
+/**
+ * ADC m32,i32
+ * Memory operand is addressed by a 32 bit displacement only
+ *
+ * PARAMS
+ * disp32  32 bit memory address
+ * imm32   32 bit immediate
+ */
+void CodeGenerator::adc_m32i32_d32(const uint32_t disp32, const uint32_t imm32)
+{
+    //81 /2 id
+    //ADC r/m32,imm32
+    //Add with carry imm32 to r/m32
+    mMachineCode[mIndex++] = 0x81;
+    emitAbsolute(0x2, disp32);
+    emit32(imm32);
+}
+
+/**
+ * SUB r32,m32
+ *
+ * PARAMS
+ * reg32d   32 bit destination register
+ * reg32s   32 bit memory pointer
+ */
+void CodeGenerator::sub_r32m32(const int reg32d, const int reg32s)
+{
+    //2B /r
+    //SUB r32,r/m32
+    //Subtract r/m32 from r32
+    mMachineCode[mIndex++] = 0x2B;
+    mMachineCode[mIndex++] = X86_MODRM_BYTE(X86_MOD_MEM, reg32d, reg32s);
+}
+
+/**
+ * SBB r32,m32
+ *
+ * PARAMS
+ * reg32d   32 bit destination register
+ * reg32s   32 bit memory pointer
+ * disp8    8 bit memory displacement
+ */
+void CodeGenerator::sbb_r32m32_d8(const int reg32d, const int reg32s, const uint8_t disp8)
+{
+    //1B /r
+    //SBB r32,r/m32
+    //Subtract with borrow r/m32 from r32
+    mMachineCode[mIndex++] = 0x1B;
+    mMachineCode[mIndex++] = X86_MODRM_BYTE(X86_MOD_MEM_DISPB, reg32d, reg32s);
+    mMachineCode[mIndex++] = disp8;
 }
 
 /**
@@ -1102,11 +1851,15 @@ void CodeGenerator::add_r32i32(const int reg32, const uint32_t imm32)
  */
 void CodeGenerator::sub_r8r8(const int reg8d, const int reg8s)
 {
+    const int start = mIndex;
+
     //28 /r
     //SUB r/m8,r8
     //Subtract r8 from r/m8
     mMachineCode[mIndex++] = 0x28;
     mMachineCode[mIndex++] = X86_MODRM_BYTE(X86_MOD_REG, reg8s, reg8d);
+
+    keepPeephole(start, reg8d);
 }
 
 /**
@@ -1134,10 +1887,42 @@ void CodeGenerator::sub_r32i32(const int reg32, const uint32_t imm32)
         mMachineCode[mIndex++] = X86_MODRM_BYTE(X86_MOD_REG, 0x5, reg32);
     }
 
-    mMachineCode[mIndex++] = imm32&0xFF;
-    mMachineCode[mIndex++] = ((imm32>>8)&0xFF);
-    mMachineCode[mIndex++] = ((imm32>>16)&0xFF);
-    mMachineCode[mIndex++] = ((imm32>>24)&0xFF);
+    emit32(imm32);
+}
+
+/**
+ * SUB m32,i32
+ *
+ * PARAMS
+ * reg32   32 bit memory pointer
+ * imm32   32 bit immediate
+ */
+void CodeGenerator::sub_m32i32(const int reg32, const uint32_t imm32)
+{
+    //81 /5 id
+    //SUB r/m32,imm32
+    //Subtract imm32 from r/m32
+    mMachineCode[mIndex++] = 0x81;
+    mMachineCode[mIndex++] = X86_MODRM_BYTE(X86_MOD_MEM, 0x5, reg32);
+    emit32(imm32);
+}
+
+/**
+ * SUB m32,i32
+ * Memory operand is addressed by a 32 bit displacement only
+ *
+ * PARAMS
+ * disp32  32 bit memory address
+ * imm32   32 bit immediate
+ */
+void CodeGenerator::sub_m32i32_d32(const uint32_t disp32, const uint32_t imm32)
+{
+    //81 /5 id
+    //SUB r/m32,imm32
+    //Subtract imm32 from r/m32
+    mMachineCode[mIndex++] = 0x81;
+    emitAbsolute(0x5, disp32);
+    emit32(imm32);
 }
 
 /**
@@ -1149,6 +1934,8 @@ void CodeGenerator::sub_r32i32(const int reg32, const uint32_t imm32)
  */
 void CodeGenerator::sub_r8i8(const int reg8, const uint8_t imm8)
 {
+    const int start = mIndex;
+
     //2C ib
     //SUB AL,imm8
     //Subtract imm8 from AL
@@ -1166,6 +1953,8 @@ void CodeGenerator::sub_r8i8(const int reg8, const uint8_t imm8)
     }
 
     mMachineCode[mIndex++] = imm8;
+
+    keepPeephole(start, reg8);
 }
 
 /**
@@ -1176,11 +1965,15 @@ void CodeGenerator::sub_r8i8(const int reg8, const uint8_t imm8)
  */
 void CodeGenerator::inc_r8(const int reg8)
 {
+    const int start = mIndex;
+
     //FE /0
     //INC r/m8
     //Increment r/m byte by 1
     mMachineCode[mIndex++] = 0xFE;
     mMachineCode[mIndex++] = X86_MODRM_BYTE(X86_MOD_REG, 0x0, reg8);
+
+    keepPeephole(start, reg8);
 }
 
 /**
@@ -1206,10 +1999,18 @@ void CodeGenerator::inc_r16(const int reg16)
  */
 void CodeGenerator::inc_r32(const int reg32)
 {
+#ifdef X86_LONG_MODE
+    //FF /0
+    //INC r/m32
+    //40+ rd is a REX prefix in 64 bit mode
+    mMachineCode[mIndex++] = 0xFF;
+    mMachineCode[mIndex++] = X86_MODRM_BYTE(X86_MOD_REG, 0x0, reg32);
+#else
     //40+ rd
     //INC r32
     //Increment doubleword register by 1
     mMachineCode[mIndex++] = 0x40+reg32;
+#endif
 }
 
 /**
@@ -1220,10 +2021,18 @@ void CodeGenerator::inc_r32(const int reg32)
  */
 void CodeGenerator::dec_r32(const int reg32)
 {
+#ifdef X86_LONG_MODE
+    //FF /1
+    //DEC r/m32
+    //48+rd is a REX prefix in 64 bit mode
+    mMachineCode[mIndex++] = 0xFF;
+    mMachineCode[mIndex++] = X86_MODRM_BYTE(X86_MOD_REG, 0x1, reg32);
+#else
     //48+rd
     //DEC r32
     //Decrement r32 by 1
     mMachineCode[mIndex++] = 0x48+reg32;
+#endif
 }
 
 /**
@@ -1234,11 +2043,15 @@ void CodeGenerator::dec_r32(const int reg32)
  */
 void CodeGenerator::shl1_r8(const int reg8)
 {
+    const int start = mIndex;
+
     //D0 /4
     //SHL r/m8,1
     //Multiply r/m8 by 2, once
     mMachineCode[mIndex++] = 0xD0;
     mMachineCode[mIndex++] = X86_MODRM_BYTE(X86_MOD_REG, 0x4, reg8);
+
+    keepPeephole(start, reg8);
 }
 
 /**
@@ -1249,11 +2062,15 @@ void CodeGenerator::shl1_r8(const int reg8)
  */
 void CodeGenerator::shr1_r8(const int reg8)
 {
+    const int start = mIndex;
+
     //D0 /5
     //SHR r/m8,1
     //Unsigned divide r/m8 by 2, once
     mMachineCode[mIndex++] = 0xD0;
     mMachineCode[mIndex++] = X86_MODRM_BYTE(X86_MOD_REG, 0x5, reg8);
+
+    keepPeephole(start, reg8);
 }
 
 /**
@@ -1264,12 +2081,16 @@ void CodeGenerator::shr1_r8(const int reg8)
  */
 void CodeGenerator::setnc_r8(const int reg8)
 {
+    const int start = mIndex;
+
     //0F 93 /0
     //SETNC r/m8
     //Set byte if not carry (CF=0)
     mMachineCode[mIndex++] = 0x0F;
     mMachineCode[mIndex++] = 0x93;
     mMachineCode[mIndex++] = X86_MODRM_BYTE(X86_MOD_REG, 0x0, reg8);
+
+    keepPeephole(start, reg8);
 }
 
 /**
@@ -1280,12 +2101,16 @@ void CodeGenerator::setnc_r8(const int reg8)
  */
 void CodeGenerator::setc_r8(const int reg8)
 {
+    const int start = mIndex;
+
     //0F 92 /0
     //SETC r/m8
     //Set if carry (CF=1)
     mMachineCode[mIndex++] = 0x0F;
     mMachineCode[mIndex++] = 0x92;
     mMachineCode[mIndex++] = X86_MODRM_BYTE(X86_MOD_REG, 0x0, reg8);
+
+    keepPeephole(start, reg8);
 }
 
 /**
@@ -1332,10 +2157,7 @@ void CodeGenerator::push_i32(const uint32_t imm32)
     //PUSH imm32
     //Push imm32
     mMachineCode[mIndex++] = 0x68;
-    mMachineCode[mIndex++] = imm32&0xFF;
-    mMachineCode[mIndex++] = ((imm32>>8)&0xFF);
-    mMachineCode[mIndex++] = ((imm32>>16)&0xFF);
-    mMachineCode[mIndex++] = ((imm32>>24)&0xFF);
+    emit32(imm32);
 }
 
 /**
@@ -1346,10 +2168,14 @@ void CodeGenerator::push_i32(const uint32_t imm32)
  */
 void CodeGenerator::push_r32(const int reg32)
 {
+    const int start = mIndex;
+
     //50+rd
     //PUSH r32
     //Push r32
     mMachineCode[mIndex++] = 0x50+reg32;
+
+    keepPeephole(start, -1);
 }
 
 /**
@@ -1529,9 +2355,9 @@ void CodeGenerator::jc_i32(const int32_t rel32)
  */
 void CodeGenerator::jmp(const Label_t label)
 {
-    mJumps.push_back(new Jump(mIndex, label, &CodeGenerator::insert_jmp));
-    nop(); nop(); nop();
-    nop(); nop(); nop();
+    //room for the longest form, the jump is written by insertJumps
+    mJumps.push_back(Jump(mIndex, label, CG_JUMP_SIZE_JMP, &CodeGenerator::insert_jmp));
+    mIndex += CG_JUMP_SPACE;
 }
 
 /**
@@ -1542,9 +2368,9 @@ void CodeGenerator::jmp(const Label_t label)
  */
 void CodeGenerator::jz(const Label_t label)
 {
-    mJumps.push_back(new Jump(mIndex, label, &CodeGenerator::insert_jz));
-    nop(); nop(); nop();
-    nop(); nop(); nop();
+    //room for the longest form, the jump is written by insertJumps
+    mJumps.push_back(Jump(mIndex, label, CG_JUMP_SIZE_JCC, &CodeGenerator::insert_jz));
+    mIndex += CG_JUMP_SPACE;
 }
 
 /**
@@ -1555,9 +2381,9 @@ void CodeGenerator::jz(const Label_t label)
  */
 void CodeGenerator::jnz(const Label_t label)
 {
-    mJumps.push_back(new Jump(mIndex, label, &CodeGenerator::insert_jnz));
-    nop(); nop(); nop();
-    nop(); nop(); nop();
+    //room for the longest form, the jump is written by insertJumps
+    mJumps.push_back(Jump(mIndex, label, CG_JUMP_SIZE_JCC, &CodeGenerator::insert_jnz));
+    mIndex += CG_JUMP_SPACE;
 }
 
 /**
@@ -1568,9 +2394,9 @@ void CodeGenerator::jnz(const Label_t label)
  */
 void CodeGenerator::jc(const Label_t label)
 {
-    mJumps.push_back(new Jump(mIndex, label, &CodeGenerator::insert_jc));
-    nop(); nop(); nop();
-    nop(); nop(); nop();
+    //room for the longest form, the jump is written by insertJumps
+    mJumps.push_back(Jump(mIndex, label, CG_JUMP_SIZE_JCC, &CodeGenerator::insert_jc));
+    mIndex += CG_JUMP_SPACE;
 }
 
 /**
@@ -1581,9 +2407,35 @@ void CodeGenerator::jc(const Label_t label)
  */
 void CodeGenerator::jnc(const Label_t label)
 {
-    mJumps.push_back(new Jump(mIndex, label, &CodeGenerator::insert_jnc));
-    nop(); nop(); nop();
-    nop(); nop(); nop();
+    //room for the longest form, the jump is written by insertJumps
+    mJumps.push_back(Jump(mIndex, label, CG_JUMP_SIZE_JCC, &CodeGenerator::insert_jnc));
+    mIndex += CG_JUMP_SPACE;
+}
+
+/**
+ * Insert JLE to label
+ *
+ * PARAMS
+ * label    destination
+ */
+void CodeGenerator::jle(const Label_t label)
+{
+    //room for the longest form, the jump is written by insertJumps
+    mJumps.push_back(Jump(mIndex, label, CG_JUMP_SIZE_JCC, &CodeGenerator::insert_jle));
+    mIndex += CG_JUMP_SPACE;
+}
+
+/**
+ * Insert JA to label
+ *
+ * PARAMS
+ * label    destination
+ */
+void CodeGenerator::ja(const Label_t label)
+{
+    //room for the longest form, the jump is written by insertJumps
+    mJumps.push_back(Jump(mIndex, label, CG_JUMP_SIZE_JCC, &CodeGenerator::insert_ja));
+    mIndex += CG_JUMP_SPACE;
 }
 
 /**
@@ -1690,6 +2542,74 @@ void CodeGenerator::jnc_i32(const int32_t rel32)
     mMachineCode[mIndex++] = ((rel32>>24)&0xFF);
 }
 
+/**
+ * JLE i8
+ *
+ * PARAMS
+ * rel8   8 bit immediate, relative distance
+ */
+void CodeGenerator::jle_i8(const int8_t rel8)
+{
+    //7E cb
+    //JLE rel8
+    //Jump short if less or equal (ZF=1 or SF!=OF)
+    mMachineCode[mIndex++] = 0x7E;
+    mMachineCode[mIndex++] = rel8;
+}
+
+/**
+ * JLE i32
+ *
+ * PARAMS
+ * rel32   32 bit immediate, relative distance
+ */
+void CodeGenerator::jle_i32(const int32_t rel32)
+{
+    //0F 8E cw/cd
+    //JLE rel16/32
+    //Jump near if less or equal (ZF=1 or SF!=OF)
+    mMachineCode[mIndex++] = 0x0F;
+    mMachineCode[mIndex++] = 0x8E;
+    mMachineCode[mIndex++] = rel32&0xFF;
+    mMachineCode[mIndex++] = ((rel32>>8)&0xFF);
+    mMachineCode[mIndex++] = ((rel32>>16)&0xFF);
+    mMachineCode[mIndex++] = ((rel32>>24)&0xFF);
+}
+
+/**
+ * JA i8
+ *
+ * PARAMS
+ * rel8   8 bit immediate, relative distance
+ */
+void CodeGenerator::ja_i8(const int8_t rel8)
+{
+    //77 cb
+    //JA rel8
+    //Jump short if above (CF=0 and ZF=0)
+    mMachineCode[mIndex++] = 0x77;
+    mMachineCode[mIndex++] = rel8;
+}
+
+/**
+ * JA i32
+ *
+ * PARAMS
+ * rel32   32 bit immediate, relative distance
+ */
+void CodeGenerator::ja_i32(const int32_t rel32)
+{
+    //0F 87 cw/cd
+    //JA rel16/32
+    //Jump near if above (CF=0 and ZF=0)
+    mMachineCode[mIndex++] = 0x0F;
+    mMachineCode[mIndex++] = 0x87;
+    mMachineCode[mIndex++] = rel32&0xFF;
+    mMachineCode[mIndex++] = ((rel32>>8)&0xFF);
+    mMachineCode[mIndex++] = ((rel32>>16)&0xFF);
+    mMachineCode[mIndex++] = ((rel32>>24)&0xFF);
+}
+
 /**
  * RDTSC
  */
@@ -1775,12 +2695,16 @@ void CodeGenerator::div_r8(const int reg8)
  */
 void CodeGenerator::shr_r8i8(const int reg8, const uint8_t imm8)
 {
+    const int start = mIndex;
+
     //C0 /5 ib
     //SHR r/m8,imm8
     //Unsigned divide r/m8 by 2, imm8 times
     mMachineCode[mIndex++] = 0xC0;
     mMachineCode[mIndex++] = X86_MODRM_BYTE(X86_MOD_REG, 0x5, reg8);
     mMachineCode[mIndex++] = imm8;
+
+    keepPeephole(start, reg8);
 }
 
 /**
@@ -1825,12 +2749,16 @@ void CodeGenerator::shr_r16i8(const int reg16, const uint8_t imm8)
  */
 void CodeGenerator::shl_r8i8(const int reg8, const uint8_t imm8)
 {
+    const int start = mIndex;
+
     //C0 /4 ib
     //SHL r/m8,imm8
     //Multiply r/m8 by 2, imm8 times
     mMachineCode[mIndex++] = 0xC0;
     mMachineCode[mIndex++] = X86_MODRM_BYTE(X86_MOD_REG, 0x4, reg8);
     mMachineCode[mIndex++] = imm8;
+
+    keepPeephole(start, reg8);
 }
 
 /**
@@ -1908,10 +2836,7 @@ void CodeGenerator::cmp_r32i32(const int reg32, const uint32_t imm32)
         mMachineCode[mIndex++] = X86_MODRM_BYTE(X86_MOD_REG, 0x7, reg32);
     }
 
-    mMachineCode[mIndex++] = imm32&0xFF;
-    mMachineCode[mIndex++] = ((imm32>>8)&0xFF);
-    mMachineCode[mIndex++] = ((imm32>>16)&0xFF);
-    mMachineCode[mIndex++] = ((imm32>>24)&0xFF);
+    emit32(imm32);
 }
 
 /**
@@ -2031,10 +2956,7 @@ void CodeGenerator::and_r32i32(const int reg32, const uint32_t imm32)
         mMachineCode[mIndex++] = X86_MODRM_BYTE(X86_MOD_REG, 0x4, reg32);
     }
 
-    mMachineCode[mIndex++] = imm32&0xFF;
-    mMachineCode[mIndex++] = ((imm32>>8)&0xFF);
-    mMachineCode[mIndex++] = ((imm32>>16)&0xFF);
-    mMachineCode[mIndex++] = ((imm32>>24)&0xFF);
+    emit32(imm32);
 }
 
 /**
@@ -2079,9 +3001,236 @@ void CodeGenerator::test_r16r16(const int reg16d, const int reg16s)
  */
 void CodeGenerator::test_r8r8(const int reg8d, const int reg8s)
 {
+    const int start = mIndex;
+
     //84 /r
     //TEST r/m8, r8
     //AND r8 with r/m8; set SF, ZF, PF according to result.
     mMachineCode[mIndex++] = 0x84;
     mMachineCode[mIndex++] = X86_MODRM_BYTE(X86_MOD_REG, reg8s, reg8d);
+
+    keepPeephole(start, -1);
+}
+
+/**
+ * TEST r8,i8
+ *
+ * PARAMS
+ * reg8     8 bit register
+ * imm8     8 bit immediate
+ */
+void CodeGenerator::test_r8i8(const int reg8, const uint8_t imm8)
+{
+    const int start = mIndex;
+
+    //A8 ib
+    //TEST AL, imm8
+    //AND imm8 with AL; set SF, ZF, PF according to result.
+
+    //F6 /0 ib
+    //TEST r/m8, imm8
+    //AND imm8 with r/m8; set SF, ZF, PF according to result.
+    if(reg8 == X86_REG_AL)
+       mMachineCode[mIndex++] = 0xA8;
+    else
+    {
+        mMachineCode[mIndex++] = 0xF6;
+        mMachineCode[mIndex++] = X86_MODRM_BYTE(X86_MOD_REG, 0x0, reg8);
+    }
+
+    mMachineCode[mIndex++] = imm8;
+
+    keepPeephole(start, -1);
+}
+
+/**
+ * TEST m32,r32
+ *
+ * PARAMS
+ * reg32d    32 bit memory pointer
+ * reg32s    32 bit source register
+ * disp32    32 bit memory displacement
+ */
+void CodeGenerator::test_m32r32_d32(const int reg32d, const int reg32s, const uint32_t disp32)
+{
+    //85 /r
+    //TEST r/m32, r32
+    //AND r32 with r/m32; set SF, ZF, PF according to result.
+    mMachineCode[mIndex++] = 0x85;
+    mMachineCode[mIndex++] = X86_MODRM_BYTE(X86_MOD_MEM_DISPDW, reg32s, reg32d);
+    emit32(disp32);
+}
+
+/**
+ * XOR m32,r32
+ *
+ * PARAMS
+ * reg32d    32 bit memory pointer
+ * reg32s    32 bit source register
+ * disp32    32 bit memory displacement
+ */
+void CodeGenerator::xor_m32r32_d32(const int reg32d, const int reg32s, const uint32_t disp32)
+{
+    //31 /r
+    //XOR r/m32,r32
+    //r/m32 XOR r32
+    mMachineCode[mIndex++] = 0x31;
+    mMachineCode[mIndex++] = X86_MODRM_BYTE(X86_MOD_MEM_DISPDW, reg32s, reg32d);
+    emit32(disp32);
+}
+
+/**
+ * XCHG r32,r32
+ *
+ * PARAMS
+ * reg32d    32 bit destination register
+ * reg32s    32 bit source register
+ */
+void CodeGenerator::xchg_r32r32(const int reg32d, const int reg32s)
+{
+    //87 /r
+    //XCHG r/m32,r32
+    //Exchange r32 with doubleword from r/m32
+    mMachineCode[mIndex++] = 0x87;
+    mMachineCode[mIndex++] = X86_MODRM_BYTE(X86_MOD_REG, reg32s, reg32d);
+}
+
+/**
+ * SHR r32,CL
+ *
+ * PARAMS
+ * reg32     32 bit register, shifted CL times
+ */
+void CodeGenerator::shr_r32cl(const int reg32)
+{
+    //D3 /5
+    //SHR r/m32,CL
+    //Unsigned divide r/m32 by 2, CL times
+    mMachineCode[mIndex++] = 0xD3;
+    mMachineCode[mIndex++] = X86_MODRM_BYTE(X86_MOD_REG, 0x5, reg32);
+}
+
+/**
+ * SHRD r32,r32,CL
+ * Shifts reg32d right CL times, filling it
+ * from the low bits of reg32s
+ *
+ * PARAMS
+ * reg32d    32 bit destination register
+ * reg32s    32 bit source register
+ */
+void CodeGenerator::shrd_r32r32cl(const int reg32d, const int reg32s)
+{
+    //0F AD /r
+    //SHRD r/m32,r32,CL
+    //Shift r/m32 to right CL places while shifting bits from r32 in from the left
+    mMachineCode[mIndex++] = 0x0F;
+    mMachineCode[mIndex++] = 0xAD;
+    mMachineCode[mIndex++] = X86_MODRM_BYTE(X86_MOD_REG, reg32s, reg32d);
+}
+
+/**
+ * PXOR xmm,xmm
+ *
+ * PARAMS
+ * xmmd     128 bit destination register
+ * xmms     128 bit source register
+ */
+void CodeGenerator::pxor_x128x128(const int xmmd, const int xmms)
+{
+    //66 0F EF /r
+    //PXOR xmm1,xmm2/m128
+    //Bitwise XOR of xmm2/m128 and xmm1
+    mMachineCode[mIndex++] = 0x66;
+    mMachineCode[mIndex++] = 0x0F;
+    mMachineCode[mIndex++] = 0xEF;
+    mMachineCode[mIndex++] = X86_MODRM_BYTE(X86_MOD_REG, xmmd, xmms);
+}
+
+/**
+ * MOVDQU m128,xmm
+ *
+ * PARAMS
+ * reg32    32 bit memory pointer
+ * xmm      128 bit source register
+ * disp8    8 bit signed memory displacement
+ */
+void CodeGenerator::movdqu_m128x128_d8(const int reg32, const int xmm, const int8_t disp8)
+{
+    //F3 0F 7F /r
+    //MOVDQU xmm2/m128,xmm1
+    //Move unaligned double quadword from xmm1 to xmm2/m128
+    mMachineCode[mIndex++] = 0xF3;
+    mMachineCode[mIndex++] = 0x0F;
+    mMachineCode[mIndex++] = 0x7F;
+    mMachineCode[mIndex++] = X86_MODRM_BYTE(X86_MOD_MEM_DISPB, xmm, reg32);
+    mMachineCode[mIndex++] = disp8;
+}
+
+/**
+ * MOV r32,m32
+ * Memory operand is addressed by a 32 bit displacement only
+ *
+ * PARAMS
+ * reg32    32 bit destination register
+ * disp32   32 bit memory address
+ */
+void CodeGenerator::mov_r32m32_d32(const int reg32, const uint32_t disp32)
+{
+    //8B /r
+    //MOV r32,r/m32
+    //Move r/m32 to r32
+    mMachineCode[mIndex++] = 0x8B;
+    emitAbsolute(reg32, disp32);
+}
+
+/**
+ * ADD r32,m32
+ * Memory operand is addressed by a 32 bit displacement only
+ *
+ * PARAMS
+ * reg32    32 bit destination register
+ * disp32   32 bit memory address
+ */
+void CodeGenerator::add_r32m32_d32(const int reg32, const uint32_t disp32)
+{
+    //03 /r
+    //ADD r32,r/m32
+    //Add r/m32 to r32
+    mMachineCode[mIndex++] = 0x03;
+    emitAbsolute(reg32, disp32);
+}
+
+/**
+ * SUB r32,m32
+ * Memory operand is addressed by a 32 bit displacement only
+ *
+ * PARAMS
+ * reg32    32 bit destination register
+ * disp32   32 bit memory address
+ */
+void CodeGenerator::sub_r32m32_d32(const int reg32, const uint32_t disp32)
+{
+    //2B /r
+    //SUB r32,r/m32
+    //Subtract r/m32 from r32
+    mMachineCode[mIndex++] = 0x2B;
+    emitAbsolute(reg32, disp32);
+}
+
+/**
+ * MOV m32,r32
+ * Memory operand is addressed by a 32 bit displacement only
+ *
+ * PARAMS
+ * disp32   32 bit memory address
+ * reg32    32 bit source register
+ */
+void CodeGenerator::mov_m32r32_d32(const uint32_t disp32, const int reg32)
+{
+    //89 /r
+    //MOV r/m32,r32
+    //Move r32 to r/m32
+    mMachineCode[mIndex++] = 0x89;
+    emitAbsolute(reg32, disp32);
 }
@@ -26,7 +26,9 @@
 #include <stddef.h>
 
 #include "x86def.h"
+#include "CodeArena.h"
 
+//largest block that is expected to be generated
 #define CG_BLOCK_SIZE 10240
 
 #define CG_INT8_MIN -128
@@ -35,8 +37,32 @@
 //must be power of 2
 #define CG_ALIGNMENT 16
 
+//max number of memory regions that generated code can address
+#define CG_MAX_REGIONS 24
+
+//bytes reserved for a jump to a label, and the sizes it can get
+#define CG_JUMP_SPACE      6
+#define CG_JUMP_SIZE_SHORT 2
+#define CG_JUMP_SIZE_JMP   5
+#define CG_JUMP_SIZE_JCC   6
+
+//labels and jumps room is made for up front, the
+//arrays are cleared between blocks but never shrunk
+#define CG_RESERVED_LABELS 64
+#define CG_RESERVED_JUMPS  64
+
 typedef int Label_t;
 
+/**
+ * An absolute address in generated code, pointing
+ * into a region registered with addRegion
+ */
+struct Relocation_t
+{
+    int offset;
+    int region;
+};
+
 class CodeGenerator
 {
     private:
@@ -50,10 +76,13 @@ class CodeGenerator
         {
             int                     index;
             int                     label;
+            int                     longSize;
+            int                     size;
+            int                     finalIndex;
             CodeGeneratorMemberFn_t pfnJmp;
 
-            Jump(const int i, const int lbl, const CodeGeneratorMemberFn_t pfn)
-            {index = i; label = lbl; pfnJmp = pfn;}
+            Jump(const int i, const int lbl, const int lsize, const CodeGeneratorMemberFn_t pfn)
+            {index = i; label = lbl; longSize = lsize; size = 0; finalIndex = i; pfnJmp = pfn;}
          // Jump(const Jump&);
          // Jump& Jump=(const Jump&);
          // ~Jump()
@@ -73,15 +102,115 @@ class CodeGenerator
          // ~Label()
         };
 
-        std::vector<Label *> mLabels;
-        std::list<Jump *>    mJumps;
-        uint8_t              mMachineCode[CG_BLOCK_SIZE];
-        int                  mIndex;
+        /**
+         * A memory region that generated code can address
+         */
+        struct Region
+        {
+            uintptr_t base;
+            size_t    size;
+        };
 
         /**
-         * Insert all jumps into the code.
+         * What the peephole optimizer knows about the registers at
+         * index, the end of the code generated so far. Emitters that
+         * keep the facts move index along, any other code leaves it
+         * behind and the facts are forgotten.
          */
-        void insertJumps();
+        struct Peephole
+        {
+            int      index;
+            int      pointer;
+            uint32_t pointerAddress;
+            bool     byteKnown[X86_COUNT_REGS_8BIT];
+            uint32_t byteAddress[X86_COUNT_REGS_8BIT];
+        };
+
+        std::vector<Label>      mLabels;
+        std::vector<Jump>       mJumps;
+        std::list<Relocation_t> mRelocations;
+        Region                  mRegions[CG_MAX_REGIONS];
+        int                     mRegionCount;
+        bool                    mRegionsValid;
+        CodeArena              *pmArena;
+        uint8_t                *mMachineCode;
+        int                     mIndex;
+        bool                    mJumpsInserted;
+        Peephole                mPeephole;
+
+        /**
+         * Gives every jump to a label the size of its
+         * shortest form, starting with the short form
+         * and growing the jumps that do not reach
+         * until no more jump has to grow.
+         */
+        void relaxJumps();
+
+        /**
+         * Write a 32 bit immediate or displacement. Values that
+         * point into a registered region are recorded as relocations.
+         *
+         * PARAMS
+         * value    32 bit value
+         */
+        void emit32(const uint32_t value);
+
+        /**
+         * Write the ModR/M byte of a memory operand at an absolute
+         * address, followed by the address. In 64 bit mode a disp32
+         * without SIB byte is relative to the instruction pointer.
+         *
+         * PARAMS
+         * reg      register or opcode extension of the ModR/M byte
+         * disp32   32 bit memory address
+         */
+        void emitAbsolute(const int reg, const uint32_t disp32);
+
+        /**
+         * Find the registered region a value points into
+         *
+         * PARAMS
+         * value    32 bit value
+         *
+         * RETURNS
+         * region number, -1 if it is not in a region
+         */
+        int findRegion(const uint32_t value) const;
+
+        /**
+         * Forget the peephole facts, the code at the current
+         * position can be reached from elsewhere
+         */
+        void forgetPeephole();
+
+        /**
+         * Start a peephole memory access, facts that are
+         * no longer valid at the current position are dropped
+         */
+        void beginPeephole();
+
+        /**
+         * Called by the register emitters that keep the peephole
+         * facts valid, after an instruction is emitted
+         *
+         * PARAMS
+         * start    position of the instruction
+         * reg8     8 bit register written, -1 if none
+         */
+        void keepPeephole(const int start, const int reg8);
+
+        /**
+         * Make a register point near an address, reusing the
+         * address already in it when it is close enough
+         *
+         * PARAMS
+         * reg32    32 bit register used as pointer
+         * address  absolute address
+         *
+         * RETURNS
+         * displacement of the address from the register
+         */
+        int pointTo(const int reg32, const uint32_t address);
 
         /**
          * Jump If Not Zero.
@@ -128,6 +257,24 @@ class CodeGenerator
          */
         void insert_jmp(const int32_t rel);
 
+        /**
+         * Jump If Less or Equal.
+         * Insert a jump into the code
+         *
+         * PARAMS
+         *   rel    distance between label and jump
+         */
+        void insert_jle(const int32_t rel);
+
+        /**
+         * Jump If Above.
+         * Insert a jump into the code
+         *
+         * PARAMS
+         *   rel    distance between label and jump
+         */
+        void insert_ja(const int32_t rel);
+
         /**
          * Destroy all data in the object.
          */
@@ -135,6 +282,26 @@ class CodeGenerator
 
     public:
 
+        /**
+         * Insert all jumps into the code. Every jump gets its shortest
+         * form and the code after it is moved back over the bytes it
+         * does not use. Relocations move with the code. No more code
+         * may be generated after this, until the code is committed.
+         */
+        void insertJumps();
+
+        /**
+         * Get the position of generated code after the jumps
+         * are inserted
+         *
+         * PARAMS
+         * index    position before the jumps were inserted
+         *
+         * RETURNS
+         * position after the jumps were inserted
+         */
+        int getFinalIndex(const int index) const;
+
         /**
          * Insert a label at current position
          *
@@ -152,17 +319,24 @@ class CodeGenerator
         Label_t newLabel();
 
         /**
-         * Copies the code to the heap and return a pointer to it
+         * Commits the code to the code arena and return a pointer to it
          * The code is guaranteed to be aligned
+         *
+         * PARAMS
+         * size     size of the code is stored here
+         *
          * RETURNS
          * void pointer to generated code
          */
-        void* getAlignedCodePointer(void **const pBlock, size_t *size);
+        void* getAlignedCodePointer(size_t *size);
 
         /**
-         * Copies the code to the heap and return a pointer to it
+         * Commits the code to the code arena and return a pointer to it
          * The code is NOT guaranteed to be aligned
          *
+         * PARAMS
+         * size     size of the code is stored here
+         *
          * RETURNS
          * void pointer to generated code
          */
@@ -178,6 +352,78 @@ class CodeGenerator
          */
         void align();
 
+        /**
+         * Get current position in the code, counted from the start
+         * of the block being generated. The position may be entered
+         * from elsewhere, so the peephole facts are forgotten.
+         *
+         * RETURNS
+         * offset of the next byte to be written
+         */
+        int getIndex();
+
+        /**
+         * Get the number of bytes that can still be generated
+         * before the code arena is full
+         *
+         * RETURNS
+         * number of free bytes after the code being generated
+         */
+        size_t getFreeSpace() const;
+
+        /**
+         * Register a memory region that generated code addresses.
+         * Absolute addresses into the region are recorded as
+         * relocations, so the code can be moved to a process
+         * where the region is located elsewhere.
+         *
+         * PARAMS
+         * pBase    start of the region
+         * size     size of the region in bytes
+         *
+         * RETURNS
+         * region number, -1 if there is no room for more regions
+         * or the generated code can not reach the region
+         */
+        int addRegion(const void *const pBase, const size_t size);
+
+        /**
+         * Check that every region could be registered
+         *
+         * RETURNS
+         * true if the generated code can address all regions
+         */
+        bool isRegionsValid() const;
+
+        /**
+         * Get the start of a registered region
+         *
+         * PARAMS
+         * region   region number
+         *
+         * RETURNS
+         * address of the region
+         */
+        uintptr_t getRegionBase(const int region) const;
+
+        /**
+         * Get number of registered regions
+         *
+         * RETURNS
+         * number of regions
+         */
+        int getRegionCount() const;
+
+        /**
+         * Move the relocations recorded for the code being
+         * generated to a list. Must be called before the code
+         * is committed.
+         *
+         * PARAMS
+         * rRelocations     relocations are moved here
+         */
+        void takeRelocations(std::list<Relocation_t> &rRelocations);
+
         /**
          * Reset
          */
@@ -185,14 +431,63 @@ class CodeGenerator
 
         /**
          * Constructor
+         *
+         * PARAMS
+         * pArena   code arena to emit code into
          */
-        CodeGenerator();
+        CodeGenerator(CodeArena *const pArena);
 
         /**
          * Destructor
          */
         ~CodeGenerator();
 
+        /**
+         * Load a byte from an absolute address. A byte that is still
+         * in a register is copied from it instead, and a pointer that
+         * is close enough to the address is reused.
+         *
+         * PARAMS
+         * reg8d    8 bit destination register
+         * reg32    32 bit register used as pointer, undefined after
+         * address  absolute address
+         */
+        void load_r8(const int reg8d, const int reg32, const uint32_t address);
+
+        /**
+         * Store a byte at an absolute address, unless the address
+         * is known to hold it already. A pointer that is close
+         * enough to the address is reused.
+         *
+         * PARAMS
+         * reg32    32 bit register used as pointer, undefined after
+         * address  absolute address
+         * reg8s    8 bit source register
+         */
+        void store_r8(const int reg32, const uint32_t address, const int reg8s);
+
+        /**
+         * Load 32 bits from an absolute address. A pointer that
+         * is close enough to the address is reused.
+         *
+         * PARAMS
+         * reg32d   32 bit destination register
+         * reg32    32 bit register used as pointer, undefined after
+         * address  absolute address
+         */
+        void load_r32(const int reg32d, const int reg32, const uint32_t address);
+
+        /**
+         * Store 32 bits at an absolute address. A pointer that
+         * is close enough to the address is reused.
+         *
+         * PARAMS
+         * reg32    32 bit register used as pointer, undefined after
+         * address  absolute address
+         * reg32s   32 bit source register
+         */
+        void store_r32(const int reg32, const uint32_t address, const int reg32s);
+
         /**
          * MOV r32,imm32
          *
@@ -317,6 +612,16 @@ class CodeGenerator
          */
         void mov_r32m32(const int reg32d, const int reg32s);
 
+        /**
+         * MOV r32,m32
+         *
+         * PARAMS
+         * reg32d    32 bit destination register
+         * reg32s    32 bit memory pointer
+         * disp8     8 bit memory displacement
+         */
+        void mov_r32m32_d8(const int reg32d, const int reg32s, const uint8_t disp8);
+
         /**
          * MOV r16,m16
          *
@@ -354,6 +659,16 @@ class CodeGenerator
          */
         void mov_m32r32(const int reg32d, const int reg32s);
 
+        /**
+         * MOV m32,r32
+         *
+         * PARAMS
+         * reg32d    32 bit memory pointer
+         * reg32s    32 bit source register
+         * disp8     8 bit memory displacement
+         */
+        void mov_m32r32_d8(const int reg32d, const int reg32s, const uint8_t disp8);
+
         /**
          * MOV m16,r16
          *
@@ -429,6 +744,14 @@ class CodeGenerator
          */
         void call_r32(const int reg32);
 
+        /**
+         * JMP r32
+         *
+         * PARAMS
+         * reg32    32 bit register with destination address
+         */
+        void jmp_r32(const int reg32);
+
         /**
          * CMP r8,i8
          *
@@ -466,6 +789,27 @@ class CodeGenerator
          */
         void cmp_m8i8_d8(const int reg32, const uint8_t imm8, const uint8_t disp8);
 
+        /**
+         * CMP m8,i8
+         *
+         * PARAMS
+         * reg32   32 bit memory pointer
+         * imm8    8 bit immediate
+         * disp32  32 bit memory displacement
+         */
+        void cmp_m8i8_d32(const int reg32, const uint8_t imm8, const uint32_t disp32);
+
+        /**
+         * CMP m32,i8
+         * The immediate is sign extended
+         *
+         * PARAMS
+         * reg32   32 bit memory pointer
+         * imm8    8 bit immediate
+         * disp8   8 bit memory displacement
+         */
+        void cmp_m32i8_d8(const int reg32, const uint8_t imm8, const uint8_t disp8);
+
         /**
          * CMP r8,r8
          *
@@ -537,6 +881,14 @@ class CodeGenerator
          */
         void not_r8(const int reg8);
 
+        /**
+         * NEG r8
+         *
+         * PARAMS
+         * reg8   8 bit register
+         */
+        void neg_r8(const int reg8);
+
         /**
          * ADD r8,i8
          *
@@ -591,6 +943,64 @@ class CodeGenerator
          */
         void add_r32i32(const int reg32, const uint32_t imm32);
 
+        /**
+         * ADD m32,r32
+         *
+         * PARAMS
+         * reg32d   32 bit memory pointer
+         * reg32s   32 bit source register
+         */
+        void add_m32r32(const int reg32d, const int reg32s);
+
+        /**
+         * ADD m32,i32
+         * Memory operand is addressed by a 32 bit displacement only
+         *
+         * PARAMS
+         * disp32  32 bit memory address
+         * imm32   32 bit immediate
+         */
+        void add_m32i32_d32(const uint32_t disp32, const uint32_t imm32);
+
+        /**
+         * ADC m32,r32
+         *
+         * PARAMS
+         * reg32d   32 bit memory pointer
+         * reg32s   32 bit source register
+         * disp8    8 bit memory displacement
+         */
+        void adc_m32r32_d8(const int reg32d, const int reg32s, const uint8_t disp8);
+
+        /**
+         * ADC m32,i32
+         * Memory operand is addressed by a 32 bit displacement only
+         *
+         * PARAMS
+         * disp32  32 bit memory address
+         * imm32   32 bit immediate
+         */
+        void adc_m32i32_d32(const uint32_t disp32, const uint32_t imm32);
+
+        /**
+         * SUB r32,m32
+         *
+         * PARAMS
+         * reg32d   32 bit destination register
+         * reg32s   32 bit memory pointer
+         */
+        void sub_r32m32(const int reg32d, const int reg32s);
+
+        /**
+         * SBB r32,m32
+         *
+         * PARAMS
+         * reg32d   32 bit destination register
+         * reg32s   32 bit memory pointer
+         * disp8    8 bit memory displacement
+         */
+        void sbb_r32m32_d8(const int reg32d, const int reg32s, const uint8_t disp8);
+
         /**
          * SUB r8,r8
          *
@@ -609,6 +1019,25 @@ class CodeGenerator
          */
         void sub_r32i32(const int reg32, const uint32_t imm32);
 
+        /**
+         * SUB m32,i32
+         *
+         * PARAMS
+         * reg32   32 bit memory pointer
+         * imm32   32 bit immediate
+         */
+        void sub_m32i32(const int reg32, const uint32_t imm32);
+
+        /**
+         * SUB m32,i32
+         * Memory operand is addressed by a 32 bit displacement only
+         *
+         * PARAMS
+         * disp32  32 bit memory address
+         * imm32   32 bit immediate
+         */
+        void sub_m32i32_d32(const uint32_t disp32, const uint32_t imm32);
+
         /**
          * SUB r8,i8
          *
@@ -834,6 +1263,22 @@ class CodeGenerator
          */
         void jnc(const Label_t label);
 
+        /**
+         * Insert JLE to label
+         *
+         * PARAMS
+         * label    destination
+         */
+        void jle(const Label_t label);
+
+        /**
+         * Insert JA to label
+         *
+         * PARAMS
+         * label    destination
+         */
+        void ja(const Label_t label);
+
         /**
          * JNZ i8
          *
@@ -882,6 +1327,38 @@ class CodeGenerator
          */
         void jnc_i32(const int32_t rel32);
 
+        /**
+         * JLE i8
+         *
+         * PARAMS
+         * rel8   8 bit immediate, relative distance
+         */
+        void jle_i8(const int8_t rel8);
+
+        /**
+         * JLE i32
+         *
+         * PARAMS
+         * rel32   32 bit immediate, relative distance
+         */
+        void jle_i32(const int32_t rel32);
+
+        /**
+         * JA i8
+         *
+         * PARAMS
+         * rel8   8 bit immediate, relative distance
+         */
+        void ja_i8(const int8_t rel8);
+
+        /**
+         * JA i32
+         *
+         * PARAMS
+         * rel32   32 bit immediate, relative distance
+         */
+        void ja_i32(const int32_t rel32);
+
         /**
          * RDTSC
          */
@@ -1065,6 +1542,122 @@ class CodeGenerator
          */
         void test_r8r8(const int reg8d, const int reg8s);
 
+        /**
+         * TEST r8,i8
+         *
+         * PARAMS
+         * reg8     8 bit register
+         * imm8     8 bit immediate
+         */
+        void test_r8i8(const int reg8, const uint8_t imm8);
+
+        /**
+         * TEST m32,r32
+         *
+         * PARAMS
+         * reg32d    32 bit memory pointer
+         * reg32s    32 bit source register
+         * disp32    32 bit memory displacement
+         */
+        void test_m32r32_d32(const int reg32d, const int reg32s, const uint32_t disp32);
+
+        /**
+         * XOR m32,r32
+         *
+         * PARAMS
+         * reg32d    32 bit memory pointer
+         * reg32s    32 bit source register
+         * disp32    32 bit memory displacement
+         */
+        void xor_m32r32_d32(const int reg32d, const int reg32s, const uint32_t disp32);
+
+        /**
+         * XCHG r32,r32
+         *
+         * PARAMS
+         * reg32d    32 bit destination register
+         * reg32s    32 bit source register
+         */
+        void xchg_r32r32(const int reg32d, const int reg32s);
+
+        /**
+         * SHR r32,CL
+         *
+         * PARAMS
+         * reg32     32 bit register, shifted CL times
+         */
+        void shr_r32cl(const int reg32);
+
+        /**
+         * SHRD r32,r32,CL
+         * Shifts reg32d right CL times, filling it
+         * from the low bits of reg32s
+         *
+         * PARAMS
+         * reg32d    32 bit destination register
+         * reg32s    32 bit source register
+         */
+        void shrd_r32r32cl(const int reg32d, const int reg32s);
+
+        /**
+         * PXOR xmm,xmm
+         *
+         * PARAMS
+         * xmmd     128 bit destination register
+         * xmms     128 bit source register
+         */
+        void pxor_x128x128(const int xmmd, const int xmms);
+
+        /**
+         * MOVDQU m128,xmm
+         *
+         * PARAMS
+         * reg32    32 bit memory pointer
+         * xmm      128 bit source register
+         * disp8    8 bit signed memory displacement
+         */
+        void movdqu_m128x128_d8(const int reg32, const int xmm, const int8_t disp8);
+
+        /**
+         * MOV r32,m32
+         * Memory operand is addressed by a 32 bit displacement only
+         *
+         * PARAMS
+         * reg32    32 bit destination register
+         * disp32   32 bit memory address
+         */
+        void mov_r32m32_d32(const int reg32, const uint32_t disp32);
+
+        /**
+         * ADD r32,m32
+         * Memory operand is addressed by a 32 bit displacement only
+         *
+         * PARAMS
+         * reg32    32 bit destination register
+         * disp32   32 bit memory address
+         */
+        void add_r32m32_d32(const int reg32, const uint32_t disp32);
+
+        /**
+         * SUB r32,m32
+         * Memory operand is addressed by a 32 bit displacement only
+         *
+         * PARAMS
+         * reg32    32 bit destination register
+         * disp32   32 bit memory address
+         */
+        void sub_r32m32_d32(const int reg32, const uint32_t disp32);
+
+        /**
+         * MOV m32,r32
+         * Memory operand is addressed by a 32 bit displacement only
+         *
+         * PARAMS
+         * disp32   32 bit memory address
+         * reg32    32 bit source register
+         */
+        void mov_m32r32_d32(const uint32_t disp32, const int reg32);
+
 };
 
 
@@ -0,0 +1,347 @@
+/************************************************************
+  **** Dispatcher.cpp (implementation of .h)
+   ***
+    ** Author:
+     *   Tommy Hellstrom
+     *
+     * Description:
+     *   Decides how the code at the PC is run: by the
+     *   translated code, the interpreter or after it has
+     *   been translated
+     *
+     * Revision history:
+     *   When         Who       What
+     *   20261016     me        created
+     *
+     * License information:
+     *   GPLv3
+     *
+     ********************************************************/
+
+#include <list>
+#include <sys/mman.h>
+
+#include "Dispatcher.h"
+
+/**
+ * Translates all code that can be found in the rom ahead of time.
+ * Starting at C8_PC_START, the static exits of each translated block
+ * (jumps, calls, return addresses of calls and both paths of skip
+ * instructions) lead to more code. Targets of BNNN and 00EE are only
+ * known at runtime and are left to be translated by the dispatcher.
+ *
+ * RETURNS
+ * number of blocks translated
+ */
+int Dispatcher::translateAhead()
+{
+    CodeBlock *ptr;
+    std::list<uint32_t> work;
+    int count = 0;
+
+    work.push_back(C8_PC_START);
+
+    while(!work.empty() && !mCache.isFull())
+    {
+        uint32_t pc = work.front();
+        work.pop_front();
+
+        if(mCache.exists(pc))
+            continue;
+
+        //code running past the end of memory is never translated
+        while(pc < C8_MEMSIZE - 1 && mDynarec.emit((pmC8_memory[pc] << 8) | pmC8_memory[pc + 1], pc));
+
+        if(pc >= C8_MEMSIZE - 1)
+        {
+            mDynarec.reset();
+            continue;
+        }
+
+        //the arena is full, the rest is translated at runtime
+        if(mDynarec.isArenaFull())
+        {
+            mDynarec.reset();
+            break;
+        }
+
+        while(mDynarec.getCodeBlock(&ptr))
+        {
+            for(int i = 0; i < ptr->exitCount; i++)
+                work.push_back(ptr->exits[i].target);
+
+            if(mCache.insert(ptr))
+                count++;
+            else
+                delete ptr;
+        }
+    }
+
+    return count;
+}
+
+/**
+ * Forms a superblock from a hot block and the hot path through
+ * its successors, and replaces the hot block with it
+ *
+ * PARAMS
+ * address  address of the hot block
+ *
+ * RETURNS
+ * true if the block was replaced, otherwise false
+ */
+bool Dispatcher::translateTrace(const uint32_t address)
+{
+    CodeBlock *ptr;
+    std::list<uint32_t> trace;
+    uint32_t pc = address;
+    bool replaced = false;
+
+    mCache.selectTrace(address, trace);
+
+    //a single block is already translated
+    if(trace.size() < 2)
+        return false;
+
+    mDynarec.setTrace(trace);
+
+    while(pc < C8_MEMSIZE - 1 && mDynarec.emit((pmC8_memory[pc] << 8) | pmC8_memory[pc + 1], pc));
+
+    if(pc >= C8_MEMSIZE - 1)
+    {
+        mDynarec.reset();
+        return false;
+    }
+
+    //the superblock did not fit, the hot code is translated again from scratch
+    if(mDynarec.isArenaFull())
+    {
+        mDynarec.reset();
+        mCache.flush();
+        return false;
+    }
+
+    while(mDynarec.getCodeBlock(&ptr))
+    {
+        if(ptr->address == address)
+        {
+            mCache.replace(ptr);
+            replaced = true;
+        }
+        else if(!mCache.insert(ptr))
+            delete ptr;
+    }
+
+    return replaced;
+}
+
+/**
+ * Translates the code at an address. Code that runs past the
+ * end of memory is not translated, the interpreter runs it
+ * until the PC stops there. When the code does not fit in the
+ * arena, the cache is flushed and the code translated again.
+ *
+ * PARAMS
+ * address  address of the code
+ *
+ * RETURNS
+ * true if the code was translated, otherwise false
+ */
+bool Dispatcher::translate(const uint32_t address)
+{
+    uint32_t pc = address;
+
+    while(pc < C8_MEMSIZE - 1 && mDynarec.emit((pmC8_memory[pc] << 8) | pmC8_memory[pc + 1], pc));
+
+    if(pc >= C8_MEMSIZE - 1)
+    {
+        mDynarec.reset();
+        mInterpreter.cool(address);
+        return false;
+    }
+
+    //a block did not fit, the code is translated again into the emptied arena
+    if(mDynarec.isArenaFull())
+    {
+        mDynarec.reset();
+        mCache.flush();
+        pc = address;
+
+        while(pc < C8_MEMSIZE - 1 && mDynarec.emit((pmC8_memory[pc] << 8) | pmC8_memory[pc + 1], pc));
+    }
+
+    return true;
+}
+
+/**
+ * Executes at least opcount opcodes, or translates the
+ * code at the PC when it is not translated yet
+ *
+ * PARAMS
+ * opcount  number of opcodes to execute
+ *
+ * RETURNS
+ * true if the opcodes were executed, false if the code was translated
+ * or execution was handed over before all opcodes were executed
+ */
+bool Dispatcher::dispatch(const int opcount)
+{
+    CodeBlock *ptr;
+    uint32_t &rPC = *pmC8_pc;
+    bool ran;
+
+    //translated code and the interpreter count down the same budget
+    ran = mCache.executeN(rPC, opcount);
+    mOpcodeCount += opcount - *mCache.getBudget();
+
+    if(ran)
+        return true;
+
+    //the PC ran past the last opcode in memory, the machine
+    //stops there the same way it does while it waits for a key
+    if(rPC >= C8_MEMSIZE - 1)
+        return true;
+
+    //start over when the arena can not hold another translation
+    if(mCache.isFull())
+    {
+        mCache.flush();
+        mDynarec.reset();
+    }
+
+    if(mCache.isHot(rPC))
+        translateTrace(rPC);
+    else if(mInterpreter.isHot(rPC) && translate(rPC))
+    {
+        while(mDynarec.getCodeBlock(&ptr))
+            mCache.insert(ptr);
+    }
+    else //code that has run a few times is interpreted
+    {
+        ran = mInterpreter.execute(rPC, opcount);
+        mOpcodeCount += opcount - *mCache.getBudget();
+    }
+
+    return ran;
+}
+
+/**
+ * Return the number of opcodes executed, counted
+ * the same way as the opcode budget
+ *
+ * RETURNS
+ * number of opcodes executed
+ */
+uint64_t Dispatcher::getOpcodeCount() const
+{
+    return mOpcodeCount;
+}
+
+/**
+ * Check that the code arena could be allocated and that
+ * the generated code can address the emulated machine
+ *
+ * RETURNS
+ * true if the dispatcher is usable, otherwise false
+ */
+bool Dispatcher::isValid()
+{
+    return mCache.getArena()->isValid() && mDynarec.isValid();
+}
+
+/**
+ * Return the code cache
+ *
+ * RETURNS
+ * the code cache
+ */
+TranslationCache& Dispatcher::getCache()
+{
+    return mCache;
+}
+
+/**
+ * Return the translator
+ *
+ * RETURNS
+ * the translator
+ */
+Translator& Dispatcher::getTranslator()
+{
+    return mDynarec;
+}
+
+/**
+ * Constructor
+ *
+ * PARAMS
+ * pC8_pc               PC
+ * c8_regArray          registers
+ * pC8_seedRng          random seed
+ * pC8_addressReg       addressregister
+ * pC8_delaytimer       delaytimer
+ * pC8_soundtimer       soundtimer
+ * pC8_clock            clock the timers count down against
+ * pC8_newframe         new-frame-indicator
+ * c8_keyArray          keypresses
+ * c8_memArray          memory
+ * c8_screendata        screen
+ * pC8_stackPointer     stackpointer
+ */
+Dispatcher::Dispatcher(uint32_t *const pC8_pc,
+                       uint8_t c8_regArray[C8_GPREG_COUNT],
+                       uint32_t *const pC8_seedRng,
+                       uint32_t *const pC8_addressReg,
+                       uint32_t *const pC8_delaytimer,
+                       uint32_t *const pC8_soundtimer,
+                       uint32_t *const pC8_clock,
+                       uint32_t *const pC8_newframe,
+                       uint8_t c8_keyArray[C8_KEY_COUNT],
+                       uint8_t c8_memArray[C8_MEMSIZE],
+                       uint64_t c8_screendata[C8_RES_HEIGHT],
+                       uint32_t **const pC8_stackPointer
+                      ) : mDynarec(c8_regArray, pC8_seedRng, pC8_addressReg,
+                                   pC8_delaytimer, pC8_soundtimer, pC8_clock, pC8_newframe,
+                                   c8_keyArray, c8_memArray, c8_screendata,
+                                   pC8_stackPointer, &mCache),
+                          mInterpreter(c8_regArray, pC8_seedRng, pC8_addressReg,
+                                       pC8_delaytimer, pC8_soundtimer, pC8_clock, pC8_newframe,
+                                       c8_keyArray, c8_memArray, c8_screendata,
+                                       pC8_stackPointer, &mCache)
+{
+    pmC8_pc = pC8_pc;
+    pmC8_memory = c8_memArray;
+    mOpcodeCount = 0;
+}
+
+#ifdef X86_LONG_MODE
+/**
+ * Allocate a dispatcher in the low 2GB, where the generated
+ * code can address the translation cache
+ *
+ * PARAMS
+ * size     size of the dispatcher
+ *
+ * RETURNS
+ * the memory, NULL if it could not be allocated
+ */
+void* Dispatcher::operator new(const size_t size) throw()
+{
+    void *const p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_32BIT, -1, 0);
+
+    return p == MAP_FAILED ? NULL : p;
+}
+
+/**
+ * Free a dispatcher
+ *
+ * PARAMS
+ * p        the memory
+ * size     size of the dispatcher
+ */
+void Dispatcher::operator delete(void *const p, const size_t size)
+{
+    if(p != NULL)
+        munmap(p, size);
+}
+#endif
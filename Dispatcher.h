@@ -0,0 +1,188 @@
+/************************************************************
+  **** Dispatcher.h (header)
+   ***
+    ** Author:
+     *   Tommy Hellstrom
+     *
+     * Description:
+     *   Decides how the code at the PC is run: by the
+     *   translated code, the interpreter or after it has
+     *   been translated
+     *
+     * Revision history:
+     *   When         Who       What
+     *   20261016     me        created
+     *
+     * License information:
+     *   GPLv3
+     *
+     ********************************************************/
+
+#pragma once
+#ifndef _DISPATCHER_H_
+#define _DISPATCHER_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "Chip8def.h"
+#include "Translator.h"
+#include "TranslationCache.h"
+#include "Interpreter.h"
+
+class Dispatcher
+{
+    private:
+
+        //the translator and interpreter use the cache, it is created first
+        TranslationCache  mCache;
+        Translator        mDynarec;
+        Interpreter       mInterpreter;
+        uint32_t         *pmC8_pc;
+        uint8_t          *pmC8_memory;
+        uint64_t          mOpcodeCount;
+
+    public:
+
+        /**
+         * Translates all code that can be found in the rom ahead of time.
+         * Starting at C8_PC_START, the static exits of each translated block
+         * (jumps, calls, return addresses of calls and both paths of skip
+         * instructions) lead to more code. Targets of BNNN and 00EE are only
+         * known at runtime and are left to be translated by the dispatcher.
+         *
+         * RETURNS
+         * number of blocks translated
+         */
+        int translateAhead();
+
+        /**
+         * Forms a superblock from a hot block and the hot path through
+         * its successors, and replaces the hot block with it
+         *
+         * PARAMS
+         * address  address of the hot block
+         *
+         * RETURNS
+         * true if the block was replaced, otherwise false
+         */
+        bool translateTrace(const uint32_t address);
+
+        /**
+         * Translates the code at an address. Code that runs past the
+         * end of memory is not translated, the interpreter runs it
+         * until the PC stops there. When the code does not fit in the
+         * arena, the cache is flushed and the code translated again.
+         *
+         * PARAMS
+         * address  address of the code
+         *
+         * RETURNS
+         * true if the code was translated, otherwise false
+         */
+        bool translate(const uint32_t address);
+
+        /**
+         * Executes at least opcount opcodes, or translates the
+         * code at the PC when it is not translated yet
+         *
+         * PARAMS
+         * opcount  number of opcodes to execute
+         *
+         * RETURNS
+         * true if the opcodes were executed, false if the code was translated
+         * or execution was handed over before all opcodes were executed
+         */
+        bool dispatch(const int opcount);
+
+        /**
+         * Return the number of opcodes executed, counted
+         * the same way as the opcode budget
+         *
+         * RETURNS
+         * number of opcodes executed
+         */
+        uint64_t getOpcodeCount() const;
+
+        /**
+         * Check that the code arena could be allocated and that
+         * the generated code can address the emulated machine
+         *
+         * RETURNS
+         * true if the dispatcher is usable, otherwise false
+         */
+        bool isValid();
+
+        /**
+         * Return the code cache
+         *
+         * RETURNS
+         * the code cache
+         */
+        TranslationCache& getCache();
+
+        /**
+         * Return the translator
+         *
+         * RETURNS
+         * the translator
+         */
+        Translator& getTranslator();
+
+        /**
+         * Constructor
+         *
+         * PARAMS
+         * pC8_pc               PC
+         * c8_regArray          registers
+         * pC8_seedRng          random seed
+         * pC8_addressReg       addressregister
+         * pC8_delaytimer       delaytimer
+         * pC8_soundtimer       soundtimer
+         * pC8_clock            clock the timers count down against
+         * pC8_newframe         new-frame-indicator
+         * c8_keyArray          keypresses
+         * c8_memArray          memory
+         * c8_screendata        screen
+         * pC8_stackPointer     stackpointer
+         */
+                Dispatcher(uint32_t *const pC8_pc,
+                           uint8_t c8_regArray[C8_GPREG_COUNT],
+                           uint32_t *const pC8_seedRng,
+                           uint32_t *const pC8_addressReg,
+                           uint32_t *const pC8_delaytimer,
+                           uint32_t *const pC8_soundtimer,
+                           uint32_t *const pC8_clock,
+                           uint32_t *const pC8_newframe,
+                           uint8_t c8_keyArray[C8_KEY_COUNT],
+                           uint8_t c8_memArray[C8_MEMSIZE],
+                           uint64_t c8_screendata[C8_RES_HEIGHT],
+                           uint32_t **const pC8_stackPointer);
+
+#ifdef X86_LONG_MODE
+        /**
+         * Allocate a dispatcher in the low 2GB, where the generated
+         * code can address the translation cache
+         *
+         * PARAMS
+         * size     size of the dispatcher
+         *
+         * RETURNS
+         * the memory, NULL if it could not be allocated
+         */
+        static void* operator new(size_t size) throw();
+
+        /**
+         * Free a dispatcher
+         *
+         * PARAMS
+         * p        the memory
+         * size     size of the dispatcher
+         */
+        static void operator delete(void *p, size_t size);
+#endif
+        //      Dispatcher(const Dispatcher&);
+        //      Dispatcher& Dispatcher=(const Dispatcher&);
+};
+
+#endif
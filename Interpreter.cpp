@@ -0,0 +1,474 @@
+/************************************************************
+  **** Interpreter.cpp (implementation of .h)
+   ***
+    ** Author:
+     *   Tommy Hellstrom
+     *
+     * Description:
+     *   Threaded interpreter for Chip-8 code that has not
+     *   run often enough to be worth translating
+     *
+     * Revision history:
+     *   When         Who       What
+     *   20261016     me        created
+     *
+     * License information:
+     *   GPLv3
+     *
+     ********************************************************/
+
+#include <cstring>
+
+#include "Interpreter.h"
+#include "Translator.h"
+#include "Screen.h"
+
+//continues at the next opcode, every handler dispatches
+//on its own (threaded code, uses computed goto)
+#define IN_NEXT(address) \
+    { \
+        pc = (address); \
+        if(budget <= 0 || pc >= C8_MEMSIZE - 1) \
+            goto done; \
+        budget--; \
+        pOp = &mOps[pc]; \
+        if(pOp->opcode != (uint32_t) ((pMem[pc] << 8) | pMem[pc + 1])) \
+            decode(pc); \
+        goto *table[pOp->handler]; \
+    }
+
+//continues at a block start, code that is translated
+//or hot is left to the dispatcher
+#define IN_BRANCH(address) \
+    { \
+        pc = (address); \
+        if(pc >= C8_MEMSIZE - 1 || pmCache->exists(pc) || ++mCount[pc] >= IN_HOT_COUNT) \
+            goto leave; \
+        IN_NEXT(pc); \
+    }
+
+/**
+ * Interprets code until the opcodes are executed, or execution
+ * arrives at a block start that is translated or hot. Block
+ * starts are the targets of jumps, calls, returns and skips.
+ * The opcodes left are stored in the budget of the cache, like
+ * translated code does.
+ *
+ * PARAMS
+ * rPC      reference to emulated PC
+ * opcount  number of opcodes to execute
+ *
+ * RETURNS
+ * true if opcount opcodes were executed or the code waits
+ * for a key, false if execution continues in translated code
+ */
+bool Interpreter::execute(uint32_t &rPC, const int opcount)
+{
+    //same order as Handler
+    static const void *const table[] =
+    {
+        &&op00E0, &&op00EE, &&op1NNN, &&op2NNN, &&op3XNN, &&op4XNN, &&op5XY0,
+        &&op6XNN, &&op7XNN, &&op8XY0, &&op8XY1, &&op8XY2, &&op8XY3, &&op8XY4,
+        &&op8XY5, &&op8XY6, &&op8XY7, &&op8XYE, &&op9XY0, &&opANNN, &&opBNNN,
+        &&opCXNN, &&opDXYN, &&opEX9E, &&opEXA1, &&opFX07, &&opFX0A, &&opFX15,
+        &&opFX18, &&opFX1E, &&opFX29, &&opFX33, &&opFX55, &&opFX65, &&opUnknown
+    };
+
+    uint8_t *const v = pmC8_regs;
+    uint8_t *const pMem = pmC8_memory;
+    const DecodedOpcode *pOp;
+    uint32_t pc;
+    int budget = opcount;
+
+    //the dispatcher only starts the interpreter at a block start
+    IN_BRANCH(rPC);
+
+op00E0:
+    screenClear(pmC8_screen);
+    *pmC8_newFrame = NEW_FRAME;
+    IN_NEXT(pc + C8_OPCODE_SIZE);
+
+op00EE:
+    (*ppmC8_stackPointer)--;
+    IN_BRANCH(**ppmC8_stackPointer);
+
+op1NNN:
+    IN_BRANCH(pOp->nnn);
+
+op2NNN:
+    {
+        uint32_t *const pStack = *ppmC8_stackPointer;
+
+        //no predicted return code, translated code returns through the dispatcher
+        pStack[0] = pc + C8_OPCODE_SIZE;
+        pStack[PREDICTION_OFFSET / sizeof(uint32_t)] = 0;
+        *ppmC8_stackPointer = pStack + 1;
+    }
+    IN_BRANCH(pOp->nnn);
+
+op3XNN:
+    IN_BRANCH(pc + (v[pOp->x] == pOp->nn ? 2 : 1) * C8_OPCODE_SIZE);
+
+op4XNN:
+    IN_BRANCH(pc + (v[pOp->x] != pOp->nn ? 2 : 1) * C8_OPCODE_SIZE);
+
+op5XY0:
+    IN_BRANCH(pc + (v[pOp->x] == v[pOp->y] ? 2 : 1) * C8_OPCODE_SIZE);
+
+op6XNN:
+    v[pOp->x] = pOp->nn;
+    IN_NEXT(pc + C8_OPCODE_SIZE);
+
+op7XNN:
+    v[pOp->x] += pOp->nn;
+    IN_NEXT(pc + C8_OPCODE_SIZE);
+
+op8XY0:
+    v[pOp->x] = v[pOp->y];
+    IN_NEXT(pc + C8_OPCODE_SIZE);
+
+op8XY1:
+    v[pOp->x] |= v[pOp->y];
+    IN_NEXT(pc + C8_OPCODE_SIZE);
+
+op8XY2:
+    v[pOp->x] &= v[pOp->y];
+    IN_NEXT(pc + C8_OPCODE_SIZE);
+
+op8XY3:
+    v[pOp->x] ^= v[pOp->y];
+    IN_NEXT(pc + C8_OPCODE_SIZE);
+
+op8XY4:
+    {
+        const uint32_t sum = v[pOp->x] + v[pOp->y];
+
+        v[pOp->x] = sum & 0xFF;
+        v[C8_FLAG_REG] = sum >> 8;
+    }
+    IN_NEXT(pc + C8_OPCODE_SIZE);
+
+op8XY5:
+    {
+        const uint8_t noBorrow = v[pOp->x] >= v[pOp->y];
+
+        v[pOp->x] -= v[pOp->y];
+        v[C8_FLAG_REG] = noBorrow;
+    }
+    IN_NEXT(pc + C8_OPCODE_SIZE);
+
+op8XY6:
+    {
+        const uint8_t lost = v[pOp->x] & 0x01;
+
+        v[pOp->x] >>= 1;
+        v[C8_FLAG_REG] = lost;
+    }
+    IN_NEXT(pc + C8_OPCODE_SIZE);
+
+op8XY7:
+    {
+        const uint8_t noBorrow = v[pOp->y] >= v[pOp->x];
+
+        v[pOp->x] = v[pOp->y] - v[pOp->x];
+        v[C8_FLAG_REG] = noBorrow;
+    }
+    IN_NEXT(pc + C8_OPCODE_SIZE);
+
+op8XYE:
+    {
+        const uint8_t lost = v[pOp->x] >> 7;
+
+        v[pOp->x] <<= 1;
+        v[C8_FLAG_REG] = lost;
+    }
+    IN_NEXT(pc + C8_OPCODE_SIZE);
+
+op9XY0:
+    IN_BRANCH(pc + (v[pOp->x] != v[pOp->y] ? 2 : 1) * C8_OPCODE_SIZE);
+
+opANNN:
+    *pmC8_addressReg = pOp->nnn;
+    IN_NEXT(pc + C8_OPCODE_SIZE);
+
+opBNNN:
+    IN_BRANCH(pOp->nnn + v[0]);
+
+opCXNN:
+    *pmC8_seedRng = *pmC8_seedRng * LCG_MULTIPLIER + LCG_INCREMENT;
+    v[pOp->x] = (*pmC8_seedRng >> 24) & pOp->nn;
+    IN_NEXT(pc + C8_OPCODE_SIZE);
+
+opDXYN:
+    {
+        //a sprite with height 0 is drawn as one row, like translated code
+        const int rows = pOp->n != 0 ? pOp->n : 1;
+        uint8_t flag = 0;
+
+        const int x = v[pOp->x] & (C8_RES_WIDTH - 1);
+
+        for(int row = 0; row < rows; row++)
+        {
+            //rows past the end of memory are empty, like in translated code
+            const uint32_t address = *pmC8_addressReg + row;
+            //the sprite row is rotated to x, pixels past the right edge wrap around
+            const uint64_t sprite = address < C8_MEMSIZE ? (uint64_t) pMem[address] << (C8_RES_WIDTH - 8) : 0;
+            const uint64_t pixels = x == 0 ? sprite : (sprite >> x) | (sprite << (C8_RES_WIDTH - x));
+            uint64_t *const pLine = pmC8_screen + ((v[pOp->y] + row) & (C8_RES_HEIGHT - 1));
+
+            if(*pLine & pixels)
+                flag = 1;
+
+            *pLine ^= pixels;
+        }
+
+        v[C8_FLAG_REG] = flag;
+        *pmC8_newFrame = NEW_FRAME;
+    }
+    IN_NEXT(pc + C8_OPCODE_SIZE);
+
+opEX9E:
+    IN_BRANCH(pc + (pmC8_keys[v[pOp->x] & (C8_KEY_COUNT - 1)] != 0 ? 2 : 1) * C8_OPCODE_SIZE);
+
+opEXA1:
+    IN_BRANCH(pc + (pmC8_keys[v[pOp->x] & (C8_KEY_COUNT - 1)] == 0 ? 2 : 1) * C8_OPCODE_SIZE);
+
+opFX07:
+    {
+        //ticks left until the deadline, zero once it has passed
+        const int32_t left = (int32_t) (*pmC8_delaytimer - *pmC8_clock);
+
+        v[pOp->x] = left > 0 ? left : 0;
+    }
+    IN_NEXT(pc + C8_OPCODE_SIZE);
+
+opFX0A:
+    {
+        int key = 0;
+
+        while(key < C8_KEY_COUNT && pmC8_keys[key] == 0)
+            key++;
+
+        //waits for a key in the dispatcher
+        if(key == C8_KEY_COUNT)
+            goto done;
+
+        v[pOp->x] = key;
+    }
+    IN_BRANCH(pc + C8_OPCODE_SIZE);
+
+opFX15:
+    *pmC8_delaytimer = *pmC8_clock + v[pOp->x];
+    IN_NEXT(pc + C8_OPCODE_SIZE);
+
+opFX18:
+    *pmC8_soundtimer = *pmC8_clock + v[pOp->x];
+    IN_NEXT(pc + C8_OPCODE_SIZE);
+
+opFX1E:
+    *pmC8_addressReg += v[pOp->x];
+    IN_NEXT(pc + C8_OPCODE_SIZE);
+
+opFX29:
+    *pmC8_addressReg = v[pOp->x] * 5;
+    IN_NEXT(pc + C8_OPCODE_SIZE);
+
+opFX33:
+    //stores past the end of memory are dropped
+    if(*pmC8_addressReg < C8_MEMSIZE)
+        pMem[*pmC8_addressReg] = v[pOp->x] / 100;
+
+    if(*pmC8_addressReg + 1 < C8_MEMSIZE)
+        pMem[*pmC8_addressReg + 1] = (v[pOp->x] / 10) % 10;
+
+    if(*pmC8_addressReg + 2 < C8_MEMSIZE)
+        pMem[*pmC8_addressReg + 2] = v[pOp->x] % 10;
+
+    pmCache->invalidate(*pmC8_addressReg, 3);
+    IN_NEXT(pc + C8_OPCODE_SIZE);
+
+opFX55:
+    for(int i = 0; i <= pOp->x; i++)
+        if(*pmC8_addressReg + i < C8_MEMSIZE)
+            pMem[*pmC8_addressReg + i] = v[i];
+
+    pmCache->invalidate(*pmC8_addressReg, pOp->x + 1);
+    IN_NEXT(pc + C8_OPCODE_SIZE);
+
+opFX65:
+    //bytes past the end of memory are read as 0
+    for(int i = 0; i <= pOp->x; i++)
+        v[i] = *pmC8_addressReg + i < C8_MEMSIZE ? pMem[*pmC8_addressReg + i] : 0;
+
+    IN_NEXT(pc + C8_OPCODE_SIZE);
+
+opUnknown:
+    IN_NEXT(pc + C8_OPCODE_SIZE);
+
+done:
+    rPC = pc;
+    *pmCache->getBudget() = budget;
+    return true;
+
+leave:
+    rPC = pc;
+    *pmCache->getBudget() = budget;
+    return false;
+}
+
+/**
+ * Predecodes the opcode at an address
+ *
+ * PARAMS
+ * address  address of the opcode
+ */
+void Interpreter::decode(const uint32_t address)
+{
+    DecodedOpcode &rOp = mOps[address];
+    const uint32_t opcode = (pmC8_memory[address] << 8) | pmC8_memory[address + 1];
+
+    rOp.opcode = opcode;
+    rOp.x = (opcode & 0x0F00) >> 8;
+    rOp.y = (opcode & 0x00F0) >> 4;
+    rOp.n = opcode & 0x000F;
+    rOp.nn = opcode & 0x00FF;
+    rOp.nnn = opcode & 0x0FFF;
+    rOp.handler = IN_UNKNOWN;
+
+    //decoded the same way as the translator does
+    switch(opcode & 0xF000)
+    {
+        case 0x0000:
+            switch(opcode & 0xF)
+            {
+                case 0x0: rOp.handler = IN_00E0; break;
+                case 0xE: rOp.handler = IN_00EE; break;
+            }
+            break;
+        case 0x1000: rOp.handler = IN_1NNN; break;
+        case 0x2000: rOp.handler = IN_2NNN; break;
+        case 0x3000: rOp.handler = IN_3XNN; break;
+        case 0x4000: rOp.handler = IN_4XNN; break;
+        case 0x5000: rOp.handler = IN_5XY0; break;
+        case 0x6000: rOp.handler = IN_6XNN; break;
+        case 0x7000: rOp.handler = IN_7XNN; break;
+        case 0x8000:
+            switch(opcode & 0xF)
+            {
+                case 0x0: rOp.handler = IN_8XY0; break;
+                case 0x1: rOp.handler = IN_8XY1; break;
+                case 0x2: rOp.handler = IN_8XY2; break;
+                case 0x3: rOp.handler = IN_8XY3; break;
+                case 0x4: rOp.handler = IN_8XY4; break;
+                case 0x5: rOp.handler = IN_8XY5; break;
+                case 0x6: rOp.handler = IN_8XY6; break;
+                case 0x7: rOp.handler = IN_8XY7; break;
+                case 0xE: rOp.handler = IN_8XYE; break;
+            }
+            break;
+        case 0x9000: rOp.handler = IN_9XY0; break;
+        case 0xA000: rOp.handler = IN_ANNN; break;
+        case 0xB000: rOp.handler = IN_BNNN; break;
+        case 0xC000: rOp.handler = IN_CXNN; break;
+        case 0xD000: rOp.handler = IN_DXYN; break;
+        case 0xE000:
+            switch(opcode & 0xF)
+            {
+                case 0x1: rOp.handler = IN_EXA1; break;
+                case 0xE: rOp.handler = IN_EX9E; break;
+            }
+            break;
+        case 0xF000:
+            switch(opcode & 0xFF)
+            {
+                case 0x07: rOp.handler = IN_FX07; break;
+                case 0x0A: rOp.handler = IN_FX0A; break;
+                case 0x15: rOp.handler = IN_FX15; break;
+                case 0x18: rOp.handler = IN_FX18; break;
+                case 0x1E: rOp.handler = IN_FX1E; break;
+                case 0x29: rOp.handler = IN_FX29; break;
+                case 0x33: rOp.handler = IN_FX33; break;
+                case 0x55: rOp.handler = IN_FX55; break;
+                case 0x65: rOp.handler = IN_FX65; break;
+            }
+            break;
+    }
+}
+
+/**
+ * Check if code at an address has been interpreted often
+ * enough to be translated
+ *
+ * PARAMS
+ * address  address to check
+ *
+ * RETURNS
+ * true if the code should be translated, otherwise false
+ */
+bool Interpreter::isHot(const uint32_t address) const
+{
+    return address < C8_MEMSIZE - 1 && mCount[address] >= IN_HOT_COUNT;
+}
+
+/**
+ * Start counting the executions of code at an address over,
+ * for code that is hot but can not be translated
+ *
+ * PARAMS
+ * address  address of the code
+ */
+void Interpreter::cool(const uint32_t address)
+{
+    mCount[address] = 0;
+}
+
+/**
+ * Constructor
+ *
+ * PARAMS
+ * c8_regArray          registers
+ * pC8_seedRng          random seed
+ * pC8_addressReg       addressregister
+ * pC8_delaytimer       delaytimer
+ * pC8_soundtimer       soundtimer
+ * pC8_clock            clock the timers count down against
+ * pC8_newframe         new-frame-indicator
+ * c8_keyArray          keypresses
+ * c8_memArray          memory
+ * c8_screendata        screen
+ * pC8_stackPointer     stackpointer
+ * pCache               cache with the translated blocks
+ */
+Interpreter::Interpreter(uint8_t c8_regArray[C8_GPREG_COUNT],
+                         uint32_t *const pC8_seedRng,
+                         uint32_t *const pC8_addressReg,
+                         uint32_t *const pC8_delaytimer,
+                         uint32_t *const pC8_soundtimer,
+                         uint32_t *const pC8_clock,
+                         uint32_t *const pC8_newframe,
+                         uint8_t c8_keyArray[C8_KEY_COUNT],
+                         uint8_t c8_memArray[C8_MEMSIZE],
+                         uint64_t c8_screendata[C8_RES_HEIGHT],
+                         uint32_t **const pC8_stackPointer,
+                         TranslationCache *const pCache)
+{
+    pmC8_regs = c8_regArray;
+    pmC8_seedRng = pC8_seedRng;
+    pmC8_addressReg = pC8_addressReg;
+    pmC8_delaytimer = pC8_delaytimer;
+    pmC8_soundtimer = pC8_soundtimer;
+    pmC8_clock = pC8_clock;
+    pmC8_newFrame = pC8_newframe;
+    pmC8_keys = c8_keyArray;
+    pmC8_memory = c8_memArray;
+    pmC8_screen = c8_screendata;
+    ppmC8_stackPointer = pC8_stackPointer;
+    pmCache = pCache;
+
+    //no opcode is 32 bit, so nothing is decoded
+    for(int i = 0; i < C8_MEMSIZE; i++)
+    {
+        mOps[i].opcode = 0xFFFFFFFF;
+        mCount[i] = 0;
+    }
+}
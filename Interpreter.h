@@ -0,0 +1,162 @@
+/************************************************************
+  **** Interpreter.h (header)
+   ***
+    ** Author:
+     *   Tommy Hellstrom
+     *
+     * Description:
+     *   Threaded interpreter for Chip-8 code that has not
+     *   run often enough to be worth translating
+     *
+     * Revision history:
+     *   When         Who       What
+     *   20261016     me        created
+     *
+     * License information:
+     *   GPLv3
+     *
+     ********************************************************/
+
+#pragma once
+#ifndef _INTERPRETER_H_
+#define _INTERPRETER_H_
+
+#include <stdint.h>
+
+#include "Chip8def.h"
+#include "TranslationCache.h"
+
+//times a block start is interpreted before it is translated
+#define IN_HOT_COUNT 16
+
+class Interpreter
+{
+    private:
+
+        /**
+         * Handlers of the dispatch table
+         */
+        enum Handler
+        {
+            IN_00E0, IN_00EE, IN_1NNN, IN_2NNN, IN_3XNN, IN_4XNN, IN_5XY0,
+            IN_6XNN, IN_7XNN, IN_8XY0, IN_8XY1, IN_8XY2, IN_8XY3, IN_8XY4,
+            IN_8XY5, IN_8XY6, IN_8XY7, IN_8XYE, IN_9XY0, IN_ANNN, IN_BNNN,
+            IN_CXNN, IN_DXYN, IN_EX9E, IN_EXA1, IN_FX07, IN_FX0A, IN_FX15,
+            IN_FX18, IN_FX1E, IN_FX29, IN_FX33, IN_FX55, IN_FX65, IN_UNKNOWN
+        };
+
+        /**
+         * A predecoded opcode. The opcode is kept to detect
+         * when the memory it was decoded from changes.
+         */
+        struct DecodedOpcode
+        {
+            uint32_t opcode;
+            int      handler;
+            int      x;
+            int      y;
+            int      n;
+            int      nn;
+            uint32_t nnn;
+        };
+
+        DecodedOpcode     mOps[C8_MEMSIZE];
+
+        //number of times execution arrived at a block start
+        uint32_t          mCount[C8_MEMSIZE];
+
+        uint8_t          *pmC8_regs;
+        uint32_t         *pmC8_seedRng;
+        uint32_t         *pmC8_addressReg;
+        uint32_t         *pmC8_delaytimer;
+        uint32_t         *pmC8_soundtimer;
+        uint32_t         *pmC8_clock;
+        uint32_t         *pmC8_newFrame;
+        uint8_t          *pmC8_keys;
+        uint8_t          *pmC8_memory;
+        uint64_t         *pmC8_screen;
+        uint32_t        **ppmC8_stackPointer;
+        TranslationCache *pmCache;
+
+        /**
+         * Predecodes the opcode at an address
+         *
+         * PARAMS
+         * address  address of the opcode
+         */
+        void decode(const uint32_t address);
+
+    public:
+
+        /**
+         * Interprets code until the opcodes are executed, or execution
+         * arrives at a block start that is translated or hot. Block
+         * starts are the targets of jumps, calls, returns and skips.
+         * The opcodes left are stored in the budget of the cache, like
+         * translated code does.
+         *
+         * PARAMS
+         * rPC      reference to emulated PC
+         * opcount  number of opcodes to execute
+         *
+         * RETURNS
+         * true if opcount opcodes were executed or the code waits
+         * for a key, false if execution continues in translated code
+         */
+        bool execute(uint32_t &rPC, const int opcount);
+
+        /**
+         * Check if code at an address has been interpreted often
+         * enough to be translated
+         *
+         * PARAMS
+         * address  address to check
+         *
+         * RETURNS
+         * true if the code should be translated, otherwise false
+         */
+        bool isHot(const uint32_t address) const;
+
+        /**
+         * Start counting the executions of code at an address over,
+         * for code that is hot but can not be translated
+         *
+         * PARAMS
+         * address  address of the code
+         */
+        void cool(const uint32_t address);
+
+        /**
+         * Constructor
+         *
+         * PARAMS
+         * c8_regArray          registers
+         * pC8_seedRng          random seed
+         * pC8_addressReg       addressregister
+         * pC8_delaytimer       delaytimer
+         * pC8_soundtimer       soundtimer
+         * pC8_clock            clock the timers count down against
+         * pC8_newframe         new-frame-indicator
+         * c8_keyArray          keypresses
+         * c8_memArray          memory
+         * c8_screendata        screen
+         * pC8_stackPointer     stackpointer
+         * pCache               cache with the translated blocks
+         */
+                Interpreter(uint8_t c8_regArray[C8_GPREG_COUNT],
+                            uint32_t *const pC8_seedRng,
+                            uint32_t *const pC8_addressReg,
+                            uint32_t *const pC8_delaytimer,
+                            uint32_t *const pC8_soundtimer,
+                            uint32_t *const pC8_clock,
+                            uint32_t *const pC8_newframe,
+                            uint8_t c8_keyArray[C8_KEY_COUNT],
+                            uint8_t c8_memArray[C8_MEMSIZE],
+                            uint64_t c8_screendata[C8_RES_HEIGHT],
+                            uint32_t **const pC8_stackPointer,
+                            TranslationCache *const pCache);
+        //      Interpreter(const Interpreter&);
+        //      Interpreter& Interpreter=(const Interpreter&);
+};
+
+#endif
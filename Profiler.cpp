@@ -0,0 +1,167 @@
+/************************************************************
+  **** Profiler.cpp (implementation of .h)
+   ***
+    ** Author:
+     *   Tommy Hellstrom
+     *
+     * Description:
+     *   Counts the executions and cycles of translated
+     *   blocks, built only when C8_PROFILE is defined
+     *
+     * Revision history:
+     *   When         Who       What
+     *   20261016     me        created
+     *
+     * License information:
+     *   GPLv3
+     *
+     ********************************************************/
+
+#ifdef C8_PROFILE
+
+#include <cstring>
+#include <list>
+
+#include "Profiler.h"
+
+/**
+ * Time of the blocks at an address, in cycles or opcodes
+ *
+ * PARAMS
+ * rEntry   counters of the address
+ *
+ * RETURNS
+ * the time
+ */
+static uint64_t getTime(const Profiler::Entry &rEntry)
+{
+#ifdef C8_PROFILE_CYCLES
+    return rEntry.cycles;
+#else
+    return rEntry.executions * rEntry.opcount;
+#endif
+}
+
+/**
+ * Orders addresses by the time of their blocks, longest first
+ */
+struct ByTime
+{
+    const Profiler::Entry *pEntries;
+
+    bool operator()(const uint32_t a, const uint32_t b) const
+    {
+        return getTime(pEntries[a]) > getTime(pEntries[b]);
+    }
+};
+
+/**
+ * Remember the size of a block that is put in the cache
+ *
+ * PARAMS
+ * pBlock   the block
+ */
+void Profiler::record(const CodeBlock *const pBlock)
+{
+    mEntries[pBlock->address].opcount = pBlock->opcount;
+    mEntries[pBlock->address].size = pBlock->size;
+}
+
+/**
+ * Counts the time since the last block entry for that block,
+ * called when translated code returns to the dispatcher
+ */
+void Profiler::leave()
+{
+#ifdef C8_PROFILE_CYCLES
+    const uint64_t now = __builtin_ia32_rdtsc();
+
+    *mClock.pCurrent += now - mClock.last;
+    mClock.last = now;
+    mClock.pCurrent = &mEntries[C8_MEMSIZE].cycles;
+#endif
+}
+
+/**
+ * Writes the blocks that ran longest, sorted by time. Without
+ * C8_PROFILE_CYCLES the time is the number of opcodes executed.
+ *
+ * PARAMS
+ * pOut     file to write to
+ */
+void Profiler::report(FILE *const pOut) const
+{
+    std::list<uint32_t> addresses;
+    ByTime byTime;
+    double total = 0;
+    int listed = 0;
+
+    for(uint32_t address = 0; address <= C8_MEMSIZE; address++)
+    {
+        total += getTime(mEntries[address]);
+
+        if(address < C8_MEMSIZE && mEntries[address].executions > 0)
+            addresses.push_back(address);
+    }
+
+    byTime.pEntries = mEntries;
+    addresses.sort(byTime);
+
+#ifdef C8_PROFILE_CYCLES
+    fprintf(pOut, "# time in cycles, %.0f in total\n", total);
+    fprintf(pOut, "# %.2f%% outside translated code\n", total > 0 ? 100 * mEntries[C8_MEMSIZE].cycles / total : 0);
+#else
+    fprintf(pOut, "# time in opcodes, %.0f in total\n", total);
+#endif
+    fprintf(pOut, "# address opcount size executions time percent\n");
+
+    std::list<uint32_t>::const_iterator it;
+
+    for(it = addresses.begin(); it != addresses.end() && listed < PROFILE_REPORT_LENGTH; ++it, listed++)
+    {
+        const Entry &rEntry = mEntries[*it];
+        const double time = getTime(rEntry);
+
+        fprintf(pOut, "%03x %u %u %.0f %.0f %.2f\n", *it, rEntry.opcount, rEntry.size,
+                (double) rEntry.executions, time, total > 0 ? 100 * time / total : 0);
+    }
+}
+
+/**
+ * Return the counters, indexed by address
+ *
+ * RETURNS
+ * the counters
+ */
+Profiler::Entry* Profiler::getEntries()
+{
+    return mEntries;
+}
+
+/**
+ * Return the clock
+ *
+ * RETURNS
+ * the clock
+ */
+Profiler::Clock* Profiler::getClock()
+{
+    return &mClock;
+}
+
+/**
+ * Constructor
+ */
+Profiler::Profiler()
+{
+    memset(mEntries, 0, sizeof(mEntries));
+
+    mClock.pCurrent = &mEntries[C8_MEMSIZE].cycles;
+#ifdef C8_PROFILE_CYCLES
+    mClock.last = __builtin_ia32_rdtsc();
+#else
+    mClock.last = 0;
+#endif
+}
+
+#endif
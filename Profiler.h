@@ -0,0 +1,118 @@
+/************************************************************
+  **** Profiler.h (header)
+   ***
+    ** Author:
+     *   Tommy Hellstrom
+     *
+     * Description:
+     *   Counts the executions and cycles of translated
+     *   blocks, built only when C8_PROFILE is defined
+     *
+     * Revision history:
+     *   When         Who       What
+     *   20261016     me        created
+     *
+     * License information:
+     *   GPLv3
+     *
+     ********************************************************/
+
+#pragma once
+#ifndef _PROFILER_H_
+#define _PROFILER_H_
+
+#ifdef C8_PROFILE
+
+#include <cstdio>
+#include <stdint.h>
+
+#include "Chip8def.h"
+#include "CodeBlock.h"
+
+//max number of blocks listed in the report
+#define PROFILE_REPORT_LENGTH 50
+
+class Profiler
+{
+    public:
+
+        /**
+         * Counters of the blocks translated at an address
+         */
+        struct Entry
+        {
+            uint64_t executions;
+            uint64_t cycles;
+            uint32_t opcount;
+            uint32_t size;
+        };
+
+        /**
+         * Time stamp of the last block entry and the cycle
+         * counter of that block. Time between two entries
+         * is counted for the first block.
+         */
+        struct Clock
+        {
+            uint64_t  last;
+            uint64_t *pCurrent;
+        };
+
+    private:
+
+        //the last entry counts the time outside translated code
+        Entry mEntries[C8_MEMSIZE + 1];
+        Clock mClock;
+
+    public:
+
+        /**
+         * Remember the size of a block that is put in the cache
+         *
+         * PARAMS
+         * pBlock   the block
+         */
+        void record(const CodeBlock *const pBlock);
+
+        /**
+         * Counts the time since the last block entry for that block,
+         * called when translated code returns to the dispatcher
+         */
+        void leave();
+
+        /**
+         * Writes the blocks that ran longest, sorted by time. Without
+         * C8_PROFILE_CYCLES the time is the number of opcodes executed.
+         *
+         * PARAMS
+         * pOut     file to write to
+         */
+        void report(FILE *const pOut) const;
+
+        /**
+         * Return the counters, indexed by address
+         *
+         * RETURNS
+         * the counters
+         */
+        Entry* getEntries();
+
+        /**
+         * Return the clock
+         *
+         * RETURNS
+         * the clock
+         */
+        Clock* getClock();
+
+        /**
+         * Constructor
+         */
+                Profiler();
+        //      Profiler(const Profiler&);
+        //      Profiler& Profiler=(const Profiler&);
+};
+
+#endif
+
+#endif
@@ -16,8 +16,17 @@
      *
      ********************************************************/
 
+#include <cassert>
+
 #include "RegTracker.h"
 
+//registers of a convention, AL and AH are left free for
+//temporary values and opcodes that need EAX
+static const int gConventionRegs[RT_CONVENTION_REGS] =
+{
+    X86_REG_CH, X86_REG_CL, X86_REG_DH, X86_REG_DL, X86_REG_BH, X86_REG_BL
+};
+
 /**
  * Reset the status (mark as free) of a IA 8 bit register
  *
@@ -47,8 +56,7 @@ void RegTracker::doSaveRegX8(const int x86reg)
         dirtyRegX32(r32);
 
         const uint32_t addr = mC8_regBaseAddr + mX86Reg8[x86reg].c8reg;
-        codegen->mov_r32i32(r32, addr);
-        codegen->mov_m8r8(r32,x86reg);
+        codegen->store_r8(r32, addr, x86reg);
         mX86Reg8[x86reg].modified = false;
     }
 }
@@ -93,8 +101,7 @@ void RegTracker::doSaveRegC16(const int x86reg)
 
         dirtyRegX32(r32);
 
-        codegen->mov_r32i32(r32, mC8_addressRegAddr);
-        codegen->mov_m32r32(r32, x86reg);
+        codegen->store_r32(r32, mC8_addressRegAddr, x86reg);
         mX86Reg32.modified = false;
     }
 }
@@ -126,8 +133,7 @@ void RegTracker::doAllocRegX8(const int x86reg, const int c8reg, const bool load
         dirtyRegX32(r32);
 
         const uint32_t addr = mC8_regBaseAddr + c8reg;
-        codegen->mov_r32i32(r32, addr);
-        codegen->mov_r8m8(x86reg, r32);
+        codegen->load_r8(x86reg, r32, addr);
     }
 }
 
@@ -196,8 +202,7 @@ void RegTracker::doAllocRegC16(const int x86reg, const bool loadvalue)
 
         dirtyRegX32(r32);
 
-        codegen->mov_r32i32(r32, mC8_addressRegAddr);
-        codegen->mov_r32m32(x86reg, r32);
+        codegen->load_r32(x86reg, r32, mC8_addressRegAddr);
     }
 }
 
@@ -216,6 +221,23 @@ void RegTracker::doDeallocRegC16(const int x86reg)
     mX86Reg32.modified = false;
 }
 
+/**
+ * Code generation:
+ * Load the registers of a convention that are not allocated
+ *
+ * PARAMS
+ * rConvention  registers to load
+ */
+void RegTracker::doLoadConvention(const RegConvention_t &rConvention)
+{
+    for(int i = 0; i < X86_COUNT_REGS_8BIT; i++)
+        if(rConvention.c8reg[i] >= 0 && mX86Reg8[i].free)
+            doAllocRegX8(i, rConvention.c8reg[i], true);
+
+    if(rConvention.addressReg)
+        doAllocRegC16(REG_C16, true);
+}
+
 /**
  * Constructor
  *
@@ -261,9 +283,9 @@ int RegTracker::allocRegX8(const int c8reg, const bool loadvalue)
 {
     bool free = false;
     bool allocated = false;
-    int ifree;
-    int ioldest;
-    int iallocated;
+    int ifree = -1;
+    int ioldest = -1;
+    int iallocated = -1;
     int oldest = -1;
 
     for(int a = 3; a >= 0; a--)
@@ -297,11 +319,14 @@ int RegTracker::allocRegX8(const int c8reg, const bool loadvalue)
     }
     else if(free)
     {
+        assert(ifree >= 0);
         doAllocRegX8(ifree, c8reg, loadvalue);
         return ifree;
     }
     else
     {
+        //every register is allocated, one of them is the oldest
+        assert(ioldest >= 0);
         doDeallocRegX8(ioldest);
         doAllocRegX8(ioldest, c8reg, loadvalue);
         return ioldest;
@@ -405,7 +430,13 @@ void RegTracker::deallocRegX8(const int x86reg)
     doDeallocRegX8(x86reg);
 }
 
-/*void RegTracker::deallocRegC8(const int c8reg)
+/**
+ * Deallocates the IA register holding a chip8 register (if allocated)
+ *
+ * PARAM
+ * c8reg    chip8 register to deallocate
+ */
+void RegTracker::deallocRegC8(const int c8reg)
 {
     for(int i = 0; i < X86_COUNT_REGS_8BIT; i++)
         if(mX86Reg8[i].c8reg == c8reg && !mX86Reg8[i].free)
@@ -413,7 +444,7 @@ void RegTracker::deallocRegX8(const int x86reg)
             doDeallocRegX8(i);
             break;
         }
-}*/
+}
 
 /**
  * Deallocates chip8 addressregister (if allocated)
@@ -428,29 +459,87 @@ void RegTracker::deallocRegC16()
  */
 void RegTracker::saveRegisters()
 {
-    /*for(int i = 0; i < X86_COUNT_REGS_8BIT; i++)
+    //the code generator reuses the pointer to the registers
+    for(int i = 0; i < X86_COUNT_REGS_8BIT; i++)
         doSaveRegX8(i);
 
-    doSaveRegC16(REG_C16);*/
+    doSaveRegC16(REG_C16);
+}
+
+/**
+ * Creates a convention, the chip8 registers are given the
+ * IA registers that are not used as temporary registers
+ *
+ * PARAMS
+ * c8regs       chip8 registers, at most RT_CONVENTION_REGS
+ * count        number of chip8 registers
+ * addressReg   the addressregister is kept in REG_C16 if true
+ * rConvention  the convention is stored here
+ */
+void RegTracker::createConvention(const int c8regs[], const int count, const bool addressReg,
+                                  RegConvention_t &rConvention) const
+{
+    for(int i = 0; i < X86_COUNT_REGS_8BIT; i++)
+        rConvention.c8reg[i] = -1;
+
+    for(int i = 0; i < count && i < RT_CONVENTION_REGS; i++)
+        rConvention.c8reg[gConventionRegs[i]] = c8regs[i];
 
-    const int r32 = temporaryRegX32();
-    bool initialized = false;
+    rConvention.addressReg = addressReg;
+}
 
+/**
+ * Code generation:
+ * Starts a block in a convention. All IA registers are pushed
+ * up front, so every block in a convention has the same stack,
+ * and the registers of the convention are loaded. Linked blocks
+ * enter after this code. The tracker must be reset before.
+ *
+ * PARAMS
+ * rConvention  registers to load
+ */
+void RegTracker::loadConvention(const RegConvention_t &rConvention)
+{
+    //REG_RET is never pushed, ESP and EBP are never used
+    for(int i = 0; i < X86_COUNT_REGS_32BIT; i++)
+        if(i != X86_REG_ESP && i != X86_REG_EBP)
+            dirtyRegX32(i);
+
+    doLoadConvention(rConvention);
+}
+
+/**
+ * Code generation:
+ * Moves the registers into a convention before a linked block
+ * is entered. Registers must be saved before, registers outside
+ * the convention are dropped and missing registers are loaded.
+ *
+ * PARAMS
+ * rConvention  registers of the block that is entered
+ */
+void RegTracker::matchConvention(const RegConvention_t &rConvention)
+{
     for(int i = 0; i < X86_COUNT_REGS_8BIT; i++)
-        if(mX86Reg8[i].modified && !mX86Reg8[i].free)
-        {
-            if(!initialized)
-            {
-                dirtyRegX32(r32);
-                codegen->mov_r32i32(r32, mC8_regBaseAddr);
-                initialized = true;
-            }
+    {
+        bool kept = false;
 
-            codegen->mov_m8r8_d8(r32, i, mX86Reg8[i].c8reg);
-            mX86Reg8[i].modified = false;
-        }
+        for(int j = 0; j < X86_COUNT_REGS_8BIT && !mX86Reg8[i].free; j++)
+            if(rConvention.c8reg[j] == mX86Reg8[i].c8reg)
+                kept = true;
 
-    doSaveRegC16(REG_C16);
+        if(!kept)
+            doDeallocRegX8(i);
+    }
+
+    //registers already in IA registers are moved or swapped into place
+    for(int i = 0; i < X86_COUNT_REGS_8BIT; i++)
+        if(rConvention.c8reg[i] >= 0 && isAllocatedRegC8(rConvention.c8reg[i]))
+            allocRegX8(i, rConvention.c8reg[i], true);
+
+    if(!rConvention.addressReg)
+        doDeallocRegC16(REG_C16);
+
+    doLoadConvention(rConvention);
 }
 
 /**
@@ -26,6 +26,20 @@
 #include "Chip8def.h"
 #include "CodeGenerator.h"
 
+//IA 8 bit registers that can hold chip8 registers between blocks
+#define RT_CONVENTION_REGS 6
+
+/**
+ * Chip8 registers that are kept in IA registers when a block
+ * is entered from a linked block. The IA registers hold the
+ * same values as memory.
+ */
+struct RegConvention_t
+{
+    int  c8reg[X86_COUNT_REGS_8BIT];    //-1 if no chip8 register
+    bool addressReg;
+};
+
 class RegTracker
 {
     private:
@@ -147,6 +161,15 @@ class RegTracker
          */
         void doDeallocRegC16(const int x86reg);
 
+        /**
+         * Code generation:
+         * Load the registers of a convention that are not allocated
+         *
+         * PARAMS
+         * rConvention  registers to load
+         */
+        void doLoadConvention(const RegConvention_t &rConvention);
+
     public:
 
         static const int REG_C16 = X86_REG_ESI;
@@ -238,11 +261,55 @@ class RegTracker
          */
         void deallocRegX8(const int x86reg);
 
+        /**
+         * Deallocates the IA register holding a chip8 register (if allocated)
+         *
+         * PARAM
+         * c8reg    chip8 register to deallocate
+         */
+        void deallocRegC8(const int c8reg);
+
         /**
          * Deallocates chip8 addressregister (if allocated)
          */
         void deallocRegC16();
 
+        /**
+         * Creates a convention, the chip8 registers are given the
+         * IA registers that are not used as temporary registers
+         *
+         * PARAMS
+         * c8regs       chip8 registers, at most RT_CONVENTION_REGS
+         * count        number of chip8 registers
+         * addressReg   the addressregister is kept in REG_C16 if true
+         * rConvention  the convention is stored here
+         */
+        void createConvention(const int c8regs[], const int count, const bool addressReg,
+                              RegConvention_t &rConvention) const;
+
+        /**
+         * Code generation:
+         * Starts a block in a convention. All IA registers are pushed
+         * up front, so every block in a convention has the same stack,
+         * and the registers of the convention are loaded. Linked blocks
+         * enter after this code. The tracker must be reset before.
+         *
+         * PARAMS
+         * rConvention  registers to load
+         */
+        void loadConvention(const RegConvention_t &rConvention);
+
+        /**
+         * Code generation:
+         * Moves the registers into a convention before a linked block
+         * is entered. Registers must be saved before, registers outside
+         * the convention are dropped and missing registers are loaded.
+         *
+         * PARAMS
+         * rConvention  registers of the block that is entered
+         */
+        void matchConvention(const RegConvention_t &rConvention);
+
         /**
          * Save all live and modified registers to memory
          */
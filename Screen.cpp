@@ -0,0 +1,171 @@
+/************************************************************
+  **** Screen.cpp (implementation)
+   ***
+    ** Author:
+     *   Tommy Hellstrom
+     *
+     * Description:
+     *   Operations on the whole Chip-8 screen, one 64 bit
+     *   word per row, with SSE2 when it is available
+     *
+     * Revision history:
+     *   When         Who       What
+     *   20261016     me        created
+     *
+     * License information:
+     *   GPLv3
+     *
+     ********************************************************/
+
+#ifdef __SSE2__
+ #include <emmintrin.h>
+#endif
+
+#include "Screen.h"
+
+//the screen is handled 128 bits at a time
+#define SCREEN_VECTORS (SCREEN_SIZE / 16)
+
+/**
+ * Turn off all pixels
+ *
+ * PARAMS
+ * screen   the screen
+ */
+void screenClear(uint64_t screen[C8_RES_HEIGHT])
+{
+#ifdef __SSE2__
+    const __m128i zero = _mm_setzero_si128();
+    __m128i *const p = (__m128i *) screen;
+
+    for(unsigned int i = 0; i < SCREEN_VECTORS; i++)
+        _mm_storeu_si128(p + i, zero);
+#else
+    for(int y = 0; y < C8_RES_HEIGHT; y++)
+        screen[y] = C8_PIXEL_OFF;
+#endif
+}
+
+/**
+ * Copy a screen
+ *
+ * PARAMS
+ * dest     screen copied to
+ * src      screen copied from
+ */
+void screenCopy(uint64_t dest[C8_RES_HEIGHT], const uint64_t src[C8_RES_HEIGHT])
+{
+#ifdef __SSE2__
+    __m128i *const pDest = (__m128i *) dest;
+    const __m128i *const pSrc = (const __m128i *) src;
+
+    for(unsigned int i = 0; i < SCREEN_VECTORS; i++)
+        _mm_storeu_si128(pDest + i, _mm_loadu_si128(pSrc + i));
+#else
+    for(int y = 0; y < C8_RES_HEIGHT; y++)
+        dest[y] = src[y];
+#endif
+}
+
+/**
+ * Compare two screens
+ *
+ * PARAMS
+ * a        first screen
+ * b        second screen
+ *
+ * RETURNS
+ * true if all pixels are the same, otherwise false
+ */
+bool screenEquals(const uint64_t a[C8_RES_HEIGHT], const uint64_t b[C8_RES_HEIGHT])
+{
+#ifdef __SSE2__
+    const __m128i *const pA = (const __m128i *) a;
+    const __m128i *const pB = (const __m128i *) b;
+    __m128i diff = _mm_setzero_si128();
+
+    //the differences are collected, there is one test at the end
+    for(unsigned int i = 0; i < SCREEN_VECTORS; i++)
+        diff = _mm_or_si128(diff, _mm_xor_si128(_mm_loadu_si128(pA + i), _mm_loadu_si128(pB + i)));
+
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(diff, _mm_setzero_si128())) == 0xFFFF;
+#else
+    uint64_t diff = 0;
+
+    for(int y = 0; y < C8_RES_HEIGHT; y++)
+        diff |= a[y] ^ b[y];
+
+    return diff == 0;
+#endif
+}
+
+/**
+ * Count the lit pixels of a screen
+ *
+ * PARAMS
+ * screen   the screen
+ *
+ * RETURNS
+ * number of lit pixels
+ */
+int screenPopcount(const uint64_t screen[C8_RES_HEIGHT])
+{
+#ifdef __SSE2__
+    //SSE2 has no popcount, the bits are summed in each byte instead
+    const __m128i *const p = (const __m128i *) screen;
+    const __m128i m1 = _mm_set1_epi8(0x55);
+    const __m128i m2 = _mm_set1_epi8(0x33);
+    const __m128i m4 = _mm_set1_epi8(0x0F);
+    __m128i bytes = _mm_setzero_si128();
+
+    for(unsigned int i = 0; i < SCREEN_VECTORS; i++)
+    {
+        __m128i v = _mm_loadu_si128(p + i);
+
+        v = _mm_sub_epi8(v, _mm_and_si128(_mm_srli_epi64(v, 1), m1));
+        v = _mm_add_epi8(_mm_and_si128(v, m2), _mm_and_si128(_mm_srli_epi64(v, 2), m2));
+        v = _mm_and_si128(_mm_add_epi8(v, _mm_srli_epi64(v, 4)), m4);
+        //at most 8 per byte and vector, 16 vectors fit in a byte
+        bytes = _mm_add_epi8(bytes, v);
+    }
+
+    //the bytes are added up in each 64 bit half
+    const __m128i sums = _mm_sad_epu8(bytes, _mm_setzero_si128());
+
+    return _mm_cvtsi128_si32(sums) + _mm_cvtsi128_si32(_mm_srli_si128(sums, 8));
+#else
+    int count = 0;
+
+    for(int y = 0; y < C8_RES_HEIGHT; y++)
+        count += __builtin_popcountll(screen[y]);
+
+    return count;
+#endif
+}
+
+/**
+ * Hash a screen, equal screens have equal hashes
+ *
+ * PARAMS
+ * screen   the screen
+ *
+ * RETURNS
+ * 64 bit hash of the pixels
+ */
+uint64_t screenHash(const uint64_t screen[C8_RES_HEIGHT])
+{
+    //FNV-1a over the rows, then mixed so all rows reach all bits
+    uint64_t hash = 14695981039346656037ull;
+
+    for(int y = 0; y < C8_RES_HEIGHT; y++)
+    {
+        hash ^= screen[y];
+        hash *= 1099511628211ull;
+    }
+
+    hash ^= hash >> 33;
+    hash *= 0xFF51AFD7ED558CCDull;
+    hash ^= hash >> 33;
+
+    return hash;
+}
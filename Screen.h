@@ -0,0 +1,86 @@
+/************************************************************
+  **** Screen.h (header)
+   ***
+    ** Author:
+     *   Tommy Hellstrom
+     *
+     * Description:
+     *   Operations on the whole Chip-8 screen, one 64 bit
+     *   word per row, with SSE2 when it is available
+     *
+     * Revision history:
+     *   When         Who       What
+     *   20261016     me        created
+     *
+     * License information:
+     *   GPLv3
+     *
+     ********************************************************/
+
+#pragma once
+#ifndef _SCREEN_H_
+#define _SCREEN_H_
+
+#include <stdint.h>
+
+#include "Chip8def.h"
+
+//size of the screen in bytes
+#define SCREEN_SIZE (C8_RES_HEIGHT * sizeof(uint64_t))
+
+/**
+ * Turn off all pixels. 00E0 in translated code does not call
+ * this, translated code has no calls to host functions, which
+ * would have to save the native registers it keeps Chip-8
+ * registers in. Translator::generate00E0 writes the same 16 byte
+ * stores inline, both must be changed with the screen layout.
+ *
+ * PARAMS
+ * screen   the screen
+ */
+void screenClear(uint64_t screen[C8_RES_HEIGHT]);
+
+/**
+ * Copy a screen
+ *
+ * PARAMS
+ * dest     screen copied to
+ * src      screen copied from
+ */
+void screenCopy(uint64_t dest[C8_RES_HEIGHT], const uint64_t src[C8_RES_HEIGHT]);
+
+/**
+ * Compare two screens
+ *
+ * PARAMS
+ * a        first screen
+ * b        second screen
+ *
+ * RETURNS
+ * true if all pixels are the same, otherwise false
+ */
+bool screenEquals(const uint64_t a[C8_RES_HEIGHT], const uint64_t b[C8_RES_HEIGHT]);
+
+/**
+ * Count the lit pixels of a screen
+ *
+ * PARAMS
+ * screen   the screen
+ *
+ * RETURNS
+ * number of lit pixels
+ */
+int screenPopcount(const uint64_t screen[C8_RES_HEIGHT]);
+
+/**
+ * Hash a screen, equal screens have equal hashes
+ *
+ * PARAMS
+ * screen   the screen
+ *
+ * RETURNS
+ * 64 bit hash of the pixels
+ */
+uint64_t screenHash(const uint64_t screen[C8_RES_HEIGHT]);
+
+#endif //_SCREEN_H_
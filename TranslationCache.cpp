@@ -19,11 +19,105 @@
 #include "TranslationCache.h"
 
 /**
- * Removes all codeblocks
+ * Removes all codeblocks and discards all code in the arena
  */
 void TranslationCache::flush()
 {
     destroy();
+    mArena.reset();
+}
+
+/**
+ * Get the code arena that blocks are emitted into
+ *
+ * RETURNS
+ * pointer to the code arena
+ */
+CodeArena* TranslationCache::getArena()
+{
+    return &mArena;
+}
+
+/**
+ * Get the opcode budget that linked blocks count down
+ *
+ * RETURNS
+ * pointer to the budget
+ */
+volatile int32_t* TranslationCache::getBudget()
+{
+    return &mBudget;
+}
+
+/**
+ * Get the code map that stores check before
+ * writing to emulated memory
+ *
+ * RETURNS
+ * pointer to CACHE_GRANULE_COUNT entries
+ */
+const uint8_t* TranslationCache::getCodeMap() const
+{
+    return mCodeMap;
+}
+
+/**
+ * Get the pending store that translated code records
+ * when it writes to memory holding translated code
+ *
+ * RETURNS
+ * pointer to the pending store
+ */
+volatile TranslationCache::Write* TranslationCache::getPendingWrite()
+{
+    return &mWrite;
+}
+
+/**
+ * Get the execution counters that blocks count down
+ *
+ * RETURNS
+ * pointer to C8_MEMSIZE counters, one per address
+ */
+volatile int32_t* TranslationCache::getHotCount()
+{
+    return mHotCount;
+}
+
+#ifdef C8_PROFILE
+/**
+ * Get the profiler that blocks count their executions in
+ *
+ * RETURNS
+ * the profiler
+ */
+Profiler* TranslationCache::getProfiler()
+{
+    return &mProfiler;
+}
+#endif
+
+/**
+ * Set the predicted host return addresses kept next to the
+ * emulated stack. Predictions into removed blocks are cleared.
+ *
+ * PARAMS
+ * pPrediction  pointer to C8_STACK_DEPTH predictions
+ */
+void TranslationCache::setPrediction(uint32_t *const pPrediction)
+{
+    pmPrediction = pPrediction;
+}
+
+/**
+ * Check if the code arena is too full for another translation
+ *
+ * RETURNS
+ * true if cache needs to be flushed, otherwise false
+ */
+bool TranslationCache::isFull() const
+{
+    return mArena.getFreeSpace() < CACHE_RESERVE;
 }
 
 /**
@@ -44,19 +138,31 @@ void TranslationCache::destroy()
  * RETURNS
  * true if block exist, otherwise false
  */
-bool TranslationCache::execute(uint32_t &rPC) const
+bool TranslationCache::execute(uint32_t &rPC)
 {
-    if(pmBlockTable[rPC] == NULL)
+    if(rPC >= C8_MEMSIZE - 1 || pmBlockTable[rPC] == NULL || isHot(rPC))
         return false;
 
+    //return at first exit
+    mBudget = 1;
     rPC = pmBlockTable[rPC]->pfnCodeBlock();
 
+#ifdef C8_PROFILE
+    mProfiler.leave();
+#endif
+
+    if(mWrite.size != 0)
+        invalidatePending();
+
     return true;
 
 }
 
 /**
  * Executes several blocks pointed to by PC
+ * Linked blocks jump directly to each other and return
+ * when the budget is used up, the next block is unknown
+ * or a block has become hot
  *
  * PARAMS
  * rPC      reference to emulated PC
@@ -65,20 +171,26 @@ bool TranslationCache::execute(uint32_t &rPC) const
  * RETURNS
  * true if block exist, otherwise false
  */
-bool TranslationCache::executeN(uint32_t &rPC, const int opcount) const
+bool TranslationCache::executeN(uint32_t &rPC, const int opcount)
 {
-    int ops = 0;
+    mBudget = opcount;
 
     do
     {
-        if(pmBlockTable[rPC] == NULL)
+        //no block starts past the last opcode in memory
+        if(rPC >= C8_MEMSIZE - 1 || pmBlockTable[rPC] == NULL || isHot(rPC))
             return false;
 
-        ops+=pmBlockTable[rPC]->opcount;
-
         rPC = pmBlockTable[rPC]->pfnCodeBlock();
 
-    } while(ops < opcount);
+#ifdef C8_PROFILE
+        mProfiler.leave();
+#endif
+
+        if(mWrite.size != 0)
+            invalidatePending();
+
+    } while(mBudget > 0);
 
     return true;
 }
@@ -108,13 +220,283 @@ bool TranslationCache::insert(CodeBlock *const pBlock)
     if(pmBlockTable[pBlock->address] == NULL)
     {
         pmBlockTable[pBlock->address] = pBlock;
+        mHotCount[pBlock->address] = CACHE_HOT_COUNT;
         mBlockCount++;
+#ifdef C8_PROFILE
+        mProfiler.record(pBlock);
+#endif
+        link(pBlock);
+        cover(pBlock);
         return true;
     }
 
     return false;
 }
 
+/**
+ * Links the exits of a block to blocks in the cache, and
+ * exits of blocks in the cache to the block
+ *
+ * PARAMS
+ * pBlock  pointer to CodeBlock
+ */
+void TranslationCache::link(CodeBlock *const pBlock)
+{
+    for(int i = 0; i < pBlock->exitCount; i++)
+    {
+        const uint32_t target = pBlock->exits[i].target;
+
+        mIncoming[target].push_back(pBlock);
+
+        if(pmBlockTable[target] != NULL)
+            pBlock->linkExit(i, pmBlockTable[target]->getEntry(pBlock->exits[i]));
+    }
+
+    std::list<CodeBlock *>::iterator it;
+
+    for(it = mIncoming[pBlock->address].begin(); it != mIncoming[pBlock->address].end(); ++it)
+        for(int i = 0; i < (*it)->exitCount; i++)
+            if((*it)->exits[i].target == pBlock->address)
+                (*it)->linkExit(i, pBlock->getEntry((*it)->exits[i]));
+}
+
+/**
+ * Reverts all links to and from a block
+ *
+ * PARAMS
+ * pBlock  pointer to CodeBlock
+ */
+void TranslationCache::unlink(CodeBlock *const pBlock)
+{
+    std::list<CodeBlock *>::iterator it;
+
+    for(it = mIncoming[pBlock->address].begin(); it != mIncoming[pBlock->address].end(); ++it)
+        for(int i = 0; i < (*it)->exitCount; i++)
+            if((*it)->exits[i].target == pBlock->address)
+                (*it)->linkExit(i, NULL);
+
+    for(int i = 0; i < pBlock->exitCount; i++)
+        mIncoming[pBlock->exits[i].target].remove(pBlock);
+}
+
+/**
+ * Adds a block to the granules it contains code in
+ *
+ * PARAMS
+ * pBlock  pointer to CodeBlock
+ */
+void TranslationCache::cover(CodeBlock *const pBlock)
+{
+    std::list<CodeBlock::Range>::const_iterator it;
+    std::list<CodeBlock::Data>::const_iterator d;
+
+    for(it = pBlock->ranges.begin(); it != pBlock->ranges.end(); ++it)
+        coverRange(pBlock, it->address, it->opcount * C8_OPCODE_SIZE, true);
+
+    for(d = pBlock->data.begin(); d != pBlock->data.end(); ++d)
+        coverRange(pBlock, d->address, d->size, true);
+}
+
+/**
+ * Removes a block from the granules it contains code in
+ *
+ * PARAMS
+ * pBlock  pointer to CodeBlock
+ */
+void TranslationCache::uncover(CodeBlock *const pBlock)
+{
+    std::list<CodeBlock::Range>::const_iterator it;
+    std::list<CodeBlock::Data>::const_iterator d;
+
+    for(it = pBlock->ranges.begin(); it != pBlock->ranges.end(); ++it)
+        coverRange(pBlock, it->address, it->opcount * C8_OPCODE_SIZE, false);
+
+    for(d = pBlock->data.begin(); d != pBlock->data.end(); ++d)
+        coverRange(pBlock, d->address, d->size, false);
+}
+
+/**
+ * Adds a block to, or removes it from, the granules of a memory range
+ *
+ * PARAMS
+ * pBlock   pointer to CodeBlock
+ * address  first address of the range
+ * size     size of the range in bytes
+ * add      true to add the block, false to remove it
+ */
+void TranslationCache::coverRange(CodeBlock *const pBlock, const uint32_t address, const uint32_t size, const bool add)
+{
+    const uint32_t last = address + size - 1;
+    const int first = address >> CACHE_GRANULE_SHIFT;
+    const int end = last < C8_MEMSIZE ? (last >> CACHE_GRANULE_SHIFT) : CACHE_GRANULE_COUNT - 1;
+
+    for(int g = first; g <= end; g++)
+    {
+        if(add)
+            mCoverage[g].push_back(pBlock);
+        else
+            mCoverage[g].remove(pBlock);
+
+        updateCodeMap(g);
+        updateCodeMap(g - 1);
+    }
+}
+
+/**
+ * Updates the code map for a granule. A store of at most
+ * one granule can reach into the next granule, so both
+ * are checked.
+ *
+ * PARAMS
+ * granule  granule to update
+ */
+void TranslationCache::updateCodeMap(const int granule)
+{
+    if(granule < 0)
+        return;
+
+    mCodeMap[granule] = !mCoverage[granule].empty() ||
+                        (granule + 1 < CACHE_GRANULE_COUNT && !mCoverage[granule + 1].empty());
+}
+
+/**
+ * Invalidates the blocks hit by a pending store
+ */
+void TranslationCache::invalidatePending()
+{
+    invalidate(mWrite.address, mWrite.size);
+    mWrite.size = 0;
+}
+
+/**
+ * Removes all blocks that contain code in a memory range
+ *
+ * PARAMS
+ * address  first address of the range
+ * size     size of the range in bytes
+ */
+void TranslationCache::invalidate(const uint32_t address, const uint32_t size)
+{
+    if(address >= C8_MEMSIZE || size == 0)
+        return;
+
+    const uint32_t end = address + size < C8_MEMSIZE ? address + size : C8_MEMSIZE;
+    std::list<uint32_t> hit;
+    std::list<CodeBlock *>::iterator it;
+
+    for(uint32_t g = address >> CACHE_GRANULE_SHIFT; g <= ((end - 1) >> CACHE_GRANULE_SHIFT); g++)
+    {
+        mStored[g] = 1;
+
+        for(it = mCoverage[g].begin(); it != mCoverage[g].end(); ++it)
+            if((*it)->overlaps(address, end))
+                hit.push_back((*it)->address);
+    }
+
+    while(!hit.empty())
+    {
+        remove(hit.front());
+        hit.pop_front();
+    }
+}
+
+/**
+ * Check if the rom has stored to a memory range. Only stores
+ * the interpreter runs, or that hit translated code, are seen.
+ *
+ * PARAMS
+ * address  first address of the range
+ * size     size of the range in bytes
+ *
+ * RETURNS
+ * true if stored to, otherwise false
+ */
+bool TranslationCache::isStored(const uint32_t address, const uint32_t size) const
+{
+    for(uint32_t g = address >> CACHE_GRANULE_SHIFT; g <= ((address + size - 1) >> CACHE_GRANULE_SHIFT); g++)
+        if(g >= CACHE_GRANULE_COUNT || mStored[g] != 0)
+            return true;
+
+    return false;
+}
+
+/**
+ * Check if the block at an address has become hot
+ *
+ * PARAMS
+ * address  address of the block
+ *
+ * RETURNS
+ * true if a trace should be formed from the block, otherwise false
+ */
+bool TranslationCache::isHot(const uint32_t address) const
+{
+    return pmBlockTable[address] != NULL && mHotCount[address] == 0;
+}
+
+/**
+ * Get number of times the block at an address has executed
+ *
+ * PARAMS
+ * address  address of the block
+ *
+ * RETURNS
+ * number of executions since the block was inserted
+ */
+uint32_t TranslationCache::getExecutions(const uint32_t address) const
+{
+    return (uint32_t) CACHE_HOT_COUNT - (uint32_t) mHotCount[address];
+}
+
+/**
+ * Selects the hot path from a block through its successors.
+ * Each step follows the exit to the most executed block,
+ * until the path returns to a block already in it, or the
+ * successor ran less than half as often as the first block.
+ * The first block is not hot again.
+ *
+ * PARAMS
+ * address  address of the hot block
+ * rTrace   addresses of the blocks on the path, starting with address
+ */
+void TranslationCache::selectTrace(const uint32_t address, std::list<uint32_t> &rTrace)
+{
+    const CodeBlock *pBlock = pmBlockTable[address];
+
+    //counts down from here, a failed trace is not retried
+    mHotCount[address] = -1;
+    rTrace.clear();
+
+    while(pBlock != NULL && rTrace.size() < CACHE_TRACE_LENGTH)
+    {
+        rTrace.push_back(pBlock->address);
+
+        const CodeBlock *pNext = NULL;
+        uint32_t most = CACHE_HOT_COUNT / 2 - 1;
+
+        //address exits are return addresses, not successors
+        for(int i = 0; i < pBlock->exitCount; i++)
+        {
+            const uint32_t target = pBlock->exits[i].target;
+
+            if(pBlock->exits[i].type == CB_EXIT_JUMP && pmBlockTable[target] != NULL &&
+               getExecutions(target) > most)
+            {
+                most = getExecutions(target);
+                pNext = pmBlockTable[target];
+            }
+        }
+
+        std::list<uint32_t>::const_iterator it;
+
+        for(it = rTrace.begin(); it != rTrace.end() && pNext != NULL; ++it)
+            if(*it == pNext->address)
+                pNext = NULL;
+
+        pBlock = pNext;
+    }
+}
+
 /**
  * Check if block exist at address
  *
@@ -129,6 +511,20 @@ bool TranslationCache::exists(const uint32_t address) const
     return pmBlockTable[address] != NULL;
 }
 
+/**
+ * Get the block at an address
+ *
+ * PARAMS
+ * address  address of the block
+ *
+ * RETURNS
+ * pointer to CodeBlock, NULL if no block exists
+ */
+CodeBlock* TranslationCache::getBlock(const uint32_t address) const
+{
+    return pmBlockTable[address];
+}
+
 /**
  * Removes a block from the cache
  *
@@ -139,6 +535,13 @@ void TranslationCache::remove(const uint32_t address)
 {
     if(pmBlockTable[address] != NULL)
     {
+        if(pmPrediction != NULL)
+            for(int i = 0; i < C8_STACK_DEPTH; i++)
+                if(pmPrediction[i] == (uintptr_t) pmBlockTable[address]->pfnCodeBlock)
+                    pmPrediction[i] = 0;
+
+        unlink(pmBlockTable[address]);
+        uncover(pmBlockTable[address]);
         delete pmBlockTable[address];
         pmBlockTable[address] = NULL;
         mBlockCount--;
@@ -153,23 +556,32 @@ void TranslationCache::remove(const uint32_t address)
  */
 void TranslationCache::replace(CodeBlock *const pBlock)
 {
-    if(pmBlockTable[pBlock->address] != NULL)
-        delete pmBlockTable[pBlock->address];
-    else
-        mBlockCount++;
-
-    pmBlockTable[pBlock->address] = pBlock;
+    remove(pBlock->address);
+    insert(pBlock);
 }
 
 /**
  * Constructor
  */
-TranslationCache::TranslationCache()
+TranslationCache::TranslationCache() : mArena(CACHESIZE)
 {
     for(int i = 0; i < TABLE_SIZE; i++)
+    {
         pmBlockTable[i] = NULL;
+        mHotCount[i] = CACHE_HOT_COUNT;
+    }
+
+    for(int i = 0; i < CACHE_GRANULE_COUNT; i++)
+    {
+        mCodeMap[i] = 0;
+        mStored[i] = 0;
+    }
 
     mBlockCount = 0;
+    mBudget = 0;
+    pmPrediction = NULL;
+    mWrite.address = 0;
+    mWrite.size = 0;
 }
 
 /**
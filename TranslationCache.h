@@ -20,19 +20,82 @@
 #ifndef _TRANSLATIONCACHE_H_
 #define _TRANSLATIONCACHE_H_
 
+#include <list>
 #include <stdint.h>
 
 #include "Chip8def.h"
 #include "CodeBlock.h"
+#include "CodeArena.h"
+#include "CodeGenerator.h"
+#include "Profiler.h"
 
+//size of the code arena in bytes
 #define CACHESIZE 1048576
 
+//free space needed in the code arena before a translation
+#define CACHE_RESERVE (8 * CG_BLOCK_SIZE)
+
+//emulated memory holding translated code is tracked in granules
+#define CACHE_GRANULE_SHIFT 4
+#define CACHE_GRANULE_SIZE  (1 << CACHE_GRANULE_SHIFT)
+#define CACHE_GRANULE_COUNT (C8_MEMSIZE / CACHE_GRANULE_SIZE)
+
+//executions before a block is hot and a trace is formed from it
+#define CACHE_HOT_COUNT 256
+
+//max number of blocks in a trace
+#define CACHE_TRACE_LENGTH 8
+
 class TranslationCache
 {
+    public:
+
+        /**
+         * A store to emulated memory that holds translated code.
+         * Size is zero when there is no pending store.
+         */
+        struct Write
+        {
+            uint32_t address;
+            uint32_t size;
+        };
+
     private:
 
         CodeBlock *pmBlockTable[C8_MEMSIZE];
 
+        CodeArena mArena;
+
+        //blocks with exits that lead to an address
+        std::list<CodeBlock *> mIncoming[C8_MEMSIZE];
+
+        //opcodes left to execute before returning to the dispatcher
+        volatile int32_t mBudget;
+
+        //predicted host return addresses, one per stack entry
+        uint32_t *pmPrediction;
+
+        //blocks that contain code in a granule
+        std::list<CodeBlock *> mCoverage[CACHE_GRANULE_COUNT];
+
+        //nonzero if a store starting in a granule can hit translated code
+        uint8_t mCodeMap[CACHE_GRANULE_COUNT];
+
+        //nonzero if the rom has stored to a granule, data there
+        //is not read when a block is translated
+        uint8_t mStored[CACHE_GRANULE_COUNT];
+
+        //store that hit translated code, blocks are invalidated on return
+        volatile Write mWrite;
+
+        //executions left before the block at an address is hot,
+        //counted down by the block
+        volatile int32_t mHotCount[C8_MEMSIZE];
+
+#ifdef C8_PROFILE
+        Profiler         mProfiler;
+#endif
+
         int mBlockCount;
 
         /**
@@ -40,6 +103,76 @@ class TranslationCache
          */
         void destroy();
 
+        /**
+         * Links the exits of a block to blocks in the cache, and
+         * exits of blocks in the cache to the block
+         *
+         * PARAMS
+         * pBlock  pointer to CodeBlock
+         */
+        void link(CodeBlock *const pBlock);
+
+        /**
+         * Reverts all links to and from a block
+         *
+         * PARAMS
+         * pBlock  pointer to CodeBlock
+         */
+        void unlink(CodeBlock *const pBlock);
+
+        /**
+         * Adds a block to the granules it contains code in
+         *
+         * PARAMS
+         * pBlock  pointer to CodeBlock
+         */
+        void cover(CodeBlock *const pBlock);
+
+        /**
+         * Removes a block from the granules it contains code in
+         *
+         * PARAMS
+         * pBlock  pointer to CodeBlock
+         */
+        void uncover(CodeBlock *const pBlock);
+
+        /**
+         * Adds a block to, or removes it from, the granules of a memory range
+         *
+         * PARAMS
+         * pBlock   pointer to CodeBlock
+         * address  first address of the range
+         * size     size of the range in bytes
+         * add      true to add the block, false to remove it
+         */
+        void coverRange(CodeBlock *const pBlock, const uint32_t address, const uint32_t size, const bool add);
+
+        /**
+         * Updates the code map for a granule. A store of at most
+         * one granule can reach into the next granule, so both
+         * are checked.
+         *
+         * PARAMS
+         * granule  granule to update
+         */
+        void updateCodeMap(const int granule);
+
+        /**
+         * Invalidates the blocks hit by a pending store
+         */
+        void invalidatePending();
+
+        /**
+         * Get number of times the block at an address has executed
+         *
+         * PARAMS
+         * address  address of the block
+         *
+         * RETURNS
+         * number of executions since the block was inserted
+         */
+        uint32_t getExecutions(const uint32_t address) const;
+
     public:
 
         static const int TABLE_SIZE = C8_MEMSIZE;
@@ -53,7 +186,7 @@ class TranslationCache
          * RETURNS
          * true if block exist, otherwise false
          */
-        bool execute(uint32_t &rPC) const;
+        bool execute(uint32_t &rPC);
 
         /**
          * Executes several blocks pointed to by PC
@@ -65,7 +198,7 @@ class TranslationCache
          * RETURNS
          * true if block exist, otherwise false
          */
-        bool executeN(uint32_t &rPC, const int opcount) const;
+        bool executeN(uint32_t &rPC, const int opcount);
 
         /**
          * Insert a codeblock
@@ -89,6 +222,17 @@ class TranslationCache
          */
         bool exists(const uint32_t address) const;
 
+        /**
+         * Get the block at an address
+         *
+         * PARAMS
+         * address  address of the block
+         *
+         * RETURNS
+         * pointer to CodeBlock, NULL if no block exists
+         */
+        CodeBlock* getBlock(const uint32_t address) const;
+
         /**
          * Removes a block from the cache
          *
@@ -97,6 +241,52 @@ class TranslationCache
          */
         void remove(const uint32_t address);
 
+        /**
+         * Check if the block at an address has become hot
+         *
+         * PARAMS
+         * address  address of the block
+         *
+         * RETURNS
+         * true if a trace should be formed from the block, otherwise false
+         */
+        bool isHot(const uint32_t address) const;
+
+        /**
+         * Selects the hot path from a block through its successors.
+         * Each step follows the exit to the most executed block,
+         * until the path returns to a block already in it, or the
+         * successor ran less than half as often as the first block.
+         * The first block is not hot again.
+         *
+         * PARAMS
+         * address  address of the hot block
+         * rTrace   addresses of the blocks on the path, starting with address
+         */
+        void selectTrace(const uint32_t address, std::list<uint32_t> &rTrace);
+
+        /**
+         * Removes all blocks that contain code in a memory range
+         *
+         * PARAMS
+         * address  first address of the range
+         * size     size of the range in bytes
+         */
+        void invalidate(const uint32_t address, const uint32_t size);
+
+        /**
+         * Check if the rom has stored to a memory range. Only stores
+         * the interpreter runs, or that hit translated code, are seen.
+         *
+         * PARAMS
+         * address  first address of the range
+         * size     size of the range in bytes
+         *
+         * RETURNS
+         * true if stored to, otherwise false
+         */
+        bool isStored(const uint32_t address, const uint32_t size) const;
+
         /**
          * Replace block at address
          *
@@ -114,10 +304,79 @@ class TranslationCache
         int getNumberOfBlocks() const;
 
         /**
-         * Removes all codeblocks
+         * Removes all codeblocks and discards all code in the arena
          */
         void flush();
 
+        /**
+         * Get the code arena that blocks are emitted into
+         *
+         * RETURNS
+         * pointer to the code arena
+         */
+        CodeArena* getArena();
+
+        /**
+         * Get the opcode budget that linked blocks count down
+         *
+         * RETURNS
+         * pointer to the budget
+         */
+        volatile int32_t* getBudget();
+
+        /**
+         * Get the code map that stores check before
+         * writing to emulated memory
+         *
+         * RETURNS
+         * pointer to CACHE_GRANULE_COUNT entries
+         */
+        const uint8_t* getCodeMap() const;
+
+        /**
+         * Get the pending store that translated code records
+         * when it writes to memory holding translated code
+         *
+         * RETURNS
+         * pointer to the pending store
+         */
+        volatile Write* getPendingWrite();
+
+        /**
+         * Get the execution counters that blocks count down
+         *
+         * RETURNS
+         * pointer to C8_MEMSIZE counters, one per address
+         */
+        volatile int32_t* getHotCount();
+
+#ifdef C8_PROFILE
+        /**
+         * Get the profiler that blocks count their executions in
+         *
+         * RETURNS
+         * the profiler
+         */
+        Profiler* getProfiler();
+#endif
+
+        /**
+         * Set the predicted host return addresses kept next to the
+         * emulated stack. Predictions into removed blocks are cleared.
+         *
+         * PARAMS
+         * pPrediction  pointer to C8_STACK_DEPTH predictions
+         */
+        void setPrediction(uint32_t *const pPrediction);
+
+        /**
+         * Check if the code arena is too full for another translation
+         *
+         * RETURNS
+         * true if cache needs to be flushed, otherwise false
+         */
+        bool isFull() const;
+
         /**
          * Constructor
          */
@@ -16,7 +16,10 @@
      *
      ********************************************************/
 
+#include <cstddef>
+
 #include "Translator.h"
+#include "Screen.h"
 
 /**
  * Reset the translator
@@ -26,6 +29,14 @@ void Translator::reset()
     mCondition = false;
     mReadyToTranslate = false;
     mCountdown = 0;
+    mBlockOpcount = 0;
+    mTracing = false;
+    mResident = false;
+    mArenaFull = false;
+    mExits.clear();
+    mRanges.clear();
+    mData.clear();
+    mTrace.clear();
 
     codegen.reset();
     tracker.reset();
@@ -44,12 +55,7 @@ void Translator::destroy()
         delete p;
     }
 
-    while(!mDecodedOps.empty())
-    {
-        const DecodedOpcode *const p = mDecodedOps.back();
-        mDecodedOps.pop_back();
-        delete p;
-    }
+    mDecodedOps.clear();
 }
 
 /**
@@ -66,8 +72,9 @@ bool Translator::getCodeBlock(CodeBlock **const ppBlock)
     if(mBlocks.empty())
         return false;
 
-    *ppBlock = mBlocks.front();
-    mBlocks.pop_front();
+    //the last block stored is handed out first
+    *ppBlock = mBlocks.back();
+    mBlocks.pop_back();
 
     if(mBlocks.empty())
         reset();
@@ -75,6 +82,75 @@ bool Translator::getCodeBlock(CodeBlock **const ppBlock)
     return true;
 }
 
+/**
+ * Translate the next block as a superblock along a trace.
+ * Jumps, calls and skips on the trace continue in the same
+ * block, other paths leave it through side exits.
+ *
+ * PARAMS
+ * rTrace   addresses of the blocks on the trace
+ */
+void Translator::setTrace(const std::list<uint32_t> &rTrace)
+{
+    mTracing = true;
+    mTrace = rTrace;
+
+    //translation starts in the first block
+    if(!mTrace.empty())
+        mTrace.pop_front();
+}
+
+/**
+ * Get the address of a memory region the generated code
+ * addresses. Relocations in CodeBlocks refer to these.
+ *
+ * PARAMS
+ * region   region number
+ *
+ * RETURNS
+ * address of the region
+ */
+uintptr_t Translator::getRegionBase(const int region) const
+{
+    return codegen.getRegionBase(region);
+}
+
+/**
+ * Get number of memory regions the generated code addresses
+ *
+ * RETURNS
+ * number of regions
+ */
+int Translator::getRegionCount() const
+{
+    return codegen.getRegionCount();
+}
+
+/**
+ * Check that the generated code can address all memory
+ * regions, in 64 bit mode they must be in the low 2GB
+ *
+ * RETURNS
+ * true if the translator is usable, otherwise false
+ */
+bool Translator::isValid() const
+{
+    return codegen.isRegionsValid();
+}
+
+/**
+ * Check if a block of the last translation did not fit in
+ * the code arena. The block is not handed out, the code is
+ * translated again after the cache has been flushed.
+ *
+ * RETURNS
+ * true if a block was thrown away, otherwise false
+ */
+bool Translator::isArenaFull() const
+{
+    return mArenaFull;
+}
+
 /**
  * Start translation.
  * Generates machinecode from IR
@@ -83,45 +159,471 @@ void Translator::translate()
 {
     int opcount = 0;
     int i = 0;
-    uint32_t address = mDecodedOps.front()->address;
+    uint32_t address = mDecodedOps.front().address;
+    CodeBlock::Range range;
+
+    range.address = address;
+    range.opcount = 0;
+
+    analyzeConstants();
+    analyzeLiveness();
+
+    //superblocks are not counted, they are never hot again
+    if(!mTracing)
+        generateCounter(address);
+
+#ifdef C8_PROFILE
+    generateProfile(address);
+#else
+    //the profiler counts blocks at their first instruction, which
+    //linked blocks in the same convention would jump past
+    if(mTracing)
+        generateConvention(mDecodedOps.begin());
+#endif
 
-    while(!mDecodedOps.empty())
+    for(std::vector<DecodedOpcode>::iterator it = mDecodedOps.begin(); it != mDecodedOps.end(); ++it)
     {
         opcount++;
-        DecodedOpcode *pNode = mDecodedOps.front();
-        mDecodedOps.pop_front();
+        const DecodedOpcode *const pNode = &*it;
+
+        //a skip can land on an unknown opcode, which still needs
+        //its label and can still start a block
+        if(pNode->isCondBranchDest)
+            codegen.insertLabel(mLabelCondBranchDest);
+
+        if (pNode->leader && i > 0)
+        {
+            mBlockOpcount = opcount - 1;
+            generateReturn(*pNode);
+            mRanges.push_back(range);
+            storeBlock(address, opcount);
+            address = pNode->address;
+            opcount = 1;
+            range.address = address;
+            range.opcount = 0;
+
+            tracker.reset();
+            //condition = false;
+            //countdown = 0;
+
+            if(!mTracing)
+                generateCounter(address);
+
+#ifdef C8_PROFILE
+            generateProfile(address);
+#else
+            if(mTracing)
+                generateConvention(it);
+#endif
+        }
+
+        //the block is ended before the arena runs out, the rest is left
+        //to a later translation. An opcode in a condition follows its skip.
+        if(opcount > 1 && !pNode->inCondition && codegen.getFreeSpace() < TR_OPCODE_RESERVE)
+        {
+            opcount--;
+            mBlockOpcount = opcount;
+            generateReturn(*pNode);
+            break;
+        }
+
+        mBlockOpcount = opcount;
 
         if(!pNode->ignore)
+            (this->*pNode->pfnGenOpcode)(*pNode);
+        else if(pNode->inCondition)
+            //an unknown opcode in a condition has no code, the path still has to leave the block
+            generateReturn(*pNode);
+
+        //a trace continued somewhere else
+        if(pNode->address != range.address + range.opcount * C8_OPCODE_SIZE)
+        {
+            mRanges.push_back(range);
+            range.address = pNode->address;
+            range.opcount = 0;
+        }
+
+        range.opcount++;
+        i++;
+    }
+
+    mDecodedOps.clear();
+    mRanges.push_back(range);
+    storeBlock(address, opcount);
+}
+
+/**
+ * Forward pass over the IR that tracks the values of the
+ * registers and I known at translation time. Opcodes on
+ * known values are folded to their result, skips on known
+ * values are decided, and opcodes that use I remember it
+ * when it is known.
+ */
+void Translator::analyzeConstants()
+{
+    //-1 when the value is only known at runtime
+    int regs[C8_GPREG_COUNT];
+    int addressReg = -1;
+
+    for(int i = 0; i < C8_GPREG_COUNT; i++)
+        regs[i] = -1;
+
+    for(size_t i = 0; i < mDecodedOps.size(); i++)
+    {
+        DecodedOpcode &rNode = mDecodedOps[i];
+
+        //code can jump to a leader, a conditional opcode leaves the block
+        if(rNode.leader)
+        {
+            for(int r = 0; r < C8_GPREG_COUNT; r++)
+                regs[r] = -1;
+
+            addressReg = -1;
+        }
+
+        if(rNode.ignore || rNode.inCondition)
+            continue;
+
+        const int x = (rNode.opcode & 0x0F00) >> 8;
+        const int y = (rNode.opcode & 0x00F0) >> 4;
+        const int n = rNode.opcode & 0x000F;
+        const int nn = rNode.opcode & 0x00FF;
+        const int vx = regs[x];
+        const int vy = regs[y];
+        int flag = -1;
+        int result = -1;
+
+        rNode.addressRegKnown = addressReg >= 0;
+        rNode.addressRegValue = addressReg;
+
+        switch(rNode.opcode >> 12)
+        {
+            case 0x3: case 0x4:
+                if(vx >= 0)
+                {
+                    rNode.folded = true;
+                    rNode.value = (vx == nn) == ((rNode.opcode >> 12) == 0x3);
+                }
+                break;
+
+            case 0x5: case 0x9:
+                if(vx >= 0 && vy >= 0)
+                {
+                    rNode.folded = true;
+                    rNode.value = (vx == vy) == ((rNode.opcode >> 12) == 0x5);
+                }
+                break;
+
+            case 0x6:
+                result = nn;
+                break;
+
+            case 0x7:
+                if(vx >= 0)
+                    result = (vx + nn) & 0xFF;
+                break;
+
+            case 0x8:
+                if(vx >= 0 && vy >= 0)
+                {
+                    switch(n)
+                    {
+                        case 0x1: result = vx | vy; break;
+                        case 0x2: result = vx & vy; break;
+                        case 0x3: result = vx ^ vy; break;
+                        case 0x4: result = (vx + vy) & 0xFF; flag = vx + vy > 0xFF; break;
+                        case 0x5: result = (vx - vy) & 0xFF; flag = vx >= vy; break;
+                        case 0x7: result = (vy - vx) & 0xFF; flag = vy >= vx; break;
+                    }
+                }
+
+                if(n == 0x0)
+                    result = vy;
+                else if(n == 0x6 && vx >= 0)
+                {
+                    result = vx >> 1;
+                    flag = vx & 0x1;
+                }
+                else if(n == 0xE && vx >= 0)
+                {
+                    result = (vx << 1) & 0xFF;
+                    flag = vx >> 7;
+                }
+
+                //VF is set after VX
+                if(result < 0 && ((n >= 0x4 && n <= 0x7) || n == 0xE))
+                    regs[C8_FLAG_REG] = -1;
+                break;
+
+            case 0xA:
+                rNode.folded = true;
+                addressReg = rNode.opcode & 0x0FFF;
+                rNode.value = addressReg;
+                break;
+
+            case 0xC:
+                regs[x] = -1;
+                break;
+
+            case 0xD:
+                regs[C8_FLAG_REG] = -1;
+                break;
+
+            case 0xF:
+                if(nn == 0x07 || nn == 0x0A)
+                    regs[x] = -1;
+                else if(nn == 0x65)
+                    for(int r = 0; r <= x; r++)
+                        regs[r] = -1;
+                else if(nn == 0x1E || nn == 0x29)
+                {
+                    if(vx < 0 || (nn == 0x1E && addressReg < 0))
+                        addressReg = -1;
+                    else
+                    {
+                        addressReg = nn == 0x1E ? addressReg + vx : vx * 5;
+                        rNode.folded = true;
+                        rNode.value = addressReg;
+                    }
+                }
+                break;
+        }
+
+        if((rNode.opcode >> 12) == 0x6 || (rNode.opcode >> 12) == 0x7 || (rNode.opcode >> 12) == 0x8)
         {
-            if(pNode->isCondBranchDest)
-                codegen.insertLabel(mLabelCondBranchDest);
+            regs[x] = result;
 
-            if (pNode->leader && i > 0)
+            if(result >= 0)
             {
-                generateReturn(*pNode);
-                void *pBlock;
-                size_t size;
-                void *const pCode = codegen.getAlignedCodePointer(&pBlock, &size);
-                mBlocks.push_front(new CodeBlock(pBlock, pCode, address, opcount, size));
-                address = pNode->address;
-                opcount = 1;
-
-                tracker.reset();
-                //condition = false;
-                //countdown = 0;
+                rNode.folded = true;
+                rNode.value = result;
+                rNode.flagValue = flag;
             }
 
-            (this->*pNode->pfnGenOpcode)(*pNode);
+            if(flag >= 0)
+                regs[C8_FLAG_REG] = flag;
         }
+    }
+}
 
-        delete pNode;
-        i++;
+/**
+ * Backward liveness pass over the IR for the registers and I.
+ * Opcodes that set VF from the carry flag only write it when
+ * it is read before it is set again, or when the block can be
+ * left before that, and folded opcodes only set live registers.
+ * A skip on VF right after such an opcode tests the carry flag.
+ */
+void Translator::analyzeLiveness()
+{
+    //one bit for each register, and one for I above them
+    const uint32_t addressBit = 1 << C8_GPREG_COUNT;
+    const uint32_t all = (addressBit << 1) - 1;
+    const uint32_t flagBit = 1 << C8_FLAG_REG;
+
+    //3F00, 3F01, 4F00 and 4F01 after 8XY4, 8XY5, 8XY6, 8XY7 or 8XYE
+    for(size_t i = 1; i < mDecodedOps.size(); i++)
+    {
+        DecodedOpcode &rFlag = mDecodedOps[i - 1];
+        DecodedOpcode &rSkip = mDecodedOps[i];
+        const uint32_t n = rFlag.opcode & 0xF00F;
+
+        //a folded opcode does not set the carry flag
+        if(rFlag.ignore || rFlag.inCondition || rFlag.folded ||
+           (n != 0x8004 && n != 0x8005 && n != 0x8006 && n != 0x8007 && n != 0x800E))
+            continue;
+
+        //code can jump to a skip that starts a block or ends a condition
+        if(rSkip.ignore || rSkip.inCondition || rSkip.leader || rSkip.isCondBranchDest ||
+           ((rSkip.opcode & 0xFFFE) != 0x3F00 && (rSkip.opcode & 0xFFFE) != 0x4F00))
+            continue;
+
+        //VF is set when the carry flag is clear after a subtraction
+        const bool noCarry = n == 0x8005 || n == 0x8007;
+        const bool equal = (rSkip.opcode & 0xF000) == 0x3000;
+        const bool one = (rSkip.opcode & 0x0001) != 0;
+
+        rFlag.carryUsed = true;
+        rSkip.carrySkip = true;
+        rSkip.skipIfCarry = (one != noCarry) == equal;
     }
 
-    void *pBlock;
+    //all registers and I are live at the end of the IR
+    uint32_t live = all;
+
+    for(size_t i = mDecodedOps.size(); i-- > 0; )
+    {
+        DecodedOpcode &rNode = mDecodedOps[i];
+
+        if(rNode.ignore)
+            continue;
+
+        const int x = (rNode.opcode & 0x0F00) >> 8;
+        const int y = (rNode.opcode & 0x00F0) >> 4;
+        const int n = rNode.opcode & 0x000F;
+        const int nn = rNode.opcode & 0x00FF;
+        const uint32_t known = rNode.addressRegKnown ? 0 : addressBit;
+        uint32_t result = 1 << x;
+        uint32_t reads = 0;
+        uint32_t writes = 0;
+        bool leaves = rNode.exitOnSkip;
+
+        switch(rNode.opcode >> 12)
+        {
+            case 0x0:
+                leaves = rNode.opcode == 0x00EE;
+                break;
+
+            case 0x1: case 0x2:
+                leaves = !rNode.inlineJump;
+                break;
+
+            case 0x3: case 0x4: case 0xE:
+                reads = rNode.carrySkip ? 0 : 1 << x;
+                break;
+
+            case 0x5: case 0x9:
+                reads = 1 << x | 1 << y;
+                break;
+
+            case 0x6: case 0xC:
+                writes = 1 << x;
+                break;
+
+            case 0x7:
+                reads = 1 << x;
+                writes = 1 << x;
+                break;
+
+            case 0x8:
+                if(n == 0x0)
+                    reads = 1 << y;
+                else if(n == 0x6 || n == 0xE)
+                    reads = 1 << x;
+                else
+                    reads = 1 << x | 1 << y;
+
+                writes = 1 << x;
+
+                if(n == 0x6 || n == 0xE || (n >= 0x4 && n <= 0x7))
+                {
+                    writes |= flagBit;
+                    rNode.flagLive = (live & flagBit) != 0;
+                }
+                break;
+
+            case 0xA:
+                result = addressBit;
+                writes = addressBit;
+                break;
+
+            case 0xB:
+                leaves = true;
+                break;
+
+            case 0xD:
+                reads = 1 << x | 1 << y | known;
+                writes = flagBit;
+                break;
+
+            case 0xF:
+                //stores can return to the dispatcher
+                if(nn == 0x07)
+                    writes = 1 << x;
+                else if(nn == 0x65)
+                {
+                    reads = known;
+                    writes = (2 << x) - 1;
+                }
+                else if(nn == 0x55)
+                    reads = ((2 << x) - 1) | known;
+                else if(nn == 0x1E || nn == 0x29)
+                {
+                    result = addressBit;
+                    reads = 1 << x | (nn == 0x1E ? addressBit : 0);
+                    writes = addressBit;
+                }
+                else if(nn == 0x33)
+                    reads = 1 << x | addressBit;
+                else if(nn != 0x0A)
+                    reads = 1 << x;
+
+                leaves = nn == 0x0A || nn == 0x33 || nn == 0x55;
+                break;
+        }
+
+        rNode.resultLive = (live & result) != 0;
+
+        //the operands of a folded opcode are not read
+        if(rNode.folded)
+            reads = 0;
+
+        //a conditional opcode leaves the block instead of running
+        if(rNode.inCondition || leaves)
+            live = all;
+        else
+            live = reads | (live & ~writes);
+
+        //the block before a leader ends with an exit
+        if(rNode.leader)
+            live = all;
+    }
+}
+
+/**
+ * Stores generated code as a new codeblock
+ *
+ * PARAMS
+ * address  the address for the code in the emulated machine
+ * opcount  number of emulated opcodes the block contains
+ */
+void Translator::storeBlock(const uint32_t address, const int opcount)
+{
+    //shortening the jumps moves the code the exits point into
+    codegen.insertJumps();
+
+    for(std::list<CodeBlock::Exit>::iterator it = mExits.begin(); it != mExits.end(); ++it)
+        it->offset = codegen.getFinalIndex(it->offset);
+
+    const int residentOffset = mResident ? codegen.getFinalIndex(mResidentIndex) : -1;
+
+    std::list<Relocation_t> relocations;
+    codegen.takeRelocations(relocations);
+
     size_t size;
-    void *const pCode = codegen.getAlignedCodePointer(&pBlock, &size);
-    mBlocks.push_front(new CodeBlock(pBlock, pCode, address, opcount, size));
+    void *const pCode = codegen.getAlignedCodePointer(&size);
+
+    if(pCode == NULL)
+    {
+        mArenaFull = true;
+        mExits.clear();
+        mRanges.clear();
+        mData.clear();
+        mResident = false;
+        return;
+    }
+
+    CodeBlock *const pBlock = new CodeBlock(pCode, address, opcount, size);
+
+    pBlock->relocations.swap(relocations);
+    pBlock->ranges.swap(mRanges);
+    pBlock->data.swap(mData);
+    mRanges.clear();
+    mData.clear();
+
+    if(mResident)
+    {
+        pBlock->residentOffset = residentOffset;
+        pBlock->convention = mConvention;
+        mResident = false;
+    }
+
+    while(!mExits.empty())
+    {
+        pBlock->addExit(mExits.front());
+        mExits.pop_front();
+    }
+
+    mBlocks.push_back(pBlock);
 }
 
 /**
@@ -139,11 +641,28 @@ bool Translator::emit(const uint32_t opcode, uint32_t &rC8PC)
         return false;
     }
 
-    DecodedOpcode *pNode = new DecodedOpcode();
+    //the node is built in place at the end of the IR
+    mDecodedOps.push_back(DecodedOpcode());
+    DecodedOpcode *const pNode = &mDecodedOps.back();
     pNode->address = rC8PC;
     pNode->opcode = opcode;
     decode(*pNode);
-    mDecodedOps.push_back(pNode);
+
+    //a trace continues on one side of a skip instruction,
+    //the opcode is decoded again outside of the condition
+    if(mCondition && !mTrace.empty() && traceTarget(*pNode) == mTrace.front())
+    {
+        if(mCountdown > 0)
+            mDecodedOps[mDecodedOps.size() - 2].exitOnSkip = true;
+
+        mCondition = false;
+        mCountdown = 0;
+        pNode->isCondBranchDest = true;
+        decode(*pNode);
+
+        if(pNode->address == mTrace.front())
+            mTrace.pop_front();
+    }
 
     if(mCondition && mCountdown == 0)
     {
@@ -153,51 +672,426 @@ bool Translator::emit(const uint32_t opcode, uint32_t &rC8PC)
     else if(mCondition)
         mCountdown--;
 
+    //a trace continues at the target of a jump or call
+    if(mReadyToTranslate && !pNode->inCondition && !mTrace.empty() &&
+       traceTarget(*pNode) == mTrace.front())
+    {
+        mTrace.pop_front();
+        mReadyToTranslate = false;
+        pNode->inlineJump = true;
+        mNextOpAddress = pNode->arg3;
+    }
+
     if(mReadyToTranslate)
     {
-        mNextOpAddress = mDecodedOps.front()->address;
+        mNextOpAddress = mDecodedOps.front().address;
         rC8PC = mNextOpAddress;
         translate();
     }
-    else
-        rC8PC = mNextOpAddress;
+    else
+        rC8PC = mNextOpAddress;
+
+    return !mReadyToTranslate;
+}
+
+/**
+ * Sets the codegeneration-function for an IR-node.
+ * If the node is in an IF statement a forced return
+ * will be generated.
+ *
+ * PARAMS
+ * rNode         ref. to IR-node (decoded node)
+ * pfnGenOpcode  func. pointer to codegeneration routin for that node
+ */
+inline void Translator::setOpcodeFunction(DecodedOpcode &rNode, const TranslatorMemberFnGenerate_t pfnGenOpcode)
+{
+    if(!mCondition)
+        rNode.pfnGenOpcode = pfnGenOpcode;
+    else
+        rNode.pfnGenOpcode = &Translator::generateReturn;
+}
+
+/**
+ * Generates code to force return
+ *
+ * PARAMS
+ * rNode    ref. to IR-node (decoded node)
+ */
+void Translator::generateReturn(const DecodedOpcode &rNode)
+{
+    if(!rNode.inCondition)
+        tracker.saveRegisters();
+
+    generateExit(rNode.address);
+}
+
+/**
+ * Generates code that counts down the opcode budget
+ * with the number of opcodes in the block so far.
+ */
+void Translator::generateBudget()
+{
+    codegen.sub_m32i32_d32(mBudgetAddr, mBlockOpcount);
+}
+
+/**
+ * Generates code that sets VF from the carry flag,
+ * if VF is live after the opcode
+ *
+ * PARAMS
+ * rNode    ref. to IR-node (decoded node)
+ * noCarry  VF is set when the carry flag is clear
+ */
+void Translator::generateFlag(const DecodedOpcode &rNode, const bool noCarry)
+{
+    if(!rNode.flagLive)
+        return;
+
+    //allocation only moves and pushes, the carry flag is kept
+    const int r = tracker.allocRegX8(C8_FLAG_REG, false);
+
+    if(noCarry)
+        codegen.setnc_r8(r);
+    else
+        codegen.setc_r8(r);
+
+    tracker.modifiedRegX8(r);
+}
+
+/**
+ * Generates the result of an opcode that was folded to a
+ * constant. VX and VF are only set if they are live.
+ *
+ * PARAMS
+ * rNode    ref. to IR-node (decoded node)
+ *
+ * RETURNS
+ * true if the opcode was folded, otherwise false
+ */
+bool Translator::generateConstant(const DecodedOpcode &rNode)
+{
+    if(!rNode.folded)
+        return false;
+
+    //VF is set after VX, it is all that is kept if VX is VF
+    if(rNode.resultLive && (rNode.flagValue < 0 || rNode.arg1 != C8_FLAG_REG))
+    {
+        const int r = tracker.allocRegX8(rNode.arg1, false);
+
+        codegen.mov_r8i8(r, rNode.value);
+        tracker.modifiedRegX8(r);
+    }
+
+    if(rNode.flagValue >= 0 && rNode.flagLive)
+    {
+        const int r = tracker.allocRegX8(C8_FLAG_REG, false);
+
+        codegen.mov_r8i8(r, rNode.flagValue);
+        tracker.modifiedRegX8(r);
+    }
+
+    return true;
+}
+
+/**
+ * Generates code that counts the executions of a block.
+ * When the block becomes hot it returns to the dispatcher
+ * once, so a trace can be formed from it.
+ *
+ * PARAMS
+ * address  emulated address of the block
+ */
+void Translator::generateCounter(const uint32_t address)
+{
+    codegen.sub_m32i32_d32(mHotCountAddr + address * sizeof(int32_t), 1);
+    codegen.jnz_i8(6);
+
+    //nothing is pushed yet
+    codegen.mov_r32i32(X86_REG_EAX, address);
+    codegen.ret();
+}
+
+#ifdef C8_PROFILE
+/**
+ * Generates code that counts the executions of a block for
+ * the profiler. With C8_PROFILE_CYCLES the time since the
+ * last block entry is also counted, for the last block.
+ *
+ * PARAMS
+ * address  emulated address of the block
+ */
+void Translator::generateProfile(const uint32_t address)
+{
+    const uintptr_t entry = mProfileAddr + address * sizeof(Profiler::Entry);
+    const uintptr_t executions = entry + offsetof(Profiler::Entry, executions);
+
+    //nothing is pushed yet, EAX, ECX and EDX are free
+    codegen.add_m32i32_d32(executions, 1);
+    codegen.adc_m32i32_d32(executions + 4, 0);
+
+#ifdef C8_PROFILE_CYCLES
+    const uint8_t current = offsetof(Profiler::Clock, pCurrent);
+
+    //EDX:EAX = time since the last entry, the clock is moved to now
+    codegen.rdtsc();
+    codegen.mov_r32i32(X86_REG_ECX, mClockAddr);
+    codegen.sub_r32m32(X86_REG_EAX, X86_REG_ECX);
+    codegen.sbb_r32m32_d8(X86_REG_EDX, X86_REG_ECX, 4);
+    codegen.add_m32r32(X86_REG_ECX, X86_REG_EAX);
+    codegen.adc_m32r32_d8(X86_REG_ECX, X86_REG_EDX, 4);
+
+    //counted for the last block, this block is the current one
+    codegen.mov_r32m32_d8(X86_REG_ECX, X86_REG_ECX, current);
+    codegen.add_m32r32(X86_REG_ECX, X86_REG_EAX);
+    codegen.adc_m32r32_d8(X86_REG_ECX, X86_REG_EDX, 4);
+    codegen.mov_r32i32(X86_REG_ECX, mClockAddr);
+    codegen.mov_m32i32_d8(X86_REG_ECX, entry + offsetof(Profiler::Entry, cycles), current);
+#endif
+}
+#endif
+
+/**
+ * Generates the conditional jump of a skip instruction.
+ * If a trace continues at the next instruction the jump
+ * is inverted, and skipping leaves the block. Skips on
+ * VF that test the carry flag use the carry flag instead
+ * of the zero flag, and skips on known values jump always
+ * or never.
+ *
+ * PARAMS
+ * rNode        ref. to IR-node (decoded node)
+ * skipIfSet    skip if the flag is set, otherwise if it is clear
+ */
+void Translator::generateSkip(const DecodedOpcode &rNode, const bool skipIfSet)
+{
+    //the skip was decided when translating
+    if(rNode.folded)
+    {
+        if(rNode.value != 0 && rNode.exitOnSkip)
+            generateExit(rNode.address + 2 * C8_OPCODE_SIZE);
+        else if(rNode.value != 0)
+            codegen.jmp(mLabelCondBranchDest);
+
+        return;
+    }
+
+    //jumps past the next instruction, or stays in the trace
+    const bool jumpIfSet = rNode.exitOnSkip ? !skipIfSet : skipIfSet;
+
+    if(rNode.carrySkip && jumpIfSet)
+        codegen.jc(mLabelCondBranchDest);
+    else if(rNode.carrySkip)
+        codegen.jnc(mLabelCondBranchDest);
+    else if(jumpIfSet)
+        codegen.jz(mLabelCondBranchDest);
+    else
+        codegen.jnz(mLabelCondBranchDest);
+
+    if(!rNode.exitOnSkip)
+        return;
+
+    generateExit(rNode.address + 2 * C8_OPCODE_SIZE);
+}
+
+/**
+ * Get the address execution continues at after an opcode,
+ * when a trace passes through it
+ *
+ * PARAMS
+ * rNode    ref. to IR-node (decoded node)
+ *
+ * RETURNS
+ * emulated address, C8_MEMSIZE if only known at runtime
+ */
+uint32_t Translator::traceTarget(const DecodedOpcode &rNode) const
+{
+    if(rNode.pfnGenOpcode == &Translator::generate1NNN || rNode.pfnGenOpcode == &Translator::generate2NNN)
+        return rNode.arg3;
+
+    //FX0A always starts a block of its own
+    if(rNode.ignore || rNode.pfnGenOpcode == &Translator::generate00EE ||
+       rNode.pfnGenOpcode == &Translator::generateBNNN || (rNode.opcode & 0xF0FF) == 0xF00A)
+        return C8_MEMSIZE;
+
+    return rNode.address;
+}
+
+/**
+ * Generates the entry of a superblock, which keeps the chip8
+ * registers it uses most in IA registers. Blocks in the same
+ * convention jump past the entry without going through memory.
+ *
+ * PARAMS
+ * first    first IR-node of the block
+ */
+void Translator::generateConvention(const std::vector<DecodedOpcode>::const_iterator first)
+{
+    int uses[C8_GPREG_COUNT] = {0};
+    int c8regs[RT_CONVENTION_REGS];
+    int count = 0;
+    bool addressReg = false;
+
+    for(std::vector<DecodedOpcode>::const_iterator it = first;
+        it != mDecodedOps.end() && (it == first || !it->leader); ++it)
+    {
+        if(it->ignore || it->inCondition)
+            continue;
+
+        const int x = (it->opcode & 0x0F00) >> 8;
+        const int y = (it->opcode & 0x00F0) >> 4;
+        const int n = it->opcode & 0x000F;
+        const int nn = it->opcode & 0x00FF;
+
+        switch(it->opcode >> 12)
+        {
+            case 0x3: case 0x4: case 0x6: case 0x7: case 0xC: case 0xE:
+                uses[x]++;
+                break;
+
+            case 0x5: case 0x9:
+                uses[x]++;
+                uses[y]++;
+                break;
+
+            case 0x8:
+                uses[x]++;
+                uses[y]++;
+
+                //arithmetic and shifts set VF
+                if((n >= 0x4 && n <= 0x7) || n == 0xE)
+                    uses[C8_FLAG_REG]++;
+                break;
+
+            case 0xA:
+                addressReg = true;
+                break;
+
+            case 0xD:
+                uses[x]++;
+                uses[y]++;
+                uses[C8_FLAG_REG]++;
+                addressReg = true;
+                break;
+
+            case 0xF:
+                //FX55 and FX65 go through memory
+                if(nn != 0x0A && nn != 0x55 && nn != 0x65)
+                    uses[x]++;
+
+                if(nn == 0x1E || nn == 0x29 || nn == 0x33 || nn == 0x55 || nn == 0x65)
+                    addressReg = true;
+                break;
+        }
+    }
+
+    //the most used registers, the lowest first among equally used
+    while(count < RT_CONVENTION_REGS)
+    {
+        int most = 0;
+
+        for(int i = 1; i < C8_GPREG_COUNT; i++)
+            if(uses[i] > uses[most])
+                most = i;
+
+        if(uses[most] == 0)
+            break;
+
+        c8regs[count++] = most;
+        uses[most] = 0;
+    }
 
-    return !mReadyToTranslate;
+    tracker.createConvention(c8regs, count, addressReg, mConvention);
+    tracker.loadConvention(mConvention);
+
+    mResident = true;
+    mResidentIndex = codegen.getIndex();
+    mBlockAddress = first->address;
 }
 
 /**
- * Sets the codegeneration-function for an IR-node.
- * If the node is in an IF statement a forced return
- * will be generated.
+ * Get the convention of the block at an address, if the
+ * block is being translated or is in the cache
  *
  * PARAMS
- * rNode         ref. to IR-node (decoded node)
- * pfnGenOpcode  func. pointer to codegeneration routin for that node
+ * address      emulated address of the block
+ * rConvention  the convention is stored here
+ *
+ * RETURNS
+ * true if the block has a convention, otherwise false
  */
-inline void Translator::setOpcodeFunction(DecodedOpcode &rNode, const TranslatorMemberFnGenerate_t pfnGenOpcode)
+bool Translator::findConvention(const uint32_t address, RegConvention_t &rConvention) const
 {
-    if(!mCondition)
-        rNode.pfnGenOpcode = pfnGenOpcode;
-    else
-        rNode.pfnGenOpcode = &Translator::generateReturn;
+    if(mResident && address == mBlockAddress)
+    {
+        rConvention = mConvention;
+        return true;
+    }
+
+    const CodeBlock *const pBlock = address < C8_MEMSIZE ? pmCache->getBlock(address) : NULL;
+
+    if(pBlock == NULL || pBlock->residentOffset < 0)
+        return false;
+
+    rConvention = pBlock->convention;
+    return true;
 }
 
 /**
- * Generates code to force return
+ * Generates a block exit to a known address.
+ * The exit is linked directly to the target block
+ * by the translation cache. Modified registers must
+ * be saved before, dirty registers are restored.
  *
  * PARAMS
- * rNode    ref. to IR-node (decoded node)
+ * address  emulated address to continue at
  */
-void Translator::generateReturn(const DecodedOpcode &rNode)
+void Translator::generateExit(const uint32_t address)
 {
-    if(!rNode.inCondition)
-        tracker.saveRegisters();
+    CodeBlock::Exit exit;
+    const bool resident = mResident && findConvention(address, exit.convention);
+
+    //code after a conditional exit continues with the registers as they were
+    const RegTracker state = tracker;
+
+    if(resident)
+        tracker.matchConvention(exit.convention);
+
+    generateBudget();
+
+    //the registers stay when the target is linked in the same convention,
+    //popping the dirty registers leaves the flags of the budget
+    if(resident)
+    {
+        codegen.jle_i8(5);
+
+        exit.target = address;
+        exit.offset = codegen.getIndex() + 1;
+        exit.type = CB_EXIT_RESIDENT;
+        mExits.push_back(exit);
+
+        codegen.jmp_i32(0);
+    }
 
     tracker.restoreDirty();
 
-    codegen.mov_r32i32(X86_REG_EAX, rNode.address);
+    //budget used up, skip the jump and return to the dispatcher
+    codegen.jle_i8(5);
+
+    if(address < C8_MEMSIZE)
+    {
+        exit.target = address;
+        exit.offset = codegen.getIndex() + 1;
+        exit.type = CB_EXIT_JUMP;
+        mExits.push_back(exit);
+    }
+
+    //not linked yet, jumps to next instruction
+    codegen.jmp_i32(0);
 
+    codegen.mov_r32i32(X86_REG_EAX, address);
     codegen.ret();
+
+    tracker = state;
 }
 
 /**
@@ -211,6 +1105,8 @@ void Translator::unknownOpcode(DecodedOpcode &rNode)
 {
     rNode.ignore = true;
     rNode.pfnGenOpcode = NULL;
+    rNode.inCondition = mCondition;
+    mNextOpAddress = rNode.address + C8_OPCODE_SIZE;
 }
 
 /**
@@ -224,26 +1120,93 @@ void Translator::decode00E0(DecodedOpcode &rNode)
     mNextOpAddress = rNode.address + C8_OPCODE_SIZE;
 }
 
+/**
+ * Generates a check after a store to emulated memory at
+ * address I. If the store can hit translated code it is
+ * recorded and the block returns to the dispatcher, which
+ * invalidates the blocks that were written to.
+ *
+ * PARAMS
+ * rNode    ref. to IR-node (decoded node)
+ * size     number of bytes stored
+ */
+void Translator::generateWriteCheck(const DecodedOpcode &rNode, const uint32_t size)
+{
+    const int ra = tracker.allocRegC16();
+    const Label_t clean = codegen.newLabel();
+
+    tracker.saveRegisters();
+    tracker.dirtyRegX32(tracker.REG_TMP);
+
+    //stores to data only memory pass with a single check
+    codegen.mov_r32r32(tracker.REG_TMP, ra);
+    codegen.shr_r32i8(tracker.REG_TMP, CACHE_GRANULE_SHIFT);
+    codegen.and_r32i32(tracker.REG_TMP, CACHE_GRANULE_COUNT - 1);
+    codegen.cmp_m8i8_d32(tracker.REG_TMP, 0, mCodeMapAddr);
+    codegen.jz(clean);
+
+    codegen.mov_r32i32(tracker.REG_TMP, mPendingWriteAddr);
+    codegen.mov_m32r32(tracker.REG_TMP, ra);
+    codegen.mov_m32i32_d8(tracker.REG_TMP, size, 4);
+    generateBudget();
+    tracker.restoreDirty();
+    codegen.mov_r32i32(X86_REG_EAX, rNode.address + C8_OPCODE_SIZE);
+    codegen.ret();
+
+    codegen.insertLabel(clean);
+}
+
+/**
+ * Generates a jump past an access to a byte of emulated
+ * memory when the byte is past the end of memory. Such
+ * bytes are read as 0 and stores to them are dropped.
+ *
+ * PARAMS
+ * ra       x86 register holding the host address of the byte
+ * outside  label jumped to when the byte is outside of memory
+ */
+void Translator::generateBoundsCheck(const int ra, const Label_t outside)
+{
+    //the last byte is compared, the end of memory can be in another region
+    codegen.cmp_r32i32(ra, mC8_memBaseAddr + C8_MEMSIZE - 1);
+    codegen.ja(outside);
+}
+
 /**
  * Generate 00E0
  * Clear the screen
  */
 void Translator::generate00E0(const DecodedOpcode &rNode)
 {
-    const Label_t loop = codegen.newLabel();
     const int r32 = tracker.temporaryRegX32();
 
     tracker.dirtyRegX32(r32);
 
+#ifdef X86_SSE2
+    //the stores of screenClear, written inline (see Screen.h). 16 bytes per
+    //store, the pointer is in the middle of the screen so all reach it with a disp8
+    const int half = SCREEN_SIZE / 2;
+
+    codegen.mov_r32i32(r32, mC8_screenBaseAddr + half);
+    codegen.pxor_x128x128(X86_REG_XMM0, X86_REG_XMM0);
+
+    for(int d = -half; d < half; d+=16)
+        codegen.movdqu_m128x128_d8(r32, X86_REG_XMM0, d);
+#else
+    const Label_t loop = codegen.newLabel();
+    //a quarter of the screen is cleared in each iteration
+    const int step = SCREEN_SIZE / 4;
+
     codegen.mov_r32i32(r32, mC8_screenBaseAddr);
 
     codegen.insertLabel(loop);
-        for(int d = 0; d < C8_RES_WIDTH; d+=4)
+        for(int d = 0; d < step; d+=4)
             codegen.mov_m32i32_d8(r32, C8_PIXEL_OFF, d);
 
-        codegen.add_r32i32(r32, C8_RES_WIDTH);
-    codegen.cmp_r32i32(r32, mC8_screenBaseAddr + C8_RES_HEIGHT * C8_RES_WIDTH);
+        codegen.add_r32i32(r32, step);
+    codegen.cmp_r32i32(r32, mC8_screenBaseAddr + SCREEN_SIZE);
     codegen.jnz(loop);
+#endif
 
     codegen.mov_r32i32(r32, mC8_newFrameAddr);
     codegen.mov_m32i32(r32, NEW_FRAME);
@@ -270,6 +1233,7 @@ void Translator::generate00EE(const DecodedOpcode &rNode)
     if(!rNode.inCondition)
         tracker.saveRegisters();
 
+    const Label_t miss = codegen.newLabel();
     bool pop = false;
 
     if(!tracker.isDirtyX32(tracker.REG_TMP))
@@ -282,13 +1246,24 @@ void Translator::generate00EE(const DecodedOpcode &rNode)
     codegen.mov_r32m32(X86_REG_EAX, tracker.REG_TMP);
     codegen.sub_r32i32(X86_REG_EAX, 4);
     codegen.mov_m32r32(tracker.REG_TMP, X86_REG_EAX);
-    codegen.mov_r32m32(X86_REG_EAX, X86_REG_EAX);
 
     if(pop)
         codegen.pop_r32(tracker.REG_TMP);
 
+    generateBudget();
+    codegen.jle(miss);
+
+    //jump straight to the predicted return code if there is one
+    codegen.cmp_m32i8_d8(X86_REG_EAX, 0, PREDICTION_OFFSET);
+    codegen.jz(miss);
+    codegen.mov_r32m32_d8(X86_REG_EAX, X86_REG_EAX, PREDICTION_OFFSET);
     tracker.restoreDirty();
+    codegen.jmp_r32(X86_REG_EAX);
 
+    //budget used up or no prediction, return to the dispatcher
+    codegen.insertLabel(miss);
+    codegen.mov_r32m32(X86_REG_EAX, X86_REG_EAX);
+    tracker.restoreDirty();
     codegen.ret();
 
     /*if(!mCondition)
@@ -321,14 +1296,14 @@ void Translator::decode1NNN(DecodedOpcode &rNode)
  */
 void Translator::generate1NNN(const DecodedOpcode &rNode)
 {
+    //the trace continues at the target in the same block
+    if(rNode.inlineJump)
+        return;
+
     if(!rNode.inCondition)
         tracker.saveRegisters();
 
-    tracker.restoreDirty();
-
-    codegen.mov_r32i32(X86_REG_EAX, rNode.arg3);
-
-    codegen.ret();
+    generateExit(rNode.arg3);
 }
 
 /**
@@ -353,6 +1328,10 @@ void Translator::generate2NNN(const DecodedOpcode &rNode)
     if(!rNode.inCondition)
         tracker.saveRegisters();
 
+    //registers in EAX are lost
+    tracker.deallocRegX8(X86_REG_AL);
+    tracker.deallocRegX8(X86_REG_AH);
+
     bool pop = false;
 
     if(!tracker.isDirtyX32(tracker.REG_TMP))
@@ -364,17 +1343,29 @@ void Translator::generate2NNN(const DecodedOpcode &rNode)
     codegen.mov_r32i32(tracker.REG_TMP, mC8_stackPointerAddr);
     codegen.mov_r32m32(X86_REG_EAX, tracker.REG_TMP);
     codegen.mov_m32i32(X86_REG_EAX, rNode.address + C8_OPCODE_SIZE);
+
+    if(rNode.address + C8_OPCODE_SIZE < C8_MEMSIZE)
+    {
+        CodeBlock::Exit exit;
+        exit.target = rNode.address + C8_OPCODE_SIZE;
+        exit.offset = codegen.getIndex() + 3;
+        exit.type = CB_EXIT_ADDRESS;
+        mExits.push_back(exit);
+    }
+
+    //predicted return code, linked by the translation cache
+    codegen.mov_m32i32_d8(X86_REG_EAX, 0, PREDICTION_OFFSET);
     codegen.add_r32i32(X86_REG_EAX, 4);
     codegen.mov_m32r32(tracker.REG_TMP, X86_REG_EAX);
 
     if(pop)
         codegen.pop_r32(tracker.REG_TMP);
 
-    tracker.restoreDirty();
-
-    codegen.mov_r32i32(X86_REG_EAX, rNode.arg3);
+    //the trace continues in the subroutine in the same block
+    if(rNode.inlineJump)
+        return;
 
-    codegen.ret();
+    generateExit(rNode.arg3);
 
 
     /*const uint32_t retval = ((rNode.address + C8_OPCODE_SIZE) << 16) | rNode.arg3;
@@ -416,6 +1407,15 @@ void Translator::decode3XNN(DecodedOpcode &rNode)
 void Translator::generate3XNN(const DecodedOpcode &rNode)
 {
     mLabelCondBranchDest = codegen.newLabel();
+
+    //the opcode before set VF from the carry flag, or VX is known
+    if(rNode.carrySkip || rNode.folded)
+    {
+        tracker.saveRegisters();
+        generateSkip(rNode, rNode.skipIfCarry);
+        return;
+    }
+
     const int r = tracker.allocRegX8(rNode.arg1);
     tracker.saveRegisters();
 
@@ -424,7 +1424,7 @@ void Translator::generate3XNN(const DecodedOpcode &rNode)
     else
         codegen.cmp_r8i8(r, rNode.arg2);
 
-    codegen.jz(mLabelCondBranchDest);
+    generateSkip(rNode, true);
 }
 
 /**
@@ -455,6 +1455,15 @@ void Translator::decode4XNN(DecodedOpcode &rNode)
 void Translator::generate4XNN(const DecodedOpcode &rNode)
 {
     mLabelCondBranchDest = codegen.newLabel();
+
+    //the opcode before set VF from the carry flag, or VX is known
+    if(rNode.carrySkip || rNode.folded)
+    {
+        tracker.saveRegisters();
+        generateSkip(rNode, rNode.skipIfCarry);
+        return;
+    }
+
     const int r = tracker.allocRegX8(rNode.arg1);
     tracker.saveRegisters();
 
@@ -463,7 +1472,7 @@ void Translator::generate4XNN(const DecodedOpcode &rNode)
     else
         codegen.cmp_r8i8(r, rNode.arg2);
 
-    codegen.jnz(mLabelCondBranchDest);
+    generateSkip(rNode, false);
 }
 
 /**
@@ -495,12 +1504,20 @@ void Translator::generate5XY0(const DecodedOpcode &rNode)
 {
     mLabelCondBranchDest = codegen.newLabel();
 
+    //VX and VY are known
+    if(rNode.folded)
+    {
+        tracker.saveRegisters();
+        generateSkip(rNode, true);
+        return;
+    }
+
     const int r1 = tracker.allocRegX8(rNode.arg1);
     const int r2 = tracker.allocRegX8(rNode.arg2);
     tracker.saveRegisters();
 
     codegen.cmp_r8r8(r1, r2);
-    codegen.jz(mLabelCondBranchDest);
+    generateSkip(rNode, true);
 }
 
 /**
@@ -523,6 +1540,9 @@ void Translator::decode6XNN(DecodedOpcode &rNode)
  */
 void Translator::generate6XNN(const DecodedOpcode &rNode)
 {
+    if(generateConstant(rNode))
+        return;
+
     const int r = tracker.allocRegX8(rNode.arg1, false);
 
     codegen.mov_r8i8(r, rNode.arg2);
@@ -550,6 +1570,9 @@ void Translator::decode7XNN(DecodedOpcode &rNode)
  */
 void Translator::generate7XNN(const DecodedOpcode &rNode)
 {
+    if(generateConstant(rNode))
+        return;
+
     const int r = tracker.allocRegX8(rNode.arg1);
 
     codegen.add_r8i8(r, rNode.arg2);
@@ -577,8 +1600,12 @@ void Translator::decode8XY0(DecodedOpcode &rNode)
  */
 void Translator::generate8XY0(const DecodedOpcode &rNode)
 {
-    const int r1 = tracker.allocRegX8(rNode.arg1, false);
+    if(generateConstant(rNode))
+        return;
+
+    //VY is loaded first, it is also VX when X == Y
     const int r2 = tracker.allocRegX8(rNode.arg2);
+    const int r1 = tracker.allocRegX8(rNode.arg1, false);
 
     codegen.mov_r8r8(r1, r2);
 
@@ -605,6 +1632,9 @@ void Translator::decode8XY1(DecodedOpcode &rNode)
  */
 void Translator::generate8XY1(const DecodedOpcode &rNode)
 {
+    if(generateConstant(rNode))
+        return;
+
     const int r1 = tracker.allocRegX8(rNode.arg1);
     const int r2 = tracker.allocRegX8(rNode.arg2);
 
@@ -633,6 +1663,9 @@ void Translator::decode8XY2(DecodedOpcode &rNode)
  */
 void Translator::generate8XY2(const DecodedOpcode &rNode)
 {
+    if(generateConstant(rNode))
+        return;
+
     const int r1 = tracker.allocRegX8(rNode.arg1);
     const int r2 = tracker.allocRegX8(rNode.arg2);
 
@@ -661,6 +1694,9 @@ void Translator::decode8XY3(DecodedOpcode &rNode)
  */
 void Translator::generate8XY3(const DecodedOpcode &rNode)
 {
+    if(generateConstant(rNode))
+        return;
+
     const int r1 = tracker.allocRegX8(rNode.arg1);
     const int r2 = tracker.allocRegX8(rNode.arg2);
 
@@ -689,15 +1725,16 @@ void Translator::decode8XY4(DecodedOpcode &rNode)
  */
 void Translator::generate8XY4(const DecodedOpcode &rNode)
 {
-    const int r3 = tracker.allocRegX8(C8_FLAG_REG, false);
+    if(generateConstant(rNode))
+        return;
+
     const int r1 = tracker.allocRegX8(rNode.arg1);
     const int r2 = tracker.allocRegX8(rNode.arg2);
 
     codegen.add_r8r8(r1,r2);
-    codegen.setc_r8(r3);
-
     tracker.modifiedRegX8(r1);
-    tracker.modifiedRegX8(r3);
+
+    generateFlag(rNode, false);
 }
 
 /**
@@ -720,15 +1757,16 @@ void Translator::decode8XY5(DecodedOpcode &rNode)
  */
 void Translator::generate8XY5(const DecodedOpcode &rNode)
 {
-    const int r3 = tracker.allocRegX8(C8_FLAG_REG, false);
+    if(generateConstant(rNode))
+        return;
+
     const int r1 = tracker.allocRegX8(rNode.arg1);
     const int r2 = tracker.allocRegX8(rNode.arg2);
 
     codegen.sub_r8r8(r1,r2);
-    codegen.setnc_r8(r3);
-
     tracker.modifiedRegX8(r1);
-    tracker.modifiedRegX8(r3);
+
+    generateFlag(rNode, true);
 }
 
 /**
@@ -752,14 +1790,15 @@ void Translator::decode8XY6(DecodedOpcode &rNode)
  */
 void Translator::generate8XY6(const DecodedOpcode &rNode)
 {
-    const int r2 = tracker.allocRegX8(C8_FLAG_REG, false);
+    if(generateConstant(rNode))
+        return;
+
     const int r1 = tracker.allocRegX8(rNode.arg1);
 
     codegen.shr1_r8(r1);
-    codegen.setc_r8(r2);
-
     tracker.modifiedRegX8(r1);
-    tracker.modifiedRegX8(r2);
+
+    generateFlag(rNode, false);
 }
 
 /**
@@ -784,13 +1823,46 @@ void Translator::decode8XY7(DecodedOpcode &rNode)
  */
 void Translator::generate8XY7(const DecodedOpcode &rNode)
 {
-    const int r3 = tracker.allocRegX8(C8_FLAG_REG, false);
+    if(generateConstant(rNode))
+        return;
+
     const int r1 = tracker.allocRegX8(rNode.arg1);
     const int r2 = tracker.allocRegX8(rNode.arg2);
 
-    codegen.mov_r8r8(r3, r2);
-    codegen.sub_r8r8(r3,r1);
-    codegen.mov_r8r8(r1,r3);
+    //without VF the difference is made in place
+    if(!rNode.flagLive && !rNode.carryUsed)
+    {
+        if(r1 == r2)
+            codegen.mov_r8i8(r1, 0);
+        else
+        {
+            codegen.neg_r8(r1);
+            codegen.add_r8r8(r1,r2);
+        }
+
+        tracker.modifiedRegX8(r1);
+        return;
+    }
+
+    const int r3 = tracker.allocRegX8(C8_FLAG_REG, false);
+
+    if(r3 == r1)
+    {
+        //VX is VF, only the flag is kept
+        codegen.cmp_r8r8(r2,r1);
+    }
+    else if(r3 == r2)
+    {
+        codegen.sub_r8r8(r2,r1);
+        codegen.mov_r8r8(r1,r2);
+    }
+    else
+    {
+        codegen.mov_r8r8(r3, r2);
+        codegen.sub_r8r8(r3,r1);
+        codegen.mov_r8r8(r1,r3);
+    }
+
     codegen.setnc_r8(r3);
 
     tracker.modifiedRegX8(r1);
@@ -818,14 +1890,15 @@ void Translator::decode8XYE(DecodedOpcode &rNode)
  */
 void Translator::generate8XYE(const DecodedOpcode &rNode)
 {
-    const int r2 = tracker.allocRegX8(C8_FLAG_REG, false);
+    if(generateConstant(rNode))
+        return;
+
     const int r1 = tracker.allocRegX8(rNode.arg1);
 
     codegen.shl1_r8(r1);
-    codegen.setc_r8(r2);
-
     tracker.modifiedRegX8(r1);
-    tracker.modifiedRegX8(r2);
+
+    generateFlag(rNode, false);
 }
 
 /**
@@ -857,12 +1930,20 @@ void Translator::generate9XY0(const DecodedOpcode &rNode)
 {
     mLabelCondBranchDest = codegen.newLabel();
 
+    //VX and VY are known
+    if(rNode.folded)
+    {
+        tracker.saveRegisters();
+        generateSkip(rNode, false);
+        return;
+    }
+
     const int r1 = tracker.allocRegX8(rNode.arg1);
     const int r2 = tracker.allocRegX8(rNode.arg2);
     tracker.saveRegisters();
 
     codegen.cmp_r8r8(r1, r2);
-    codegen.jnz(mLabelCondBranchDest);
+    generateSkip(rNode, false);
 }
 
 /**
@@ -884,6 +1965,9 @@ void Translator::decodeANNN(DecodedOpcode &rNode)
  */
 void Translator::generateANNN(const DecodedOpcode &rNode)
 {
+	if(!rNode.resultLive)
+		return;
+
 	const int r = tracker.allocRegC16(false);
 
 	codegen.mov_r32i32(r, rNode.arg3);
@@ -897,7 +1981,7 @@ void Translator::generateANNN(const DecodedOpcode &rNode)
  */
 void Translator::decodeBNNN(DecodedOpcode &rNode)
 {
-    //rNode.arg1 = 0;
+    rNode.arg1 = 0;
 	rNode.arg3 = rNode.opcode & 0x0FFF;
 	rNode.pfnGenOpcode = &Translator::generateBNNN;
     rNode.inCondition = mCondition;
@@ -911,26 +1995,14 @@ void Translator::decodeBNNN(DecodedOpcode &rNode)
  */
 void Translator::generateBNNN(const DecodedOpcode &rNode)
 {
-    if(rNode.inCondition)
-    {
-        if(tracker.isAllocatedRegC8(rNode.arg1))
-        {
-            const int r = tracker.allocRegX8(rNode.arg1);
-
-            if(r != X86_REG_AL)
-                codegen.mov_r8r8(X86_REG_AL, r);
-        }
-        else
-        {
-            codegen.mov_r32i32(X86_REG_EAX, mC8_regBaseAddr);
-            codegen.mov_r8m8(X86_REG_AL, X86_REG_EAX);
-        }
-    }
-    else
-    {
+    if(!rNode.inCondition)
         tracker.saveRegisters();
-        tracker.allocRegX8(X86_REG_AL, rNode.arg1);
-    }
+
+    generateBudget();
+
+    //registers are saved, V0 is read from memory
+    codegen.mov_r32i32(X86_REG_EAX, mC8_regBaseAddr + rNode.arg1);
+    codegen.mov_r8m8(X86_REG_AL, X86_REG_EAX);
 
     tracker.restoreDirty();
     codegen.movzx_r32r8(X86_REG_EAX, X86_REG_AL);
@@ -1042,26 +2114,37 @@ void Translator::decodeDXYN(DecodedOpcode &rNode)
  */
 void Translator::generateDXYN(const DecodedOpcode &rNode)
 {
-    const int rf = tracker.allocRegX8(X86_REG_AL, C8_FLAG_REG, false);
+    const int rows = rNode.arg3 != 0 ? rNode.arg3 : 1;
+    //a sprite at a known I is read now, unless the rom stores there
+    const bool spriteKnown = rNode.addressRegKnown && rNode.addressRegValue + rows <= C8_MEMSIZE &&
+                             !pmCache->isStored(rNode.addressRegValue, rows);
+    const bool loop = !spriteKnown && rNode.arg3 != 0;
+
+    //the coordinates are allocated before VF, allocating a register that
+    //is already held elsewhere moves it. VF is written last, when it is
+    //a coordinate the flag is kept in AL until the sprite is drawn.
     const int rx = tracker.allocRegX8(X86_REG_AH, rNode.arg1);
-    const int ry = tracker.allocRegX8(X86_REG_BL, rNode.arg2);
-    const int ra = tracker.allocRegC16();
+    const int ry = rNode.arg2 == rNode.arg1 ? rx : tracker.allocRegX8(X86_REG_BL, rNode.arg2);
+    const bool flagCoord = rNode.arg1 == C8_FLAG_REG || rNode.arg2 == C8_FLAG_REG;
+
+    if(flagCoord)
+        tracker.deallocRegX8(X86_REG_AL);
 
-    const int rtmp32_x = X86_REG_ECX;
-    const int rtmp32_y = tracker.REG_TMP;
-    const int rtmp8_cmp = X86_REG_DL;
+    const int rf = flagCoord ? X86_REG_AL : tracker.allocRegX8(X86_REG_AL, C8_FLAG_REG, false);
+    //a known I is added to the sprite address as an immediate
+    const int ra = rNode.addressRegKnown ? -1 : tracker.allocRegC16();
+    const uint32_t sprite = rNode.addressRegKnown ? rNode.addressRegValue : 0;
     const int rtmp8_c = X86_REG_BH;
-    const int rtmp8_b = X86_REG_DH;
 
-    tracker.dirtyRegX32(rtmp32_y);
-    tracker.dirtyRegX32(rtmp32_x);
-    tracker.dirtyRegX8(rtmp8_b);
-    tracker.dirtyRegX8(rtmp8_cmp);
+    tracker.dirtyRegX32(tracker.REG_TMP);
+    tracker.dirtyRegX32(X86_REG_ECX);
+    tracker.dirtyRegX32(X86_REG_EDX);
 
-    if(rNode.arg3 != 0)
+    if(loop)
         tracker.dirtyRegX8(rtmp8_c);
 
     const Label_t loop1 = codegen.newLabel();
+    const Label_t outside = codegen.newLabel();
 
     if(tracker.isAllocatedRegX8(X86_REG_DL) || tracker.isAllocatedRegX8(X86_REG_DH))
         codegen.push_r32(X86_REG_EDX);
@@ -1069,63 +2152,75 @@ void Translator::generateDXYN(const DecodedOpcode &rNode)
     if(tracker.isAllocatedRegX8(X86_REG_CL) || tracker.isAllocatedRegX8(X86_REG_CH))
         codegen.push_r32(X86_REG_ECX);
 
-    if(tracker.isAllocatedRegX8(X86_REG_BH) && rNode.arg3 != 0)
+    if(tracker.isAllocatedRegX8(X86_REG_BH) && loop)
         codegen.push_r32(X86_REG_EBX);
 
     codegen.xor_r8r8(rf, rf);
 
-    if(rNode.arg3 != 0)
+    if(spriteKnown)
     {
-        codegen.xor_r8r8(rtmp8_c, rtmp8_c);
-        codegen.insertLabel(loop1);
-        codegen.movzx_r32r8(tracker.REG_TMP, rtmp8_c);
-        codegen.add_r32r32(tracker.REG_TMP, ra);
-    }
-    else
-        codegen.mov_r32r32(tracker.REG_TMP, ra);
+        const uint8_t *const pSprite = (const uint8_t *) (mC8_memBaseAddr + sprite);
+        CodeBlock::Data data;
 
-    codegen.add_r32i32(tracker.REG_TMP, mC8_memBaseAddr);
-    codegen.mov_r8m8(rtmp8_b, tracker.REG_TMP);
+        //stores to the sprite invalidate the block
+        data.address = rNode.addressRegValue;
+        data.size = rows;
+        mData.push_back(data);
 
-    for(int i = 0; i < 8; i++)
-    {
-        const Label_t zero = codegen.newLabel();
-        const Label_t one = codegen.newLabel();
-
-        codegen.movzx_r32r8(rtmp32_y, ry);
-        codegen.movzx_r32r8(rtmp32_x, rx);
-        codegen.and_r32i32(rtmp32_y, 0x1F);    //reg mod 32
-        codegen.and_r32i32(rtmp32_x, 0x3F);    //reg mod 64
-        codegen.shl_r32i8(rtmp32_y, 6);        //reg * 64
-        codegen.add_r32r32(rtmp32_y, rtmp32_x);
-        codegen.add_r32i32(tracker.REG_TMP, mC8_screenBaseAddr);
-        codegen.shl1_r8(rtmp8_b);
-        codegen.jnc(zero);
-        codegen.mov_r8m8(rtmp8_cmp, tracker.REG_TMP);
-        codegen.test_r8r8(rtmp8_cmp, rtmp8_cmp);
-        codegen.jz(one);
-        codegen.or_r8i8(rf, 1);
-        codegen.insertLabel(one);
-        codegen.xor_m8i8(tracker.REG_TMP, C8_PIXEL_ON);
-        codegen.insertLabel(zero);
-        codegen.inc_r8(rx);
+        //rows without pixels are not drawn
+        for(int row = 0; row < rows; row++)
+            if(pSprite[row] != 0)
+            {
+                //shifted here, an immediate can look like an address to relocate
+                codegen.mov_r32i32(X86_REG_EDX, pSprite[row]);
+                codegen.shl_r32i8(X86_REG_EDX, 24);
+                generateSpriteRow(rf, rx, ry, -1, row);
+            }
     }
+    else
+    {
+        if(loop)
+        {
+            codegen.xor_r8r8(rtmp8_c, rtmp8_c);
+            codegen.insertLabel(loop1);
+            codegen.movzx_r32r8(tracker.REG_TMP, rtmp8_c);
 
-    codegen.sub_r8i8(rx, 8);
+            if(ra >= 0)
+                codegen.add_r32r32(tracker.REG_TMP, ra);
+        }
+        else if(ra >= 0)
+            codegen.mov_r32r32(tracker.REG_TMP, ra);
 
-    if(rNode.arg3 != 0)
-    {
-        codegen.inc_r8(ry);
-        codegen.inc_r8(rtmp8_c);
-        codegen.cmp_r8i8(rtmp8_c, rNode.arg3);
-        codegen.jnz(loop1);
-        codegen.sub_r8r8(ry, rtmp8_c);
+        if(loop || ra >= 0)
+        {
+            if(sprite != 0)
+                codegen.add_r32i32(tracker.REG_TMP, sprite);
+        }
+        else
+            codegen.mov_r32i32(tracker.REG_TMP, sprite);
+
+        //rows past the end of memory are empty
+        codegen.xor_r32r32(X86_REG_EDX, X86_REG_EDX);
+        codegen.cmp_r32i32(tracker.REG_TMP, C8_MEMSIZE);
+        codegen.jnc(outside);
+        codegen.add_r32i32(tracker.REG_TMP, mC8_memBaseAddr);
+        codegen.movzx_r32m8(X86_REG_EDX, tracker.REG_TMP);
+        codegen.shl_r32i8(X86_REG_EDX, 24);
+        codegen.insertLabel(outside);
+        generateSpriteRow(rf, rx, ry, loop ? rtmp8_c : -1, 0);
+
+        if(loop)
+        {
+            codegen.inc_r8(rtmp8_c);
+            codegen.cmp_r8i8(rtmp8_c, rNode.arg3);
+            codegen.jnz(loop1);
+        }
     }
 
     codegen.mov_r32i32(tracker.REG_TMP, mC8_newFrameAddr);
     codegen.mov_m32i32(tracker.REG_TMP, NEW_FRAME);
 
-    if(tracker.isAllocatedRegX8(X86_REG_BH) && rNode.arg3 != 0)
+    if(tracker.isAllocatedRegX8(X86_REG_BH) && loop)
         codegen.pop_r32(X86_REG_EBX);
 
     if(tracker.isAllocatedRegX8(X86_REG_CL) || tracker.isAllocatedRegX8(X86_REG_CH))
@@ -1134,7 +2229,81 @@ void Translator::generateDXYN(const DecodedOpcode &rNode)
     if(tracker.isAllocatedRegX8(X86_REG_DL) || tracker.isAllocatedRegX8(X86_REG_DH))
         codegen.pop_r32(X86_REG_EDX);
 
-    tracker.modifiedRegX8(rf);
+    if(flagCoord)
+    {
+        const int r = rNode.arg1 == C8_FLAG_REG ? rx : ry;
+
+        codegen.mov_r8r8(r, rf);
+        tracker.modifiedRegX8(r);
+    }
+    else
+        tracker.modifiedRegX8(rf);
+}
+
+/**
+ * Generates the drawing of one sprite row. The row is shifted
+ * to VX over the two 32 bit halves of a screen row, the left
+ * half holds pixels 0-31 and is the high word of the row.
+ * Both halves are tested for a collision and XORed onto the screen.
+ * Uses EDX, ECX and REG_TMP.
+ *
+ * PARAMS
+ * rf       x86 register the collision flag is set in
+ * rx       x86 register holding VX
+ * ry       x86 register holding VY
+ * rrow     x86 register holding the row in a loop, -1 if there is none
+ * row      row of the sprite, drawn at VY + rrow + row
+ */
+void Translator::generateSpriteRow(const int rf, const int rx, const int ry, const int rrow, const int row)
+{
+    //EDX holds the sprite row in its highest byte
+    const int rtmp32_left = X86_REG_EDX;
+    const int rtmp32_right = tracker.REG_TMP;
+    const int rtmp32_line = X86_REG_ECX;
+    const int rtmp8_shift = X86_REG_CL;
+
+    const Label_t left = codegen.newLabel();
+    const Label_t leftclear = codegen.newLabel();
+    const Label_t rightclear = codegen.newLabel();
+
+    //shift the sprite row to x, the shifts only use x mod 32
+    codegen.xor_r32r32(rtmp32_right, rtmp32_right);
+    codegen.mov_r8r8(rtmp8_shift, rx);
+    codegen.shrd_r32r32cl(rtmp32_right, rtmp32_left);
+    codegen.shr_r32cl(rtmp32_left);
+
+    //from x = 32 the halves change places, which also wraps the row around
+    codegen.test_r8i8(rx, 32);
+    codegen.jz(left);
+    codegen.xchg_r32r32(rtmp32_left, rtmp32_right);
+    codegen.insertLabel(left);
+
+    if(rrow >= 0)
+    {
+        codegen.mov_r8r8(rtmp8_shift, ry);
+        codegen.add_r8r8(rtmp8_shift, rrow);
+        codegen.movzx_r32r8(rtmp32_line, rtmp8_shift);
+    }
+    else
+        codegen.movzx_r32r8(rtmp32_line, ry);
+
+    if(row != 0)
+        codegen.add_r32i32(rtmp32_line, row);
+
+    codegen.and_r32i32(rtmp32_line, 0x1F);     //reg mod 32
+    codegen.shl_r32i8(rtmp32_line, 3);         //reg * 8
+
+    codegen.test_m32r32_d32(rtmp32_line, rtmp32_left, mC8_screenBaseAddr + 4);
+    codegen.jz(leftclear);
+    codegen.or_r8i8(rf, 1);
+    codegen.insertLabel(leftclear);
+    codegen.test_m32r32_d32(rtmp32_line, rtmp32_right, mC8_screenBaseAddr);
+    codegen.jz(rightclear);
+    codegen.or_r8i8(rf, 1);
+    codegen.insertLabel(rightclear);
+
+    codegen.xor_m32r32_d32(rtmp32_line, rtmp32_left, mC8_screenBaseAddr + 4);
+    codegen.xor_m32r32_d32(rtmp32_line, rtmp32_right, mC8_screenBaseAddr);
 }
 
 /**
@@ -1197,7 +2366,7 @@ void Translator::generateEX9E(const DecodedOpcode &rNode)
     else
         codegen.cmp_m8i8(r32, 0);
 
-    codegen.jnz(mLabelCondBranchDest);
+    generateSkip(rNode, false);
 }
 
 /**
@@ -1260,7 +2429,7 @@ void Translator::generateEXA1(const DecodedOpcode &rNode)
     else
         codegen.cmp_m8i8(r32, 0);
 
-   codegen.jz(mLabelCondBranchDest);
+    generateSkip(rNode, true);
 }
 
 /**
@@ -1278,17 +2447,35 @@ void Translator::decodeFX07(DecodedOpcode &rNode)
 
 /**
  * Generate FX07
- * Sets VX to the value of the delay timer
+ * Sets VX to the value of the delay timer, the ticks
+ * left until its deadline or zero when it has passed
  */
 void Translator::generateFX07(const DecodedOpcode &rNode)
 {
     const int r8 = tracker.allocRegX8(rNode.arg1, false);
-    const int r32 = tracker.temporaryRegX32();
-
-    tracker.dirtyRegX32(r32);
-
-    codegen.mov_r32i32(r32, mC8_delaytimerAddr);
-    codegen.mov_r8m8(r8, r32);
+    //the value is computed in a register with a low byte that is not VX
+    const int rtmp32 = r8 == X86_REG_DL || r8 == X86_REG_DH ? X86_REG_ECX : X86_REG_EDX;
+    const int rtmp8 = rtmp32;
+    const bool save = tracker.isAllocatedRegX8(rtmp32) || tracker.isAllocatedRegX8(rtmp32 + 4);
+    const Label_t passed = codegen.newLabel();
+    const Label_t done = codegen.newLabel();
+
+    tracker.dirtyRegX32(rtmp32);
+
+    if(save)
+        codegen.push_r32(rtmp32);
+
+    codegen.mov_r32m32_d32(rtmp32, mC8_delaytimerAddr);
+    codegen.sub_r32m32_d32(rtmp32, mC8_clockAddr);
+    codegen.jle(passed);
+    codegen.mov_r8r8(r8, rtmp8);
+    codegen.jmp(done);
+    codegen.insertLabel(passed);
+    codegen.xor_r8r8(r8, r8);
+    codegen.insertLabel(done);
+
+    if(save)
+        codegen.pop_r32(rtmp32);
 
     tracker.modifiedRegX8(r8);
 }
@@ -1314,6 +2501,11 @@ void Translator::decodeFX0A(DecodedOpcode &rNode)
  */
 void Translator::generateFX0A(const DecodedOpcode &rNode)
 {
+    //VX is stored to memory, CL and CH are used for the keys
+    tracker.deallocRegC8(rNode.arg1);
+    tracker.deallocRegX8(X86_REG_CL);
+    tracker.deallocRegX8(X86_REG_CH);
+
     const int r32 = tracker.temporaryRegX32();
 
     tracker.dirtyRegX32(r32);
@@ -1333,9 +2525,7 @@ void Translator::generateFX0A(const DecodedOpcode &rNode)
     }
     //loop until i == 16
 
-    tracker.restoreDirty();
-    codegen.mov_r32i32(X86_REG_EAX, rNode.address);
-    codegen.ret();
+    generateExit(rNode.address);
 
     //PRESSED:
     codegen.insertLabel(lblPRESSED);
@@ -1343,10 +2533,7 @@ void Translator::generateFX0A(const DecodedOpcode &rNode)
     codegen.mov_r32i32(r32, mC8_regBaseAddr + rNode.arg1);
     codegen.mov_m8r8(r32, X86_REG_CL);
 
-    tracker.restoreDirty();
-    codegen.mov_r32i32(X86_REG_EAX, rNode.address + C8_OPCODE_SIZE);
-
-    codegen.ret();
+    generateExit(rNode.address + C8_OPCODE_SIZE);
 }
 
 /**
@@ -1373,8 +2560,10 @@ void Translator::generateFX15(const DecodedOpcode &rNode)
 
     tracker.dirtyRegX32(r32);
 
-    codegen.mov_r32i32(r32, mC8_delaytimerAddr);
-    codegen.mov_m8r8(r32, r8);
+    //the timer is set to a deadline VX ticks ahead of the clock
+    codegen.movzx_r32r8(r32, r8);
+    codegen.add_r32m32_d32(r32, mC8_clockAddr);
+    codegen.mov_m32r32_d32(mC8_delaytimerAddr, r32);
 }
 
 /**
@@ -1401,8 +2590,10 @@ void Translator::generateFX18(const DecodedOpcode &rNode)
 
     tracker.dirtyRegX32(r32);
 
-    codegen.mov_r32i32(r32, mC8_soundtimerAddr);
-    codegen.mov_m8r8(r32, r8);
+    //the timer is set to a deadline VX ticks ahead of the clock
+    codegen.movzx_r32r8(r32, r8);
+    codegen.add_r32m32_d32(r32, mC8_clockAddr);
+    codegen.mov_m32r32_d32(mC8_soundtimerAddr, r32);
 }
 
 /**
@@ -1424,6 +2615,18 @@ void Translator::decodeFX1E(DecodedOpcode &rNode)
  */
 void Translator::generateFX1E(const DecodedOpcode &rNode)
 {
+    //I and VX are known
+    if(rNode.folded)
+    {
+        if(rNode.resultLive)
+        {
+            codegen.mov_r32i32(tracker.allocRegC16(false), rNode.value);
+            tracker.modifiedRegC16();
+        }
+
+        return;
+    }
+
     const int r1 = tracker.allocRegC16();
     const int r2 = tracker.allocRegX8(rNode.arg1);
     const int r32 = tracker.temporaryRegX32();
@@ -1457,6 +2660,18 @@ void Translator::decodeFX29(DecodedOpcode &rNode)
  */
 void Translator::generateFX29(const DecodedOpcode &rNode)
 {
+    //VX is known
+    if(rNode.folded)
+    {
+        if(rNode.resultLive)
+        {
+            codegen.mov_r32i32(tracker.allocRegC16(false), rNode.value);
+            tracker.modifiedRegC16();
+        }
+
+        return;
+    }
+
     const int r1 = tracker.allocRegC16(false);
     const int r2 = tracker.allocRegX8(rNode.arg1);
     const int r32 = tracker.temporaryRegX32();
@@ -1515,25 +2730,37 @@ void Translator::generateFX33(const DecodedOpcode &rNode)
     else
         tracker.dirtyRegX8(r3);
 
+    const Label_t outside1 = codegen.newLabel();
+    const Label_t outside2 = codegen.newLabel();
+    const Label_t outside3 = codegen.newLabel();
+
     codegen.mov_r32r32(tracker.REG_TMP, X86_REG_EAX);
     codegen.add_r32i32(r2, mC8_memBaseAddr);
     codegen.xor_r8r8(X86_REG_AH, X86_REG_AH);
     codegen.mov_r8i8(r3, 100);
     codegen.div_r8(r3);
+    generateBoundsCheck(r2, outside1);
     codegen.mov_m8r8(r2, X86_REG_AL);
+    codegen.insertLabel(outside1);
     codegen.inc_r32(r2);
     codegen.mov_r8r8(X86_REG_AL, X86_REG_AH);
     codegen.xor_r8r8(X86_REG_AH, X86_REG_AH);
     codegen.mov_r8i8(r3, 10);
     codegen.div_r8(r3);
+    generateBoundsCheck(r2, outside2);
     codegen.mov_m8r8(r2, X86_REG_AL);
+    codegen.insertLabel(outside2);
     codegen.inc_r32(r2);
+    generateBoundsCheck(r2, outside3);
     codegen.mov_m8r8(r2, X86_REG_AH);
+    codegen.insertLabel(outside3);
     codegen.mov_r32r32(X86_REG_EAX, tracker.REG_TMP);
     codegen.sub_r32i32(r2, mC8_memBaseAddr + 2);
 
     if(!freetmp)
         codegen.pop_r32(X86_REG_ECX);
+
+    generateWriteCheck(rNode, 3);
 }
 
 /**
@@ -1555,16 +2782,32 @@ void Translator::decodeFX55(DecodedOpcode &rNode)
  */
 void Translator::generateFX55(const DecodedOpcode &rNode)
 {
-    const int ra = tracker.allocRegC16();
+    //a known I is not loaded, the address is set directly
+    const int ra = tracker.allocRegC16(!rNode.addressRegKnown);
+    int count = rNode.arg1 + 1;
 
-    codegen.add_r32i32(ra, mC8_memBaseAddr);
+    //stores past the end of memory are dropped, at a known I they are left out
+    if(rNode.addressRegKnown && rNode.addressRegValue + count > C8_MEMSIZE)
+        count = rNode.addressRegValue < C8_MEMSIZE ? C8_MEMSIZE - rNode.addressRegValue : 0;
 
-    for(int i = 0; i <= rNode.arg1; i++)
+    if(rNode.addressRegKnown)
+        codegen.mov_r32i32(ra, mC8_memBaseAddr + (count > 0 ? rNode.addressRegValue : 0));
+    else
+        codegen.add_r32i32(ra, mC8_memBaseAddr);
+
+    for(int i = 0; i < count; i++)
     {
+        const Label_t outside = codegen.newLabel();
+
         if(tracker.isAllocatedRegC8(i) || tracker.getNumberOfFreeX8Regs() > 0)
         {
             const int r = tracker.allocRegX8(i);
+
+            if(!rNode.addressRegKnown)
+                generateBoundsCheck(ra, outside);
+
             codegen.mov_m8r8(ra, r);
+            codegen.insertLabel(outside);
         }
         else
         {
@@ -1573,14 +2816,24 @@ void Translator::generateFX55(const DecodedOpcode &rNode)
             codegen.push_r32(X86_REG_EDX);
             codegen.mov_r32i32(tracker.REG_TMP, mC8_regBaseAddr + i);
             codegen.mov_r8m8(X86_REG_DL, tracker.REG_TMP);
+
+            if(!rNode.addressRegKnown)
+                generateBoundsCheck(ra, outside);
+
             codegen.mov_m8r8(ra, X86_REG_DL);
+            codegen.insertLabel(outside);
             codegen.pop_r32(X86_REG_EDX);
         }
 
         codegen.inc_r32(ra);
     }
 
-    codegen.sub_r32i32(ra, rNode.arg1 + mC8_memBaseAddr + 1);
+    if(rNode.addressRegKnown)
+        codegen.mov_r32i32(ra, rNode.addressRegValue);
+    else
+        codegen.sub_r32i32(ra, rNode.arg1 + mC8_memBaseAddr + 1);
+
+    generateWriteCheck(rNode, rNode.arg1 + 1);
 }
 
 /**
@@ -1602,16 +2855,39 @@ void Translator::decodeFX65(DecodedOpcode &rNode)
  */
 void Translator::generateFX65(const DecodedOpcode &rNode)
 {
-    const int ra = tracker.allocRegC16();
+    //a known I is not loaded, the address is set directly
+    const int ra = tracker.allocRegC16(!rNode.addressRegKnown);
+    int count = rNode.arg1 + 1;
 
-    codegen.add_r32i32(ra, mC8_memBaseAddr);
+    //bytes past the end of memory are read as 0, at a known I they are set directly
+    if(rNode.addressRegKnown && rNode.addressRegValue + count > C8_MEMSIZE)
+        count = rNode.addressRegValue < C8_MEMSIZE ? C8_MEMSIZE - rNode.addressRegValue : 0;
+
+    if(rNode.addressRegKnown)
+        codegen.mov_r32i32(ra, mC8_memBaseAddr + (count > 0 ? rNode.addressRegValue : 0));
+    else
+        codegen.add_r32i32(ra, mC8_memBaseAddr);
 
     for(int i = 0; i <= rNode.arg1; i++)
     {
+        const Label_t outside = codegen.newLabel();
+
         if(tracker.isAllocatedRegC8(i) || tracker.getNumberOfFreeX8Regs() > 0)
         {
             const int r = tracker.allocRegX8(i, false);
-            codegen.mov_r8m8(r, ra);
+
+            if(i >= count)
+                codegen.xor_r8r8(r, r);
+            else if(!rNode.addressRegKnown)
+            {
+                codegen.xor_r8r8(r, r);
+                generateBoundsCheck(ra, outside);
+                codegen.mov_r8m8(r, ra);
+                codegen.insertLabel(outside);
+            }
+            else
+                codegen.mov_r8m8(r, ra);
+
             tracker.modifiedRegX8(r);
         }
         else
@@ -1620,7 +2896,19 @@ void Translator::generateFX65(const DecodedOpcode &rNode)
 
             codegen.push_r32(X86_REG_EDX);
             codegen.mov_r32i32(tracker.REG_TMP, mC8_regBaseAddr + i);
-            codegen.mov_r8m8(X86_REG_DL, ra);
+
+            if(i >= count)
+                codegen.xor_r8r8(X86_REG_DL, X86_REG_DL);
+            else if(!rNode.addressRegKnown)
+            {
+                codegen.xor_r8r8(X86_REG_DL, X86_REG_DL);
+                generateBoundsCheck(ra, outside);
+                codegen.mov_r8m8(X86_REG_DL, ra);
+                codegen.insertLabel(outside);
+            }
+            else
+                codegen.mov_r8m8(X86_REG_DL, ra);
+
             codegen.mov_m8r8(tracker.REG_TMP, X86_REG_DL);
             codegen.pop_r32(X86_REG_EDX);
         }
@@ -1628,7 +2916,10 @@ void Translator::generateFX65(const DecodedOpcode &rNode)
         codegen.inc_r32(ra);
     }
 
-    codegen.sub_r32i32(ra, rNode.arg1 + mC8_memBaseAddr + 1);
+    if(rNode.addressRegKnown)
+        codegen.mov_r32i32(ra, rNode.addressRegValue);
+    else
+        codegen.sub_r32i32(ra, rNode.arg1 + mC8_memBaseAddr + 1);
 }
 
 /**
@@ -1717,29 +3008,65 @@ inline void Translator::decode(DecodedOpcode &rNode)
  * c8_memArray          memory
  * c8_screendata        screen
  * pC8_stackPointer     stackpointer
+ * pCache               cache that blocks will be inserted into
  */
 Translator::Translator(uint8_t c8_regArray[C8_GPREG_COUNT],
                        uint32_t *const pC8_seedRngAddr,
                        uint32_t *const pC8_addressReg,
-                       uint8_t *const pC8_delaytimer,
-                       uint8_t *const pC8_soundtimer,
+                       uint32_t *const pC8_delaytimer,
+                       uint32_t *const pC8_soundtimer,
+                       uint32_t *const pC8_clock,
                        uint32_t *const pC8_newFrame,
                        uint8_t c8_keyArray[C8_KEY_COUNT],
                        uint8_t c8_memArray[C8_MEMSIZE],
-                       uint8_t c8_screenMatrix[C8_RES_HEIGHT][C8_RES_WIDTH],
-                       uint32_t **const pC8_stackPointer
-                      ) : tracker(&codegen, c8_regArray, pC8_addressReg)
+                       uint64_t c8_screenMatrix[C8_RES_HEIGHT],
+                       uint32_t **const pC8_stackPointer,
+                       TranslationCache *const pCache
+                      ) : codegen(pCache->getArena()), tracker(&codegen, c8_regArray, pC8_addressReg)
 {
     mC8_regBaseAddr = (uintptr_t) c8_regArray;
     mC8_seedRngAddr = (uintptr_t) pC8_seedRngAddr;
     mC8_addressRegAddr = (uintptr_t) pC8_addressReg;
     mC8_delaytimerAddr = (uintptr_t) pC8_delaytimer;
     mC8_soundtimerAddr = (uintptr_t) pC8_soundtimer;
+    mC8_clockAddr = (uintptr_t) pC8_clock;
     mC8_keyBaseAddr = (uintptr_t) c8_keyArray;
     mC8_memBaseAddr = (uintptr_t) c8_memArray;
     mC8_screenBaseAddr = (uintptr_t) c8_screenMatrix;
     mC8_newFrameAddr = (uintptr_t) pC8_newFrame;
     mC8_stackPointerAddr = (uintptr_t) pC8_stackPointer;
+    mBudgetAddr = (uintptr_t) pCache->getBudget();
+    mCodeMapAddr = (uintptr_t) pCache->getCodeMap();
+    mPendingWriteAddr = (uintptr_t) pCache->getPendingWrite();
+    mHotCountAddr = (uintptr_t) pCache->getHotCount();
+    pmCache = pCache;
+#ifdef C8_PROFILE
+    mProfileAddr = (uintptr_t) pCache->getProfiler()->getEntries();
+    mClockAddr = (uintptr_t) pCache->getProfiler()->getClock();
+#endif
+
+    //every address baked into the code must be in a region
+    codegen.addRegion(c8_regArray, C8_GPREG_COUNT);
+    codegen.addRegion(pC8_seedRngAddr, sizeof(uint32_t));
+    codegen.addRegion(pC8_addressReg, sizeof(uint32_t));
+    codegen.addRegion(pC8_delaytimer, sizeof(uint32_t));
+    codegen.addRegion(pC8_soundtimer, sizeof(uint32_t));
+    codegen.addRegion(pC8_clock, sizeof(uint32_t));
+    codegen.addRegion(pC8_newFrame, sizeof(uint32_t));
+    codegen.addRegion(c8_keyArray, C8_KEY_COUNT);
+    codegen.addRegion(c8_memArray, C8_MEMSIZE);
+    codegen.addRegion(c8_screenMatrix, SCREEN_SIZE);
+    codegen.addRegion(pC8_stackPointer, sizeof(uint32_t *));
+    codegen.addRegion((void *) pCache->getBudget(), sizeof(int32_t));
+    codegen.addRegion(pCache->getCodeMap(), CACHE_GRANULE_COUNT);
+    codegen.addRegion((void *) pCache->getPendingWrite(), sizeof(TranslationCache::Write));
+    codegen.addRegion((void *) pCache->getHotCount(), C8_MEMSIZE * sizeof(int32_t));
+#ifdef C8_PROFILE
+    codegen.addRegion(pCache->getProfiler(), sizeof(Profiler));
+#endif
+
+    mDecodedOps.reserve(TR_RESERVED_OPS);
+    mBlocks.reserve(TR_RESERVED_BLOCKS);
 
     reset();
 }
@@ -21,6 +21,7 @@
 #define _TRANSLATOR_H_
 
 #include <list>
+#include <vector>
 #include <stdint.h>
 
 #include "x86def.h"
@@ -28,15 +29,34 @@
 #include "CodeGenerator.h"
 #include "RegTracker.h"
 #include "CodeBlock.h"
+#include "TranslationCache.h"
 
 #define NEW_FRAME    1
 #define NO_NEW_FRAME 0
 
 #define TO_COND_BRANCH 2
 
+//IR-nodes and blocks room is made for up front, the
+//buffers are cleared between blocks but never shrunk
+#define TR_RESERVED_OPS    256
+#define TR_RESERVED_BLOCKS 16
+
+//a block is ended when less than this is left in the code arena,
+//it holds the largest opcode (DXYN with 15 unrolled rows is about
+//1.3kB) and the exit of the block
+#define TR_OPCODE_RESERVE 4096
+
+//must be changed when the generated code changes
+#define TR_VERSION 12
+
 #define LCG_INCREMENT  12345
 #define LCG_MULTIPLIER 1103515245
 
+//the emulated stack is followed by the predicted host
+//address of the code that each stack entry returns to
+#define STACK_SIZE        (C8_STACK_DEPTH * 2)
+#define PREDICTION_OFFSET (C8_STACK_DEPTH * 4)
+
 class Translator
 {
     private:
@@ -54,6 +74,18 @@ class Translator
             bool                         inCondition;
             bool                         leader;
             bool                         ignore;
+            bool                         exitOnSkip;
+            bool                         inlineJump;
+            bool                         flagLive;
+            bool                         carryUsed;
+            bool                         carrySkip;
+            bool                         skipIfCarry;
+            bool                         resultLive;
+            bool                         folded;
+            bool                         addressRegKnown;
+            int                          flagValue;
+            uint32_t                     value;
+            uint32_t                     addressRegValue;
             int                          arg1;
             int                          arg2;
             uint32_t                     arg3;
@@ -62,7 +94,10 @@ class Translator
             TranslatorMemberFnGenerate_t pfnGenOpcode;
 
             DecodedOpcode()
-            {isCondBranchDest = false; ignore = false; leader = false; inCondition = false;}
+            {isCondBranchDest = false; ignore = false; leader = false; inCondition = false;
+             exitOnSkip = false; inlineJump = false; flagLive = true; carryUsed = false;
+             carrySkip = false; skipIfCarry = false; resultLive = true; folded = false;
+             addressRegKnown = false; flagValue = -1; value = 0; addressRegValue = 0;}
          // DecodedOpcode(const DecodedOpcode&);
          // DecodedOpcode& DecodedOpcode=(const DecodedOpcode&);
          // ~DecodedOpcode();
@@ -70,25 +105,46 @@ class Translator
 
         CodeGenerator               codegen;
         RegTracker                  tracker;
-        std::list<DecodedOpcode *>  mDecodedOps;
-        std::list<CodeBlock *>      mBlocks;
+        std::vector<DecodedOpcode>  mDecodedOps;
+        std::vector<CodeBlock *>    mBlocks;
+        std::list<CodeBlock::Exit>  mExits;
+        std::list<CodeBlock::Range> mRanges;
+        std::list<CodeBlock::Data>  mData;
+        std::list<uint32_t>         mTrace;
         Label_t                     mLabelCondBranchDest;
         Label_t                     mLabelCondReturnDest;
         bool                        mReadyToTranslate;
         bool                        mCondition;
         bool                        inlineSub;
+        bool                        mTracing;
+        bool                        mResident;
+        bool                        mArenaFull;
+        int                         mResidentIndex;
+        RegConvention_t             mConvention;
+        uint32_t                    mBlockAddress;
         int                         mCountdown;
+        int                         mBlockOpcount;
         uint32_t                    mNextOpAddress;
         uintptr_t                   mC8_regBaseAddr;
         uintptr_t                   mC8_addressRegAddr;
         uintptr_t                   mC8_delaytimerAddr;
         uintptr_t                   mC8_soundtimerAddr;
+        uintptr_t                   mC8_clockAddr;
         uintptr_t                   mC8_keyBaseAddr;
         uintptr_t                   mC8_memBaseAddr;
         uintptr_t                   mC8_screenBaseAddr;
         uintptr_t                   mC8_newFrameAddr;
         uintptr_t                   mC8_seedRngAddr;
         uintptr_t                   mC8_stackPointerAddr;
+        uintptr_t                   mBudgetAddr;
+        uintptr_t                   mCodeMapAddr;
+        uintptr_t                   mPendingWriteAddr;
+        uintptr_t                   mHotCountAddr;
+        TranslationCache           *pmCache;
+#ifdef C8_PROFILE
+        uintptr_t                   mProfileAddr;
+        uintptr_t                   mClockAddr;
+#endif
 
         /**
          * Destroy
@@ -109,6 +165,46 @@ class Translator
          */
         void translate();
 
+        /**
+         * Forward pass over the IR that tracks the values of the
+         * registers and I known at translation time. Opcodes on
+         * known values are folded to their result, skips on known
+         * values are decided, and opcodes that use I remember it
+         * when it is known.
+         */
+        void analyzeConstants();
+
+        /**
+         * Backward liveness pass over the IR for the registers and I.
+         * Opcodes that set VF from the carry flag only write it when
+         * it is read before it is set again, or when the block can be
+         * left before that, and folded opcodes only set live registers.
+         * A skip on VF right after such an opcode tests the carry flag.
+         */
+        void analyzeLiveness();
+
+        /**
+         * Generates the result of an opcode that was folded to a
+         * constant. VX and VF are only set if they are live.
+         *
+         * PARAMS
+         * rNode    ref. to IR-node (decoded node)
+         *
+         * RETURNS
+         * true if the opcode was folded, otherwise false
+         */
+        bool generateConstant(const DecodedOpcode &rNode);
+
+        /**
+         * Generates code that sets VF from the carry flag,
+         * if VF is live after the opcode
+         *
+         * PARAMS
+         * rNode    ref. to IR-node (decoded node)
+         * noCarry  VF is set when the carry flag is clear
+         */
+        void generateFlag(const DecodedOpcode &rNode, const bool noCarry);
+
         /**
          * Sets the codegeneration-function for an IR-node.
          * If the node is in an IF statement a forced return
@@ -120,6 +216,15 @@ class Translator
          */
         void setOpcodeFunction(DecodedOpcode &rNode, const TranslatorMemberFnGenerate_t pfnGenOpcode);
 
+        /**
+         * Stores generated code as a new codeblock
+         *
+         * PARAMS
+         * address  the address for the code in the emulated machine
+         * opcount  number of emulated opcodes the block contains
+         */
+        void storeBlock(const uint32_t address, const int opcount);
+
         /**
          * Generates code to force return
          *
@@ -128,6 +233,117 @@ class Translator
          */
         void generateReturn(const DecodedOpcode &rNode);
 
+        /**
+         * Generates code that counts down the opcode budget
+         * with the number of opcodes in the block so far.
+         */
+        void generateBudget();
+
+        /**
+         * Generates code that counts the executions of a block.
+         * When the block becomes hot it returns to the dispatcher
+         * once, so a trace can be formed from it.
+         *
+         * PARAMS
+         * address  emulated address of the block
+         */
+        void generateCounter(const uint32_t address);
+
+#ifdef C8_PROFILE
+        /**
+         * Generates code that counts the executions of a block for
+         * the profiler. With C8_PROFILE_CYCLES the time since the
+         * last block entry is also counted, for the last block.
+         *
+         * PARAMS
+         * address  emulated address of the block
+         */
+        void generateProfile(const uint32_t address);
+#endif
+
+        /**
+         * Generates the conditional jump of a skip instruction.
+         * If a trace continues at the next instruction the jump
+         * is inverted, and skipping leaves the block. Skips on
+         * VF that test the carry flag use the carry flag instead
+         * of the zero flag, and skips on known values jump always
+         * or never.
+         *
+         * PARAMS
+         * rNode        ref. to IR-node (decoded node)
+         * skipIfSet    skip if the flag is set, otherwise if it is clear
+         */
+        void generateSkip(const DecodedOpcode &rNode, const bool skipIfSet);
+
+        /**
+         * Get the address execution continues at after an opcode,
+         * when a trace passes through it
+         *
+         * PARAMS
+         * rNode    ref. to IR-node (decoded node)
+         *
+         * RETURNS
+         * emulated address, C8_MEMSIZE if only known at runtime
+         */
+        uint32_t traceTarget(const DecodedOpcode &rNode) const;
+
+        /**
+         * Generates the entry of a superblock, which keeps the chip8
+         * registers it uses most in IA registers. Blocks in the same
+         * convention jump past the entry without going through memory.
+         *
+         * PARAMS
+         * first    first IR-node of the block
+         */
+        void generateConvention(const std::vector<DecodedOpcode>::const_iterator first);
+
+        /**
+         * Get the convention of the block at an address, if the
+         * block is being translated or is in the cache
+         *
+         * PARAMS
+         * address      emulated address of the block
+         * rConvention  the convention is stored here
+         *
+         * RETURNS
+         * true if the block has a convention, otherwise false
+         */
+        bool findConvention(const uint32_t address, RegConvention_t &rConvention) const;
+
+        /**
+         * Generates a block exit to a known address.
+         * The exit is linked directly to the target block
+         * by the translation cache. Modified registers must
+         * be saved before, dirty registers are restored.
+         *
+         * PARAMS
+         * address  emulated address to continue at
+         */
+        void generateExit(const uint32_t address);
+
+        /**
+         * Generates a check after a store to emulated memory at
+         * address I. If the store can hit translated code it is
+         * recorded and the block returns to the dispatcher, which
+         * invalidates the blocks that were written to.
+         *
+         * PARAMS
+         * rNode    ref. to IR-node (decoded node)
+         * size     number of bytes stored
+         */
+        void generateWriteCheck(const DecodedOpcode &rNode, const uint32_t size);
+
+        /**
+         * Generates a jump past an access to a byte of emulated
+         * memory when the byte is past the end of memory. Such
+         * bytes are read as 0 and stores to them are dropped.
+         *
+         * PARAMS
+         * ra       x86 register holding the host address of the byte
+         * outside  label jumped to when the byte is outside of memory
+         */
+        void generateBoundsCheck(const int ra, const Label_t outside);
+
         /**
          * Unknown opcode
          * sets decoded info for an unknown opcode (ignore = true)
@@ -425,6 +641,22 @@ class Translator
          */
         void generateDXYN(const DecodedOpcode &rNode);
 
+        /**
+         * Generates the drawing of one sprite row. The row is shifted
+         * to VX over the two 32 bit halves of a screen row, the left
+         * half holds pixels 0-31 and is the high word of the row.
+         * Both halves are tested for a collision and XORed onto the screen.
+         * Uses EDX, ECX and REG_TMP.
+         *
+         * PARAMS
+         * rf       x86 register the collision flag is set in
+         * rx       x86 register holding VX
+         * ry       x86 register holding VY
+         * rrow     x86 register holding the row in a loop, -1 if there is none
+         * row      row of the sprite, drawn at VY + rrow + row
+         */
+        void generateSpriteRow(const int rf, const int rx, const int ry, const int rrow, const int row);
+
         /**
          * Decode EX9E
          * Skips the next instruction if the key stored in VX is pressed.
@@ -588,6 +820,55 @@ class Translator
          */
         void reset();
 
+        /**
+         * Translate the next block as a superblock along a trace.
+         * Jumps, calls and skips on the trace continue in the same
+         * block, other paths leave it through side exits.
+         *
+         * PARAMS
+         * rTrace   addresses of the blocks on the trace
+         */
+        void setTrace(const std::list<uint32_t> &rTrace);
+
+        /**
+         * Get the address of a memory region the generated code
+         * addresses. Relocations in CodeBlocks refer to these.
+         *
+         * PARAMS
+         * region   region number
+         *
+         * RETURNS
+         * address of the region
+         */
+        uintptr_t getRegionBase(const int region) const;
+
+        /**
+         * Get number of memory regions the generated code addresses
+         *
+         * RETURNS
+         * number of regions
+         */
+        int getRegionCount() const;
+
+        /**
+         * Check that the generated code can address all memory
+         * regions, in 64 bit mode they must be in the low 2GB
+         *
+         * RETURNS
+         * true if the translator is usable, otherwise false
+         */
+        bool isValid() const;
+
+        /**
+         * Check if a block of the last translation did not fit in
+         * the code arena. The block is not handed out, the code is
+         * translated again after the cache has been flushed.
+         *
+         * RETURNS
+         * true if a block was thrown away, otherwise false
+         */
+        bool isArenaFull() const;
+
         /**
          * Constructor
          *
@@ -597,22 +878,26 @@ class Translator
          * pC8_addressReg       addressregister
          * pC8_delaytimer       delaytimer
          * pC8_soundtimer       soundtimer
+         * pC8_clock            clock the timers count down against
          * pC8_newframe         new-frame-indicator
          * c8_keyArray          keypresses
          * c8_memArray          memory
          * c8_screendata        screen
          * pC8_stackPointer     stackpointer
+         * pCache               cache that blocks will be inserted into
          */
                 Translator(uint8_t c8_regArray[C8_GPREG_COUNT],
                            uint32_t *const pC8_seedRngAddr,
                            uint32_t *const pC8_addressReg,
-                           uint8_t *const pC8_delaytimer,
-                           uint8_t *const pC8_soundtimer,
+                           uint32_t *const pC8_delaytimer,
+                           uint32_t *const pC8_soundtimer,
+                           uint32_t *const pC8_clock,
                            uint32_t *const pC8_newframe,
                            uint8_t c8_keyArray[C8_KEY_COUNT],
                            uint8_t c8_memArray[C8_MEMSIZE],
-                           uint8_t c8_screendata[C8_RES_HEIGHT][C8_RES_WIDTH],
-                           uint32_t **const pC8_stackPointer);
+                           uint64_t c8_screendata[C8_RES_HEIGHT],
+                           uint32_t **const pC8_stackPointer,
+                           TranslationCache *const pCache);
 
         /**
          * Destructor
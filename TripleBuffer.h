@@ -0,0 +1,107 @@
+/************************************************************
+  **** TripleBuffer.h (header and implementation)
+   ***
+    ** Author:
+     *   Tommy Hellstrom
+     *
+     * Description:
+     *   Hands finished frames from the emulation thread
+     *   to the presentation thread without locks
+     *
+     * Revision history:
+     *   When         Who       What
+     *   20261016     me        created
+     *
+     * License information:
+     *   GPLv3
+     *
+     ********************************************************/
+
+#pragma once
+#ifndef _TRIPLEBUFFER_H_
+#define _TRIPLEBUFFER_H_
+
+#include <stdint.h>
+
+#include "Chip8def.h"
+#include "Screen.h"
+
+//set in the shared index when it holds a frame not presented yet
+#define TB_FRESH 4
+
+class TripleBuffer
+{
+    private:
+
+        uint64_t mFrames[3][C8_RES_HEIGHT];
+
+        //buffer the writer draws in, only used by the writer
+        uint32_t mBack;
+
+        //buffer handed between the threads, and TB_FRESH
+        volatile uint32_t mMiddle;
+
+        //buffer the reader presents, only used by the reader
+        uint32_t mFront;
+
+    public:
+
+        /**
+         * Constructor
+         * All buffers start with a blank screen
+         */
+        TripleBuffer()
+        {
+            for(int i = 0; i < 3; i++)
+                screenClear(mFrames[i]);
+
+            mBack = 0;
+            mMiddle = 1;
+            mFront = 2;
+        }
+
+        /**
+         * Publish a frame, called by the writer. A frame
+         * that was not presented yet is replaced.
+         *
+         * PARAMS
+         * screen   the frame
+         */
+        void publish(const uint64_t screen[C8_RES_HEIGHT])
+        {
+            screenCopy(mFrames[mBack], screen);
+
+            //the frame is written before it is handed over
+            __sync_synchronize();
+            mBack = __sync_lock_test_and_set(&mMiddle, mBack | TB_FRESH) & ~TB_FRESH;
+        }
+
+        /**
+         * Take the newest published frame, called by the reader
+         *
+         * RETURNS
+         * true if there was a new frame, otherwise false
+         */
+        bool consume()
+        {
+            if((mMiddle & TB_FRESH) == 0)
+                return false;
+
+            mFront = __sync_lock_test_and_set(&mMiddle, mFront) & ~TB_FRESH;
+
+            return true;
+        }
+
+        /**
+         * Get the frame the reader presents
+         *
+         * RETURNS
+         * the frame taken by the last consume
+         */
+        const uint64_t* getFront() const
+        {
+            return mFrames[mFront];
+        }
+};
+
+#endif //_TRIPLEBUFFER_H_
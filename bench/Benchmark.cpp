@@ -0,0 +1,357 @@
+/************************************************************
+  **** Benchmark.cpp (performance benchmarks)
+   ***
+    ** Author:
+     *   Tommy Hellstrom
+     *
+     * Description:
+     *   Measures translation throughput, dispatch overhead
+     *   and end-to-end rom speed. Every result is written
+     *   to stdout as one JSON object per line.
+     *
+     * Revision history:
+     *   When         Who       What
+     *   20261016     me        created
+     *
+     * License information:
+     *   GPLv3
+     *
+     ********************************************************/
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <stdint.h>
+
+#include "Chip8def.h"
+#include "Translator.h"
+#include "TranslationCache.h"
+#include "Dispatcher.h"
+#include "Screen.h"
+
+//every benchmark is repeated, the fastest round is reported
+#define BENCH_ROUNDS 5
+
+//times every block of the roms is translated in a round
+#define BENCH_TRANSLATE_PASSES 20
+
+//blocks executed in a round of the dispatch benchmark
+#define BENCH_DISPATCH_BLOCKS 2000000
+
+//opcodes executed between returns to the dispatcher in the rom benchmark
+#define BENCH_OPCOUNT 1000
+
+//a rom that never reaches the idle address is stopped
+#define BENCH_MAX_OPCODES 4000000000u
+
+//Chip8 variabels
+static uint32_t gC8_pc;
+static uint32_t gC8_seedRng;
+static uint32_t gC8_newFrame;
+static uint32_t gC8_addressReg;
+static uint32_t gC8_stack[STACK_SIZE];
+static uint32_t *gC8_stackPointer;
+static uint8_t  gC8_regs[C8_GPREG_COUNT];
+static uint8_t  gC8_memory[C8_MEMSIZE];
+static uint64_t gC8_screen[C8_RES_HEIGHT];
+static uint8_t  gC8_keys[C8_KEY_COUNT];
+static uint32_t gC8_delaytimer;
+static uint32_t gC8_soundtimer;
+static uint32_t gC8_clock;
+
+/**
+ * Get the time from a monotonic clock
+ *
+ * RETURNS
+ * time in seconds
+ */
+static double now()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * Reset the Chip8 system, the rom in memory is kept
+ */
+static void c8_reset()
+{
+    gC8_pc = C8_PC_START;
+    gC8_addressReg = 0;
+    gC8_delaytimer = 0;
+    gC8_soundtimer = 0;
+    gC8_clock = 0;
+    gC8_newFrame = 0;
+    gC8_stackPointer = gC8_stack;
+    gC8_seedRng = 1;
+    memset(gC8_stack, 0, sizeof(gC8_stack));
+    memset(gC8_regs, 0, sizeof(gC8_regs));
+    memset(gC8_keys, 0, sizeof(gC8_keys));
+    screenClear(gC8_screen);
+}
+
+/**
+ * Load a Chip8 rom
+ *
+ * PARAMS
+ * pFile    filepath
+ *
+ * RETURNS
+ * size of the rom, zero if it could not be loaded
+ */
+static uint32_t c8_loadRom(const char *const pFile)
+{
+    memset(gC8_memory, 0, sizeof(gC8_memory));
+    c8_reset();
+
+    FILE *const pIn = fopen(pFile, "rb");
+
+    if(pIn == NULL)
+        return 0;
+
+    const uint32_t size = fread(&gC8_memory[C8_PC_START], 1, C8_MEMSIZE - C8_PC_START, pIn);
+    fclose(pIn);
+
+    return size;
+}
+
+/**
+ * Create a dispatcher on the Chip8 variabels
+ *
+ * RETURNS
+ * the dispatcher, NULL if no code arena could be allocated
+ * or the generated code can not address the Chip8 variabels
+ */
+static Dispatcher* createDispatcher()
+{
+    Dispatcher *const pDispatcher = new Dispatcher(&gC8_pc, gC8_regs, &gC8_seedRng, &gC8_addressReg,
+                                                   &gC8_delaytimer, &gC8_soundtimer, &gC8_clock, &gC8_newFrame,
+                                                   gC8_keys, gC8_memory, gC8_screen, &gC8_stackPointer);
+
+    if(pDispatcher == NULL || !pDispatcher->isValid())
+    {
+        delete pDispatcher;
+        return NULL;
+    }
+
+    pDispatcher->getCache().setPrediction(gC8_stack + C8_STACK_DEPTH);
+
+    return pDispatcher;
+}
+
+/**
+ * Translates a block at every opcode address of the roms,
+ * through Translator::emit, and reports blocks per second
+ *
+ * PARAMS
+ * pRoms    paths of the roms
+ * count    number of roms
+ */
+static void benchTranslate(char *const pRoms[], const int count)
+{
+    double best = 0;
+    uint32_t blocks = 0;
+
+    for(int round = 0; round < BENCH_ROUNDS; round++)
+    {
+        double elapsed = 0;
+        blocks = 0;
+
+        for(int r = 0; r < count; r++)
+        {
+            const uint32_t size = c8_loadRom(pRoms[r]);
+            Dispatcher *const pDispatcher = createDispatcher();
+
+            if(size == 0 || pDispatcher == NULL)
+            {
+                delete pDispatcher;
+                continue;
+            }
+
+            TranslationCache &rCache = pDispatcher->getCache();
+            Translator &rDynarec = pDispatcher->getTranslator();
+            const uint32_t end = C8_PC_START + size - 1;
+            const double start = now();
+
+            for(int pass = 0; pass < BENCH_TRANSLATE_PASSES; pass++)
+            {
+                rCache.flush();
+                rDynarec.reset();
+
+                for(uint32_t address = C8_PC_START; address < end; address += C8_OPCODE_SIZE)
+                {
+                    CodeBlock *ptr;
+                    uint32_t pc = address;
+
+                    if(rCache.exists(pc))
+                        continue;
+
+                    if(rCache.isFull())
+                    {
+                        rCache.flush();
+                        rDynarec.reset();
+                    }
+
+                    while(pc < C8_MEMSIZE - 1 && rDynarec.emit((gC8_memory[pc] << 8) | gC8_memory[pc + 1], pc));
+
+                    if(pc >= C8_MEMSIZE - 1)
+                    {
+                        rDynarec.reset();
+                        continue;
+                    }
+
+                    while(rDynarec.getCodeBlock(&ptr))
+                    {
+                        if(rCache.insert(ptr))
+                            blocks++;
+                        else
+                            delete ptr;
+                    }
+                }
+            }
+
+            elapsed += now() - start;
+            delete pDispatcher;
+        }
+
+        if(round == 0 || elapsed < best)
+            best = elapsed;
+    }
+
+    printf("{\"benchmark\": \"translate\", \"blocks\": %u, \"seconds\": %.6f, \"blocks_per_second\": %.0f}\n",
+           blocks, best, best > 0 ? blocks / best : 0);
+}
+
+/**
+ * Runs a loop of one small block, first returning to the dispatcher
+ * after every block and then with the block linked to itself, and
+ * reports the time per block
+ */
+static void benchDispatch()
+{
+    //6000: V0 = 0, 7001: V0 += 1, 1202: jump to the add
+    const uint8_t loop[] = {0x60, 0x00, 0x70, 0x01, 0x12, 0x02};
+    double bestReturn = 0;
+    double bestLinked = 0;
+
+    memset(gC8_memory, 0, sizeof(gC8_memory));
+    memcpy(gC8_memory + C8_PC_START, loop, sizeof(loop));
+
+    for(int round = 0; round < BENCH_ROUNDS; round++)
+    {
+        c8_reset();
+        Dispatcher *const pDispatcher = createDispatcher();
+
+        if(pDispatcher == NULL)
+            return;
+
+        //translate the loop and form its trace before measuring
+        while(!pDispatcher->dispatch(1) || pDispatcher->getOpcodeCount() < 2 * CACHE_HOT_COUNT);
+
+        //a budget of one opcode returns at the end of every block
+        double start = now();
+
+        for(int i = 0; i < BENCH_DISPATCH_BLOCKS; i++)
+            pDispatcher->dispatch(1);
+
+        const double returned = (now() - start) / BENCH_DISPATCH_BLOCKS;
+
+        //the loop block has two opcodes
+        start = now();
+        pDispatcher->dispatch(2 * BENCH_DISPATCH_BLOCKS);
+
+        const double linked = (now() - start) / BENCH_DISPATCH_BLOCKS;
+
+        if(round == 0 || returned < bestReturn)
+            bestReturn = returned;
+
+        if(round == 0 || linked < bestLinked)
+            bestLinked = linked;
+
+        delete pDispatcher;
+    }
+
+    printf("{\"benchmark\": \"dispatch\", \"blocks\": %u, \"returned_ns_per_block\": %.2f, \"linked_ns_per_block\": %.2f}\n",
+           BENCH_DISPATCH_BLOCKS, bestReturn * 1e9, bestLinked * 1e9);
+}
+
+/**
+ * Runs a rom from reset until it reaches its idle address,
+ * and reports opcodes per second. Translation time is included.
+ *
+ * PARAMS
+ * pRom     path of the rom
+ * idle     address of the idle loop
+ */
+static void benchRom(const char *const pRom, const uint32_t idle)
+{
+    double best = 0;
+    uint64_t opcodes = 0;
+
+    for(int round = 0; round < BENCH_ROUNDS; round++)
+    {
+        if(c8_loadRom(pRom) == 0)
+        {
+            fprintf(stderr, "Could not open file: %s\n", pRom);
+            return;
+        }
+
+        Dispatcher *const pDispatcher = createDispatcher();
+
+        if(pDispatcher == NULL)
+            return;
+
+        const double start = now();
+
+        //the timers count down once per frame of guest opcodes
+        while(gC8_pc != idle && pDispatcher->getOpcodeCount() < BENCH_MAX_OPCODES)
+        {
+            if(pDispatcher->dispatch(BENCH_OPCOUNT))
+                gC8_clock++;
+        }
+
+        const double elapsed = now() - start;
+        opcodes = pDispatcher->getOpcodeCount();
+
+        if(round == 0 || elapsed < best)
+            best = elapsed;
+
+        delete pDispatcher;
+    }
+
+    printf("{\"benchmark\": \"rom\", \"rom\": \"%s\", \"idle\": %u, \"reached\": %s, \"opcodes\": %.0f, \"seconds\": %.6f, \"opcodes_per_second\": %.0f}\n",
+           pRom, idle, gC8_pc == idle ? "true" : "false", (double) opcodes, best, best > 0 ? opcodes / best : 0);
+}
+
+/**
+ * Main...
+ */
+int main(int argc, char *argv[])
+{
+    uint32_t idle = 0;
+    int first = 1;
+
+    if(first < argc && strncmp(argv[first], "--idle=", 7) == 0)
+        idle = strtoul(argv[first++] + 7, NULL, 0);
+
+    if(first >= argc)
+    {
+        printf("USAGE:\n");
+        printf("\tchip86-bench [--idle=address] rom [rom...]\n\n");
+        printf("\tTranslates every rom, measures the dispatcher and runs the\n");
+        printf("\tfirst rom until it reaches the idle address, if one is given.\n");
+        return 0;
+    }
+
+    benchTranslate(argv + first, argc - first);
+    benchDispatch();
+
+    if(idle != 0)
+        benchRom(argv[first], idle);
+
+    return 0;
+}
@@ -17,21 +17,31 @@
      ********************************************************/
 
 #include <cstdio>
+#include <cstdlib>
 #include <cstring>
 #include <ctime>
 #include <stdint.h>
 
-#ifndef _WINDOWS
- #include <SDL/SDL.h>
- #include <SDL/SDL_opengl.h>
-#else
- #include "SDL_win/include/SDL.h"
- #include "SDL_win/include/SDL_opengl.h"
+//the headless build runs without a window and has no SDL dependency
+#ifndef C8_HEADLESS
+ #ifndef _WINDOWS
+  #include <SDL/SDL.h>
+  #include <SDL/SDL_opengl.h>
+ #else
+  #include "SDL_win/include/SDL.h"
+  #include "SDL_win/include/SDL_opengl.h"
+ #endif
 #endif
 
 #include "Chip8def.h"
 #include "Translator.h"
 #include "TranslationCache.h"
+#include "CacheFile.h"
+#include "Dispatcher.h"
+#include "Screen.h"
+#ifndef C8_HEADLESS
+ #include "TripleBuffer.h"
+#endif
 
 #define WINDOW_WIDTH  512
 #define WINDOW_HEIGHT 256
@@ -48,10 +58,15 @@
 #define COLOR_PIXEL_OFF_B 0
 
 #define DEFAULT_OPCOUNT 10
+#define DEFAULT_FRAMES  600
 
 #define APP_NAME         "Chip-86"
 #define APP_VERSION      "0.2"
-#define APP_BINARY_NAME  "chip86"
+#ifndef C8_HEADLESS
+ #define APP_BINARY_NAME "chip86"
+#else
+ #define APP_BINARY_NAME "chip86-headless"
+#endif
 #define APP_WINDOW_TITLE "Chip-86"
 
 //Font sprites that is copied to chip8 memory
@@ -80,14 +95,30 @@ static uint32_t gC8_pc;
 static uint32_t gC8_seedRng;
 static uint32_t gC8_newFrame;
 static uint32_t gC8_addressReg;
-static uint32_t gC8_stack[C8_STACK_DEPTH];
+static uint32_t gC8_stack[STACK_SIZE];
 static uint32_t *gC8_stackPointer;
 static uint8_t  gC8_regs[C8_GPREG_COUNT];
 static uint8_t  gC8_memory[C8_MEMSIZE];
-static uint8_t  gC8_screen[C8_RES_HEIGHT][C8_RES_WIDTH];
+static uint64_t gC8_screen[C8_RES_HEIGHT];
 static uint8_t  gC8_keys[C8_KEY_COUNT];
-static uint8_t  gC8_delaytimer;
-static uint8_t  gC8_soundtimer;
+static uint32_t gC8_delaytimer;
+static uint32_t gC8_soundtimer;
+static uint32_t gC8_clock;
+
+#ifndef C8_HEADLESS
+//shared by the emulation thread and the presentation thread
+static TripleBuffer      gFrames;
+static volatile uint32_t gKeyMask;
+static volatile int      gDelay;
+static volatile int      gOpcount;
+static volatile bool     gRunning;
+
+//the screen texture, only used by the presentation thread
+static GLuint   gTexture;
+static uint8_t  gTexels[C8_RES_HEIGHT][C8_RES_WIDTH];
+static uint64_t gShown[C8_RES_HEIGHT];
+static uint64_t gExpand[256];
+#endif
 
 /**
  * Fetch the instruction, pointed to by the PC
@@ -102,32 +133,43 @@ inline uint32_t c8_getOpcode()
 
 /**
  * Reset the Chip8 system
+ *
+ * PARAMS
+ * seed     seed of the random number generator
  */
-void c8_reset()
+void c8_reset(const uint32_t seed)
 {
     gC8_pc = C8_PC_START;
     gC8_addressReg = 0;
     gC8_delaytimer = 0;
     gC8_soundtimer = 0;
+    gC8_clock = 0;
     gC8_newFrame = 0;
     gC8_stackPointer = gC8_stack;
-    gC8_seedRng = time(NULL);
+    memset(gC8_stack, 0, sizeof(gC8_stack));
+    gC8_seedRng = seed;
     memset(gC8_regs, 0, sizeof(gC8_regs));
     memset(gC8_keys, 0, sizeof(gC8_keys));
-    memset(gC8_screen, 0, sizeof(gC8_screen));
+    screenClear(gC8_screen);
     memcpy(gC8_memory, C8_FONT, sizeof(C8_FONT));
 }
 
 /**
- * Decrease chip8 timers
+ * Get the value of a chip8 timer. Timers are kept as the
+ * clock tick they reach zero at, so nothing needs to
+ * count them down.
+ *
+ * PARAMS
+ * deadline the clock tick the timer reaches zero at
+ *
+ * RETURNS
+ * ticks left until the deadline, zero if it has passed
  */
-void c8_decreaseTimers()
+inline uint8_t c8_timer(const uint32_t deadline)
 {
-    if (gC8_delaytimer > 0)
-        gC8_delaytimer--;
+    const int32_t left = (int32_t) (deadline - gC8_clock);
 
-    if (gC8_soundtimer > 0)
-        gC8_soundtimer--;
+    return left > 0 ? left : 0;
 }
 
 /**
@@ -135,6 +177,9 @@ void c8_decreaseTimers()
  */
 void c8_beep()
 {
+    if(c8_timer(gC8_soundtimer) == 0)
+        return;
+
     //not implemented
 }
 
@@ -143,13 +188,14 @@ void c8_beep()
  *
  * PARAMS
  * pFile filepath
+ * seed  seed of the random number generator
  *
  * RETURNS
  * true if successful, otherwise false
  */
-bool c8_loadRom(const char *const pFile)
+bool c8_loadRom(const char *const pFile, const uint32_t seed)
 {
-    c8_reset();
+    c8_reset(seed);
     FILE *const pIn = fopen(pFile, "rb");
 
     if(pIn == NULL)
@@ -175,154 +221,364 @@ bool c8_loadRom(const char *const pFile)
     return true;
 }
 
+#ifdef C8_HEADLESS
 /**
- * Handle input
+ * Write the memory, registers and screen to files named
+ * after a prefix: prefix.mem is the raw memory, prefix.regs
+ * lists the registers in hex and prefix.pbm is the screen
+ * as a portable bitmap
+ *
+ * PARAMS
+ * pPrefix  prefix of the file names
+ *
+ * RETURNS
+ * true if successful, otherwise false
+ */
+bool c8_dumpState(const char *const pPrefix)
+{
+    char path[1024];
+    bool ok;
+
+    if(strlen(pPrefix) + 8 >= sizeof(path))
+        return false;
+
+    sprintf(path, "%s.mem", pPrefix);
+    FILE *pOut = fopen(path, "wb");
+
+    if(pOut == NULL)
+        return false;
+
+    ok = fwrite(gC8_memory, 1, C8_MEMSIZE, pOut) == C8_MEMSIZE;
+    ok = fclose(pOut) == 0 && ok;
+
+    sprintf(path, "%s.regs", pPrefix);
+    pOut = fopen(path, "w");
+
+    if(pOut == NULL)
+        return false;
+
+    fprintf(pOut, "pc %03x\n", gC8_pc);
+    fprintf(pOut, "i %03x\n", gC8_addressReg);
+
+    for(int i = 0; i < C8_GPREG_COUNT; i++)
+        fprintf(pOut, "v%x %02x\n", i, gC8_regs[i]);
+
+    fprintf(pOut, "dt %02x\n", c8_timer(gC8_delaytimer));
+    fprintf(pOut, "st %02x\n", c8_timer(gC8_soundtimer));
+    fprintf(pOut, "sp %d\n", (int) (gC8_stackPointer - gC8_stack));
+    fprintf(pOut, "lit %d\n", screenPopcount(gC8_screen));
+    fprintf(pOut, "hash %016llx\n", (unsigned long long) screenHash(gC8_screen));
+
+    for(uint32_t *p = gC8_stack; p < gC8_stackPointer; p++)
+        fprintf(pOut, "s%d %03x\n", (int) (p - gC8_stack), *p);
+
+    ok = fclose(pOut) == 0 && ok;
+
+    sprintf(path, "%s.pbm", pPrefix);
+    pOut = fopen(path, "w");
+
+    if(pOut == NULL)
+        return false;
+
+    fprintf(pOut, "P1\n%d %d\n", C8_RES_WIDTH, C8_RES_HEIGHT);
+
+    for(int y = 0; y < C8_RES_HEIGHT; y++)
+        for(int x = 0; x < C8_RES_WIDTH; x++)
+            fprintf(pOut, x == C8_RES_WIDTH - 1 ? "%d\n" : "%d ", (int) C8_PIXEL(gC8_screen[y], x));
+
+    return fclose(pOut) == 0 && ok;
+}
+#else
+/**
+ * Get the Chip-8 key of a host key
+ *
+ * PARAMS
+ * sym      SDL key
+ *
+ * RETURNS
+ * the Chip-8 key, -1 if the host key is not mapped
+ */
+int keyIndex(const SDLKey sym)
+{
+    switch(sym)
+    {
+        case SDLK_x: return 0;
+        case SDLK_1: return 1;
+        case SDLK_2: return 2;
+        case SDLK_3: return 3;
+        case SDLK_q: return 4;
+        case SDLK_w: return 5;
+        case SDLK_e: return 6;
+        case SDLK_a: return 7;
+        case SDLK_s: return 8;
+        case SDLK_d: return 9;
+        case SDLK_z: return 10;
+        case SDLK_c: return 11;
+        case SDLK_4: return 12;
+        case SDLK_r: return 13;
+        case SDLK_f: return 14;
+        case SDLK_v: return 15;
+        default: return -1;
+    }
+}
+
+/**
+ * Handle input. Keys are passed to the emulation
+ * thread in a bitmask, one bit for each Chip-8 key.
  *
  * PARAMS
- * rDelay   ref. to delay variable
- * rOpcount ref. to opcount variable
  * rEvent   SDL event
  */
-void handleInput(int &rDelay, int &rOpCount, const SDL_Event &rEvent)
+void handleInput(const SDL_Event &rEvent)
 {
+    const int key = rEvent.type == SDL_KEYDOWN || rEvent.type == SDL_KEYUP ? keyIndex(rEvent.key.keysym.sym) : -1;
+
 	switch(rEvent.type)
 	{
 	    case SDL_KEYDOWN:
+            if(key >= 0)
+                __sync_fetch_and_or(&gKeyMask, 1 << key);
+
             switch(rEvent.key.keysym.sym)
             {
-                case SDLK_x: gC8_keys[0] = 1; break;
-                case SDLK_1: gC8_keys[1] = 1; break;
-                case SDLK_2: gC8_keys[2] = 1; break;
-                case SDLK_3: gC8_keys[3] = 1; break;
-                case SDLK_q: gC8_keys[4] = 1; break;
-                case SDLK_w: gC8_keys[5] = 1; break;
-                case SDLK_e: gC8_keys[6] = 1; break;
-                case SDLK_a: gC8_keys[7] = 1; break;
-                case SDLK_s: gC8_keys[8] = 1; break;
-                case SDLK_d: gC8_keys[9] = 1; break;
-                case SDLK_z: gC8_keys[10] = 1; break;
-                case SDLK_c: gC8_keys[11] = 1; break;
-                case SDLK_4: gC8_keys[12] = 1; break;
-                case SDLK_r: gC8_keys[13] = 1; break;
-                case SDLK_f: gC8_keys[14] = 1; break;
-                case SDLK_v: gC8_keys[15] = 1; break;
-                case SDLK_PAGEDOWN: rDelay++; break;
-                case SDLK_PAGEUP: if(rDelay > 0) rDelay--; break;
-                case SDLK_HOME: rOpCount++; break;
-                case SDLK_END: if(rOpCount > 1) rOpCount--; break;
+                case SDLK_PAGEDOWN: gDelay++; break;
+                case SDLK_PAGEUP: if(gDelay > 0) gDelay--; break;
+                case SDLK_HOME: gOpcount++; break;
+                case SDLK_END: if(gOpcount > 1) gOpcount--; break;
                 default:;
             }
             break;
 
         case SDL_KEYUP:
-            switch(rEvent.key.keysym.sym)
-            {
-                case SDLK_x: gC8_keys[0] = 0; break;
-                case SDLK_1: gC8_keys[1] = 0; break;
-                case SDLK_2: gC8_keys[2] = 0; break;
-                case SDLK_3: gC8_keys[3] = 0; break;
-                case SDLK_q: gC8_keys[4] = 0; break;
-                case SDLK_w: gC8_keys[5] = 0; break;
-                case SDLK_e: gC8_keys[6] = 0; break;
-                case SDLK_a: gC8_keys[7] = 0; break;
-                case SDLK_s: gC8_keys[8] = 0; break;
-                case SDLK_d: gC8_keys[9] = 0; break;
-                case SDLK_z: gC8_keys[10] = 0; break;
-                case SDLK_c: gC8_keys[11] = 0; break;
-                case SDLK_4: gC8_keys[12] = 0; break;
-                case SDLK_r: gC8_keys[13] = 0; break;
-                case SDLK_f: gC8_keys[14] = 0; break;
-                case SDLK_v: gC8_keys[15] = 0; break;
-                default:;
-            }
+            if(key >= 0)
+                __sync_fetch_and_and(&gKeyMask, ~(1 << key));
     }
 }
 
 /**
- * Renders a new frame
+ * Draws the screen texture as a single quad
  */
-void renderFrame()
+void drawScreen()
 {
-    glClearColor(COLOR_PIXEL_OFF_R, COLOR_PIXEL_OFF_G, COLOR_PIXEL_OFF_B, 1.0);
     glClear(GL_COLOR_BUFFER_BIT);
 
-    for(int y = 0; y < C8_RES_HEIGHT; y++)
-        for(int x = 0; x < C8_RES_WIDTH; x++)
-            if(gC8_screen[y][x] == C8_PIXEL_ON)
-            {
-                const int xx = x * SCALE_WIDTH;
-                const int yy = y * SCALE_HEIGHT;
-
-                glBegin(GL_QUADS);
-                glColor3f(COLOR_PIXEL_ON_R, COLOR_PIXEL_ON_G, COLOR_PIXEL_ON_B);
-                glVertex2f(xx, yy);
-                glVertex2f(xx + SCALE_WIDTH, yy);
-                glVertex2f(xx + SCALE_WIDTH, yy + SCALE_HEIGHT);
-                glVertex2f(xx, yy + SCALE_HEIGHT);
-                glEnd();
-            }
+    glBegin(GL_QUADS);
+    glTexCoord2f(0, 0);
+    glVertex2f(0, 0);
+    glTexCoord2f(1, 0);
+    glVertex2f(C8_RES_WIDTH * SCALE_WIDTH, 0);
+    glTexCoord2f(1, 1);
+    glVertex2f(C8_RES_WIDTH * SCALE_WIDTH, C8_RES_HEIGHT * SCALE_HEIGHT);
+    glTexCoord2f(0, 1);
+    glVertex2f(0, C8_RES_HEIGHT * SCALE_HEIGHT);
+    glEnd();
 
     glFlush();
 }
 
 /**
- * Main emulationloop
+ * Renders a new frame. Rows that differ from the last rendered
+ * frame are expanded to one byte per pixel and uploaded to the
+ * screen texture, which is drawn as a single quad. A frame that
+ * is the same as the last one is not rendered.
  *
  * PARAMS
- * delay    delayvalue
- * opcount  number of opcodes to execute between delays
+ * screen   the frame, one word per row
+ *
+ * RETURNS
+ * true if the frame was rendered, false if it did not change
  */
-void dispatchLoop(int delay, int opcount)
+bool renderFrame(const uint64_t screen[C8_RES_HEIGHT])
 {
-    CodeBlock *ptr;
-    SDL_Event event;
-    TranslationCache cache;
-    Translator dynarec(gC8_regs, &gC8_seedRng, &gC8_addressReg,
-                       &gC8_delaytimer, &gC8_soundtimer, &gC8_newFrame,
-                       gC8_keys, gC8_memory, gC8_screen, &gC8_stackPointer);
+    int first = C8_RES_HEIGHT;
+    int last = -1;
 
-    for(;;)
-    {
-        const unsigned int future = SDL_GetTicks() + delay;
+    if(screenEquals(screen, gShown))
+        return false;
 
-        if(gC8_newFrame == NEW_FRAME)
-           renderFrame();
+    for(int y = 0; y < C8_RES_HEIGHT; y++)
+    {
+        if(screen[y] == gShown[y])
+            continue;
 
-        while(SDL_PollEvent(&event))
+        for(int i = 0; i < C8_RES_WIDTH / 8; i++)
         {
-            if(event.type == SDL_QUIT)
-                return;
+            //eight pixels at a time, the leftmost in the highest byte
+            const uint64_t pixels = gExpand[(screen[y] >> (C8_RES_WIDTH - 8 - i * 8)) & 0xFF];
+            memcpy(&gTexels[y][i * 8], &pixels, 8);
+        }
 
-            if(event.active.state & SDL_APPINPUTFOCUS)
-                SDL_GL_SwapBuffers();
+        gShown[y] = screen[y];
 
-            handleInput(delay, opcount, event);
-        }
+        if(first > y)
+            first = y;
+
+        last = y;
+    }
+
+    if(last < 0)
+        return false;
+
+    //the rows from the first to the last changed row are uploaded
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, first, C8_RES_WIDTH, last - first + 1, GL_ALPHA, GL_UNSIGNED_BYTE, gTexels[first]);
+    drawScreen();
+
+    return true;
+}
+
+/**
+ * Emulation thread. Runs the rom and publishes the finished
+ * frames, so a slow presentation does not stall emulation.
+ *
+ * PARAMS
+ * pData    the Dispatcher
+ *
+ * RETURNS
+ * always 0
+ */
+int emulate(void *pData)
+{
+    Dispatcher &dispatcher = *(Dispatcher *) pData;
+
+    while(gRunning)
+    {
+        const unsigned int future = SDL_GetTicks() + gDelay;
+        const uint32_t keys = gKeyMask;
+
+        for(int i = 0; i < C8_KEY_COUNT; i++)
+            gC8_keys[i] = (keys >> i) & 1;
+
+        //the timers count down at 60 Hz of wall clock time
+        gC8_clock = (uint32_t) ((uint64_t) SDL_GetTicks() * 60 / 1000);
+
+        const bool ran = dispatcher.dispatch(gOpcount);
 
         if(gC8_newFrame == NEW_FRAME)
         {
-            SDL_GL_SwapBuffers();
+            gFrames.publish(gC8_screen);
             gC8_newFrame = NO_NEW_FRAME;
         }
 
-        if(cache.executeN(gC8_pc, opcount))
+        if(ran)
         {
-            c8_decreaseTimers();
             c8_beep();
 
-            while(SDL_GetTicks() < future)
+            while(gRunning && SDL_GetTicks() < future)
                 SDL_Delay(0);
         }
-        else
+    }
+
+    return 0;
+}
+#endif
+
+/**
+ * Main emulationloop
+ *
+ * PARAMS
+ * delay    delayvalue
+ * opcount  number of opcodes to execute between delays
+ * pDir     directory for the translation cache file, or NULL
+ * aot      translate all code in the rom before starting
+ * frames   number of frames to run, only used by the headless build
+ */
+void dispatchLoop(int delay, int opcount, const char *const pDir, const bool aot, const uint32_t frames)
+{
+#ifndef C8_HEADLESS
+    SDL_Event event;
+#else
+    uint32_t frame = 0;
+#endif
+    CacheFile file(pDir, gC8_memory);
+    //allocated, so it can be placed where the generated code reaches it
+    Dispatcher *const pDispatcher = new Dispatcher(&gC8_pc, gC8_regs, &gC8_seedRng, &gC8_addressReg,
+                                                   &gC8_delaytimer, &gC8_soundtimer, &gC8_clock, &gC8_newFrame,
+                                                   gC8_keys, gC8_memory, gC8_screen, &gC8_stackPointer);
+
+    if(pDispatcher == NULL || !pDispatcher->isValid())
+    {
+        fprintf(stderr, "Unable to allocate code arena where the Chip-8 state can be addressed\n");
+        delete pDispatcher;
+        return;
+    }
+
+    Dispatcher &dispatcher = *pDispatcher;
+    TranslationCache &cache = dispatcher.getCache();
+    Translator &dynarec = dispatcher.getTranslator();
+
+    cache.setPrediction(gC8_stack + C8_STACK_DEPTH);
+
+    //code is emitted after the loaded blocks
+    if(file.load(cache, dynarec, gC8_memory) > 0)
+        dynarec.reset();
+
+    if(aot)
+        dispatcher.translateAhead();
+
+#ifndef C8_HEADLESS
+    gDelay = delay;
+    gOpcount = opcount;
+    gKeyMask = 0;
+    gRunning = true;
+
+    SDL_Thread *const pThread = SDL_CreateThread(emulate, pDispatcher);
+
+    if(pThread == NULL)
+    {
+        fprintf(stderr, "Unable to create emulation thread: %s\n", SDL_GetError());
+        gRunning = false;
+    }
+
+    //presents the newest frame, the swap waits for the display
+    while(gRunning)
+    {
+        while(SDL_PollEvent(&event))
         {
-            while(dynarec.emit(c8_getOpcode(), gC8_pc));
+            if(event.type == SDL_QUIT)
+            {
+                gRunning = false;
+                break;
+            }
+
+            //the back buffer is stale, the screen is drawn again
+            if(event.type == SDL_ACTIVEEVENT && (event.active.state & SDL_APPINPUTFOCUS))
+            {
+                drawScreen();
+                SDL_GL_SwapBuffers();
+            }
 
-            while(dynarec.getCodeBlock(&ptr))
-                cache.insert(ptr);
+            handleInput(event);
         }
+
+        if(gFrames.consume() && renderFrame(gFrames.getFront()))
+            SDL_GL_SwapBuffers();
+        else
+            SDL_Delay(1);
     }
+
+    if(pThread != NULL)
+        SDL_WaitThread(pThread, NULL);
+#else
+    //no window to draw and nothing to wait for
+    while(frame < frames)
+    {
+        //the timers count down once per frame of guest opcodes
+        if(dispatcher.dispatch(opcount))
+            gC8_clock = ++frame;
+    }
+#endif
+
+    if(file.isEnabled() && !file.save(cache, dynarec, gC8_memory))
+        fprintf(stderr, "Could not save translation cache\n");
+
+#ifdef C8_PROFILE
+    cache.getProfiler()->report(stderr);
+#endif
+
+    delete pDispatcher;
 }
 
+#ifndef C8_HEADLESS
 /**
  * Init OpenGL
  */
@@ -339,6 +595,28 @@ void initGL()
     glClearColor(COLOR_PIXEL_OFF_R, COLOR_PIXEL_OFF_G, COLOR_PIXEL_OFF_B, 1.0);
     glClear(GL_COLOR_BUFFER_BIT);
     glShadeModel(GL_FLAT);
+
+    //a byte of pixels expands to eight bytes, 0xFF for lit pixels
+    for(int b = 0; b < 256; b++)
+    {
+        gExpand[b] = 0;
+
+        for(int bit = 0; bit < 8; bit++)
+            if(b & (0x80 >> bit))
+                gExpand[b] |= (uint64_t) 0xFF << (bit * 8);
+    }
+
+    //lit pixels are drawn in the on color over the cleared screen,
+    //the texture starts blank like the last rendered frame
+    glGenTextures(1, &gTexture);
+    glBindTexture(GL_TEXTURE_2D, gTexture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_ALPHA, C8_RES_WIDTH, C8_RES_HEIGHT, 0, GL_ALPHA, GL_UNSIGNED_BYTE, gTexels);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    glColor3f(COLOR_PIXEL_ON_R, COLOR_PIXEL_ON_G, COLOR_PIXEL_ON_B);
 }
 
 /**
@@ -357,6 +635,8 @@ bool createSDLWindow()
     SDL_GL_SetAttribute(SDL_GL_BLUE_SIZE, 5);
     SDL_GL_SetAttribute(SDL_GL_DEPTH_SIZE, 0);
     SDL_GL_SetAttribute(SDL_GL_DOUBLEBUFFER, 1);
+    //presentation runs on its own thread and can wait for the display
+    SDL_GL_SetAttribute(SDL_GL_SWAP_CONTROL, 1);
 
     if(SDL_SetVideoMode(WINDOW_WIDTH, WINDOW_HEIGHT, 16, SDL_OPENGL) == NULL)
     {
@@ -369,6 +649,7 @@ bool createSDLWindow()
 
     return true;
 }
+#endif
 
 /**
  * Print helptext
@@ -380,8 +661,12 @@ void printHelp()
     printf("Written in C++ by Tommy Hellstrom at the University of Gavle,\n");
     printf("Sweden, 2009.\n\n");
     printf("USAGE:\n");
-    printf("\t%s file speed [tune]\n\n", APP_BINARY_NAME);
+    printf("\t%s [--aot] file speed [tune [cachedir]]\n\n", APP_BINARY_NAME);
     printf("WHERE:\n");
+    printf("\t--aot\n");
+    printf("\t  translates all code that can be found in the\n");
+    printf("\t  rom before starting, instead of when it is\n");
+    printf("\t  first executed.\n\n");
     printf("\tfile\n");
     printf("\t  is the rom to load.\n\n");
     printf("\tspeed\n");
@@ -394,6 +679,26 @@ void printHelp()
     printf("\t  emulation speed and smoothness.\n");
     printf("\t  The argument is optional, default value is %u.\n", DEFAULT_OPCOUNT);
     printf("\t  For most roms 5 to 20 are good values.\n");
+    printf("\tcachedir\n");
+    printf("\t  is a directory where translated code is saved\n");
+    printf("\t  on exit and loaded on start, so later runs of\n");
+    printf("\t  the same rom do not need to translate it again.\n");
+    printf("\t  The argument is optional.\n");
+#ifdef C8_HEADLESS
+    printf("\nHEADLESS OPTIONS:\n");
+    printf("\t--frames=N\n");
+    printf("\t  runs N frames of tune opcodes each, the timers\n");
+    printf("\t  count down once per frame. Default is %u.\n", DEFAULT_FRAMES);
+    printf("\t--ops=N\n");
+    printf("\t  runs at least N opcodes, rounded up to whole frames.\n");
+    printf("\t--seed=N\n");
+    printf("\t  seeds the random number generator with N instead\n");
+    printf("\t  of the time, for runs that can be compared.\n");
+    printf("\t--dump=PREFIX\n");
+    printf("\t  writes the final memory to PREFIX.mem, the registers\n");
+    printf("\t  to PREFIX.regs and the screen to PREFIX.pbm.\n\n");
+    printf("\tThe rom runs as fast as possible, speed is ignored.\n");
+#endif
 }
 
 /**
@@ -401,29 +706,75 @@ void printHelp()
  */
 int main(int argc, char *argv[])
 {
-    if(argc < 3)
+    char *args[4];
+    int argn = 0;
+    bool aot = false;
+    uint32_t seed = time(NULL);
+    uint32_t frames = DEFAULT_FRAMES;
+#ifdef C8_HEADLESS
+    uint32_t ops = 0;
+    const char *pDump = NULL;
+#endif
+
+    for(int i = 1; i < argc; i++)
+    {
+        if(strcmp(argv[i], "--aot") == 0)
+            aot = true;
+#ifdef C8_HEADLESS
+        else if(strncmp(argv[i], "--frames=", 9) == 0)
+            frames = strtoul(argv[i] + 9, NULL, 0);
+        else if(strncmp(argv[i], "--ops=", 6) == 0)
+            ops = strtoul(argv[i] + 6, NULL, 0);
+        else if(strncmp(argv[i], "--seed=", 7) == 0)
+            seed = strtoul(argv[i] + 7, NULL, 0);
+        else if(strncmp(argv[i], "--dump=", 7) == 0)
+            pDump = argv[i] + 7;
+#endif
+        else if(argn < 4)
+            args[argn++] = argv[i];
+    }
+
+    if(argn < 2)
     {
         printHelp();
         return 0;
     }
 
-    int delay = atoi(argv[2]);
+    int delay = atoi(args[1]);
     int opcount = DEFAULT_OPCOUNT;
 
-    if(argc >= 4)
-        opcount = atoi(argv[3]);
+    if(argn >= 3)
+        opcount = atoi(args[2]);
+
+    if(opcount < 1)
+        opcount = 1;
+
+#ifdef C8_HEADLESS
+    if(ops > 0)
+        frames = (ops + opcount - 1) / opcount;
+#endif
 
-    if (!c8_loadRom(argv[1]))
+    if (!c8_loadRom(args[0], seed))
     {
-        fprintf(stderr, "Could not open file: %s\n", argv[1]);
+        fprintf(stderr, "Could not open file: %s\n", args[0]);
         return 0;
     }
 
+#ifndef C8_HEADLESS
     if(!createSDLWindow())
         return 0;
 
-    dispatchLoop(delay, opcount);
+    dispatchLoop(delay, opcount, argn >= 4 ? args[3] : NULL, aot, frames);
 
     SDL_Quit();
+#else
+    dispatchLoop(delay, opcount, argn >= 4 ? args[3] : NULL, aot, frames);
+
+    if(pDump != NULL && !c8_dumpState(pDump))
+    {
+        fprintf(stderr, "Could not write state: %s\n", pDump);
+        return 1;
+    }
+#endif
     return 0;
 }
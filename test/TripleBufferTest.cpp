@@ -0,0 +1,227 @@
+/************************************************************
+  **** TripleBufferTest.cpp (triple buffer checks)
+   ***
+    ** Author:
+     *   Tommy Hellstrom
+     *
+     * Description:
+     *   Checks the order frames are handed over in by the
+     *   TripleBuffer, first from one thread and then with
+     *   a writer and a reader thread running at once.
+     *
+     * Revision history:
+     *   When         Who       What
+     *   20261016     me        created
+     *
+     * License information:
+     *   GPLv3
+     *
+     ********************************************************/
+
+#include <cstdio>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+
+#include "Chip8def.h"
+#include "Screen.h"
+#include "TripleBuffer.h"
+
+//frames published by the writer thread
+#define TEST_FRAMES 400000
+
+static TripleBuffer gFrames;
+static volatile bool gWriting;
+static int gFailures;
+
+/**
+ * Fill every row of a frame with the same value, so a frame
+ * mixed from two published frames can be seen
+ *
+ * PARAMS
+ * screen   the frame
+ * value    the value of every row
+ */
+void fillFrame(uint64_t screen[C8_RES_HEIGHT], const uint64_t value)
+{
+    for(int y = 0; y < C8_RES_HEIGHT; y++)
+        screen[y] = value;
+}
+
+/**
+ * Report a failed check
+ *
+ * PARAMS
+ * ok       result of the check
+ * pWhat    what was checked
+ */
+void check(const bool ok, const char *const pWhat)
+{
+    if(ok)
+        return;
+
+    printf("FAILED: %s\n", pWhat);
+    gFailures++;
+}
+
+/**
+ * Check that a frame is whole and get its value
+ *
+ * PARAMS
+ * screen   the frame
+ *
+ * RETURNS
+ * the value of the rows, or -1 if the rows differ
+ */
+int64_t frameValue(const uint64_t screen[C8_RES_HEIGHT])
+{
+    for(int y = 1; y < C8_RES_HEIGHT; y++)
+        if(screen[y] != screen[0])
+            return -1;
+
+    return (int64_t) screen[0];
+}
+
+/**
+ * Hand frames over from one thread
+ */
+void testOrder()
+{
+    TripleBuffer frames;
+    uint64_t screen[C8_RES_HEIGHT];
+
+    check(!frames.consume(), "nothing to take before the first publish");
+    check(frameValue(frames.getFront()) == 0, "the front starts blank");
+
+    fillFrame(screen, 1);
+    frames.publish(screen);
+    check(frames.consume() && frameValue(frames.getFront()) == 1, "a published frame is taken");
+    check(!frames.consume() && frameValue(frames.getFront()) == 1, "a frame is taken once");
+
+    fillFrame(screen, 2);
+    frames.publish(screen);
+    fillFrame(screen, 3);
+    frames.publish(screen);
+    check(frames.consume() && frameValue(frames.getFront()) == 3, "the newest frame replaces one not taken");
+    check(!frames.consume(), "the replaced frame is not taken later");
+
+    //a change that is reverted before the reader runs leaves the frame it had
+    fillFrame(screen, 4);
+    frames.publish(screen);
+    fillFrame(screen, 3);
+    frames.publish(screen);
+    check(frames.consume() && frameValue(frames.getFront()) == 3, "a reverted change hands over the reverted frame");
+
+    //every buffer is used, none of them may hold an old frame
+    for(uint64_t i = 5; i < 12; i++)
+    {
+        fillFrame(screen, i);
+        frames.publish(screen);
+
+        if(i & 1)
+            check(frames.consume() && frameValue(frames.getFront()) == (int64_t) i, "buffers are reused in order");
+    }
+
+    check(!frames.consume() && frameValue(frames.getFront()) == 11, "the last taken frame stays in front");
+
+    //the writer never draws in the frame the reader presents
+    for(uint64_t i = 12; i < 15; i++)
+    {
+        fillFrame(screen, i);
+        frames.publish(screen);
+        check(frameValue(frames.getFront()) == 11, "publishing leaves the taken frame alone");
+    }
+}
+
+/**
+ * Writer thread, publishes numbered frames
+ *
+ * PARAMS
+ * pData    not used
+ *
+ * RETURNS
+ * always NULL
+ */
+void *writeFrames(void *pData)
+{
+    uint64_t screen[C8_RES_HEIGHT];
+
+    for(uint64_t i = 1; i <= TEST_FRAMES; i++)
+    {
+        fillFrame(screen, i);
+        gFrames.publish(screen);
+
+        //some frames are taken and some are replaced before they are taken
+        if((i & 3) == 0)
+            sched_yield();
+    }
+
+    gWriting = false;
+
+    return NULL;
+}
+
+/**
+ * Take frames while another thread publishes them
+ */
+void testThreads()
+{
+    pthread_t writer;
+    int64_t last = 0;
+    int64_t taken = 0;
+    int torn = 0;
+    int reordered = 0;
+
+    gWriting = true;
+
+    if(pthread_create(&writer, NULL, writeFrames, NULL) != 0)
+    {
+        check(false, "the writer thread starts");
+        return;
+    }
+
+    //one more frame is taken after the writer is seen to be done
+    for(bool done = false; !done; )
+    {
+        done = !gWriting;
+
+        //the writer also gets to run on a single core
+        sched_yield();
+
+        if(!gFrames.consume())
+            continue;
+
+        const int64_t value = frameValue(gFrames.getFront());
+
+        if(value < 0)
+            torn++;
+        else if(value <= last)
+            reordered++;
+        else
+            last = value;
+
+        taken++;
+    }
+
+    pthread_join(writer, NULL);
+
+    check(last == TEST_FRAMES, "the last published frame is taken");
+    check(torn == 0, "no taken frame is mixed from two frames");
+    check(reordered == 0, "every taken frame is newer than the one before");
+    check(!gFrames.consume(), "the last frame is taken once");
+
+    printf("%lld of %d frames taken\n", (long long) taken, TEST_FRAMES);
+}
+
+int main()
+{
+    testOrder();
+    testThreads();
+
+    if(gFailures > 0)
+        return 1;
+
+    printf("TripleBuffer checks passed\n");
+
+    return 0;
+}
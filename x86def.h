@@ -28,6 +28,26 @@
 
 #define X86_MODRM_BYTE(mod, reg, rm) (((mod) << 6) | ((reg) << 3) | (rm))
 
+//SIB byte, index 4 means no index and base 5 with mod 00 means disp32 only
+#define X86_SIB_BYTE(scale, index, base) (((scale) << 6) | ((index) << 3) | (base))
+#define X86_SIB_NO_INDEX 4
+#define X86_SIB_NO_BASE  5
+
+//The generated code also runs in 64 bit mode. Registers are used with
+//32 bit operands and addresses are 32 bit immediates or displacements,
+//so the code and everything it addresses must be in the low 2GB.
+#ifdef __x86_64__
+#define X86_LONG_MODE
+#define X86_LONG_MODE_LIMIT 0x80000000u
+#endif
+
+//SSE2 is used when the emulator is built for it, always in 64 bit mode
+#ifdef __SSE2__
+#define X86_SSE2
+#endif
+
+#define X86_REG_XMM0 0
+
 //use 16 bit registers
 #define X86_PREFIX_REG16 0x66
 //16 bit indirect addresses